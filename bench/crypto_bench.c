@@ -0,0 +1,269 @@
+// Microbenchmark of the PoT crypto primitives, built as dpdk-pot-crypto-bench. It runs every
+// primitive on the calling lcore in a tight loop, so crypto regressions show up without a testbed:
+//
+//   dpdk-pot-crypto-bench --no-huge -l 0 -- --iterations 200000 --csv crypto.csv
+//   python3 make/scripts/plot.py crypto.csv
+//
+// Keys are random and published straight into the key store, no key or segment file is read.
+#include <getopt.h>
+#include <openssl/rand.h>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto.h"
+#include "headers.h"
+#include "keystore.h"
+#include "mac.h"
+#include "utils/logging.h"
+
+#define BENCH_DEFAULT_ITERATIONS 100000
+#define BENCH_MAX_BURST 256
+#define BENCH_MAX_POINTS 64
+
+// One sweep dimension, either given on the command line as a comma separated list or the default
+struct bench_points {
+  int nb;
+  int values[BENCH_MAX_POINTS];
+};
+
+struct bench_result {
+  const char* primitive;
+  const char* alg;
+  int segments;
+  int transits;
+  int burst;
+  uint64_t ops;
+  uint64_t cycles;
+};
+
+static uint64_t g_iterations = BENCH_DEFAULT_ITERATIONS;
+static FILE* g_csv = NULL;
+static volatile uint8_t g_sink; // keeps the compiler from dropping a result nobody reads
+
+static void bench_report(const struct bench_result* r) {
+  double cycles_per_op = (double)r->cycles / (double)r->ops;
+  double ops_per_sec = (double)rte_get_tsc_hz() / cycles_per_op;
+  printf("%-14s %-12s %8d %8d %6d %12.1f %14.0f\n", r->primitive, r->alg, r->segments, r->transits, r->burst,
+         cycles_per_op, ops_per_sec);
+  if (g_csv != NULL)
+    fprintf(g_csv, "%s,%s,%d,%d,%d,%" PRIu64 ",%.1f,%.0f\n", r->primitive, r->alg, r->segments, r->transits,
+            r->burst, r->ops, cycles_per_op, ops_per_sec);
+}
+
+static int parse_points(const char* arg, struct bench_points* points, int min, int max) {
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", arg);
+  points->nb = 0;
+  for (char* tok = strtok(buf, ","); tok != NULL; tok = strtok(NULL, ",")) {
+    int v = atoi(tok);
+    if (v < min || v > max || points->nb == BENCH_MAX_POINTS) return -1;
+    points->values[points->nb++] = v;
+  }
+  return points->nb > 0 ? 0 : -1;
+}
+
+static void default_points(struct bench_points* points, int first, int last) {
+  points->nb = 0;
+  for (int v = first; v <= last && points->nb < BENCH_MAX_POINTS; v++) points->values[points->nb++] = v;
+}
+
+static void usage(const char* prog) {
+  printf("Usage: %s [EAL options] -- [options]\n", prog);
+  printf("  --segments LIST    Segment counts of the MAC runs, 1..%d (default: all)\n", MAX_SEGMENTS);
+  printf("  --transits LIST    Transit counts of the PVF runs, 0..%d (default: 0..8)\n", MAX_POT_NODES - 1);
+  printf("  --bursts LIST      Burst sizes of the transit decrypt runs, 1..%d (default: 1,4,8,16,32,64)\n",
+         BENCH_MAX_BURST);
+  printf("  --iterations N     Operations per measurement (default: %d)\n", BENCH_DEFAULT_ITERATIONS);
+  printf("  --tag-len N        Tag bytes of the PVF and transit runs, 8, 16, 24 or 32 (default: %d)\n",
+         HMAC_MAX_LENGTH);
+  printf("  --csv FILE         Also write the results as CSV, for make/scripts/plot.py\n");
+  printf("  -h, --help         Show this help message\n");
+}
+
+// An SRH with nb_segments SIDs followed by an HMAC TLV, laid out as add_custom_header() does
+struct bench_srh {
+  struct ipv6_srh srh;
+  struct in6_addr segments[MAX_SEGMENTS];
+  struct hmac_tlv hmac;
+};
+
+static void bench_srh_init(struct bench_srh* b, int nb_segments) {
+  memset(b, 0, sizeof(*b));
+  b->srh.next_header = IPPROTO_UDP;
+  b->srh.hdr_ext_len = nb_segments * 2;
+  b->srh.routing_type = 4;
+  b->srh.segments_left = nb_segments - 1;
+  b->srh.last_entry = nb_segments - 1;
+  RAND_bytes((uint8_t*)b->segments, nb_segments * sizeof(struct in6_addr));
+  b->hmac.type = 5;
+  b->hmac.length = 38;
+  b->hmac.hmac_key_id = rte_cpu_to_be_32(POT_MAC_KEY_ID(g_pot_mac->alg, 0));
+}
+
+// Path authenticator of a new flow: the source changes every operation, so the flow cache never hits
+static void bench_mac(const struct pot_key_epoch* epoch, int nb_segments) {
+  struct bench_srh b;
+  uint8_t src[16], nonce[NONCE_LENGTH], out[HMAC_MAX_LENGTH];
+  bench_srh_init(&b, nb_segments);
+  RAND_bytes(src, sizeof(src));
+  RAND_bytes(nonce, sizeof(nonce));
+
+  struct bench_result r = {"mac", g_pot_mac->name, nb_segments, 0, 1, g_iterations, 0};
+  uint64_t start = rte_rdtsc_precise();
+  for (uint64_t i = 0; i < g_iterations; i++) {
+    memcpy(src + 12, &i, 4);
+    calculate_pot_mac(g_pot_mac, src, &b.srh, &b.hmac, &epoch->keys[0], nonce, out);
+    g_sink ^= out[0];
+  }
+  r.cycles = rte_rdtsc_precise() - start;
+  bench_report(&r);
+
+  // Deterministic MACs of a known flow come out of the per-lcore cache
+  if (g_pot_mac->needs_nonce) return;
+  r.primitive = "mac_cached";
+  start = rte_rdtsc_precise();
+  for (uint64_t i = 0; i < g_iterations; i++) {
+    calculate_pot_mac(g_pot_mac, src, &b.srh, &b.hmac, &epoch->keys[0], nonce, out);
+    g_sink ^= out[0];
+  }
+  r.cycles = rte_rdtsc_precise() - start;
+  bench_report(&r);
+}
+
+// Ingress onion encryption and egress onion decryption, all transit layers plus the egress one
+static void bench_pvf(const struct pot_key_epoch* epoch, int transits) {
+  uint8_t nonce[NONCE_LENGTH], pvf[HMAC_MAX_LENGTH];
+  RAND_bytes(nonce, sizeof(nonce));
+  RAND_bytes(pvf, sizeof(pvf));
+  num_transit_nodes = transits;
+
+  struct bench_result r = {"encrypt_pvf", "aes-256-ctr", 0, transits, 1, g_iterations, 0};
+  uint64_t start = rte_rdtsc_precise();
+  for (uint64_t i = 0; i < g_iterations; i++) encrypt_pvf(epoch, nonce, pvf, g_pot_tag_len);
+  r.cycles = rte_rdtsc_precise() - start;
+  bench_report(&r);
+
+  r.primitive = "decrypt_pvf";
+  start = rte_rdtsc_precise();
+  for (uint64_t i = 0; i < g_iterations; i++) decrypt_pvf(epoch, nonce, pvf, g_pot_tag_len);
+  r.cycles = rte_rdtsc_precise() - start;
+  g_sink ^= pvf[0];
+  bench_report(&r);
+}
+
+// The single layer a transit peels, once per packet with decrypt() and per burst with
+// decrypt_pvf_burst(); both report cycles per packet
+static void bench_transit(const struct pot_key_epoch* epoch, int burst) {
+  static uint8_t nonce_buf[BENCH_MAX_BURST][NONCE_LENGTH];
+  static uint8_t pvf_buf[BENCH_MAX_BURST][HMAC_MAX_LENGTH];
+  uint8_t* nonces[BENCH_MAX_BURST];
+  uint8_t* pvfs[BENCH_MAX_BURST];
+  RAND_bytes(&nonce_buf[0][0], sizeof(nonce_buf));
+  RAND_bytes(&pvf_buf[0][0], sizeof(pvf_buf));
+  for (int i = 0; i < burst; i++) {
+    nonces[i] = nonce_buf[i];
+    pvfs[i] = pvf_buf[i];
+  }
+
+  uint64_t rounds = g_iterations / burst > 0 ? g_iterations / burst : 1;
+  const struct pot_key* key = &epoch->keys[1];
+  struct bench_result r = {"decrypt", "aes-256-ctr", 0, 1, burst, rounds * burst, 0};
+  uint64_t start = rte_rdtsc_precise();
+  for (uint64_t i = 0; i < rounds; i++) {
+    for (int j = 0; j < burst; j++)
+      decrypt(pvfs[j], g_pot_tag_len, (unsigned char*)key->key, nonces[j], pvfs[j]);
+  }
+  r.cycles = rte_rdtsc_precise() - start;
+  bench_report(&r);
+
+  r.primitive = "decrypt_burst";
+  start = rte_rdtsc_precise();
+  for (uint64_t i = 0; i < rounds; i++) decrypt_pvf_burst(key, nonces, pvfs, burst, g_pot_tag_len);
+  r.cycles = rte_rdtsc_precise() - start;
+  g_sink ^= pvf_buf[0][0];
+  bench_report(&r);
+}
+
+int main(int argc, char* argv[]) {
+  int ret = rte_eal_init(argc, argv);
+  if (ret < 0) rte_exit(EXIT_FAILURE, "Failed to initialize EAL\n");
+  argc -= ret;
+  argv += ret;
+
+  // Logging from the primitives would be all that gets measured
+  g_logging_enabled = 0;
+
+  struct bench_points segments, transits, bursts;
+  default_points(&segments, 1, MAX_SEGMENTS);
+  default_points(&transits, 0, 8);
+  parse_points("1,4,8,16,32,64", &bursts, 1, BENCH_MAX_BURST);
+
+  static struct option long_options[] = {{"segments", required_argument, 0, 's'},
+                                         {"transits", required_argument, 0, 't'},
+                                         {"bursts", required_argument, 0, 'b'},
+                                         {"iterations", required_argument, 0, 'i'},
+                                         {"tag-len", required_argument, 0, 'l'},
+                                         {"csv", required_argument, 0, 'c'},
+                                         {"help", no_argument, 0, 'h'},
+                                         {0, 0, 0, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 's':
+      if (parse_points(optarg, &segments, 1, MAX_SEGMENTS) < 0) rte_exit(EXIT_FAILURE, "Invalid --segments\n");
+      break;
+    case 't':
+      if (parse_points(optarg, &transits, 0, MAX_POT_NODES - 1) < 0) rte_exit(EXIT_FAILURE, "Invalid --transits\n");
+      break;
+    case 'b':
+      if (parse_points(optarg, &bursts, 1, BENCH_MAX_BURST) < 0) rte_exit(EXIT_FAILURE, "Invalid --bursts\n");
+      break;
+    case 'i':
+      g_iterations = strtoull(optarg, NULL, 10);
+      if (g_iterations == 0) rte_exit(EXIT_FAILURE, "Invalid --iterations\n");
+      break;
+    case 'l':
+      if (!POT_TAG_LEN_VALID(atoi(optarg))) rte_exit(EXIT_FAILURE, "Invalid --tag-len\n");
+      g_pot_tag_len = (uint8_t)atoi(optarg);
+      break;
+    case 'c':
+      g_csv = fopen(optarg, "w");
+      if (g_csv == NULL) rte_exit(EXIT_FAILURE, "Cannot open %s\n", optarg);
+      break;
+    case 'h':
+    default: usage(argv[0]); rte_exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE, "\n");
+    }
+  }
+
+  static uint8_t keys[MAX_POT_NODES + 1][POT_KEY_LENGTH];
+  RAND_bytes(&keys[0][0], sizeof(keys));
+  if (keystore_publish(keys, MAX_POT_NODES + 1) < 0) rte_exit(EXIT_FAILURE, "Failed to publish the bench keys\n");
+  g_key_count = MAX_POT_NODES + 1;
+  const struct pot_key_epoch* epoch = keystore_current();
+
+  printf("TSC %" PRIu64 " Hz, %" PRIu64 " operations per measurement, %u byte PVFs, lcore %u\n", rte_get_tsc_hz(),
+         g_iterations, g_pot_tag_len, rte_lcore_id());
+  printf("%-14s %-12s %8s %8s %6s %12s %14s\n", "primitive", "alg", "segments", "transits", "burst", "cycles/op",
+         "ops/s");
+  if (g_csv != NULL) fprintf(g_csv, "primitive,alg,segments,transits,burst,ops,cycles_per_op,ops_per_sec\n");
+
+  for (int alg = 0; alg < POT_MAC_COUNT; alg++) {
+    pot_mac_configure(alg);
+    if (g_pot_mac->alg != alg) continue; // not provided by this OpenSSL
+    for (int i = 0; i < segments.nb; i++) bench_mac(epoch, segments.values[i]);
+  }
+  for (int i = 0; i < transits.nb; i++) bench_pvf(epoch, transits.values[i]);
+  for (int i = 0; i < bursts.nb; i++) bench_transit(epoch, bursts.values[i]);
+
+  if (g_csv != NULL) fclose(g_csv);
+  hmac_cache_free();
+  crypto_ctx_pool_free();
+  pot_mac_free();
+  keystore_free();
+  rte_eal_cleanup();
+  return 0;
+}
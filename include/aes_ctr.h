@@ -0,0 +1,59 @@
+#ifndef AES_CTR_H
+#define AES_CTR_H
+
+#include <rte_common.h>
+#include <stdint.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES256_ROUNDS 14
+
+// Expanded AES-256 encryption key schedule, laid out the way the AES-NI round instructions consume it
+struct aes256_round_keys {
+  uint8_t rk[AES256_ROUNDS + 1][AES_BLOCK_SIZE];
+} __rte_aligned(16);
+
+// Returns 1 if the CPU has the AES round instructions needed by the kernels below. When it does
+// not, callers are expected to stay on the OpenSSL EVP path.
+int aes_ctr_accel_available(void);
+
+// Expands a 32-byte AES-256 key into its round keys, only valid when aes_ctr_accel_available()
+void aes256_expand_key(const uint8_t key[32], struct aes256_round_keys* rk);
+
+/**
+ * Applies the AES-256-CTR keystreams of nb_keys keys, all under the same IV, to a 32-byte (two block)
+ * buffer in place.
+ *
+ * CTR layers with a shared IV commute, so an onion of nb_keys encryptions is the plaintext XORed with
+ * every layer's keystream. The keystreams are generated in one interleaved pass with the rounds of
+ * several keys in flight, then XORed into data once. The result is byte-for-byte what chaining
+ * nb_keys EVP_aes_256_ctr() calls would produce, so any single layer can still be peeled off with a
+ * plain decrypt().
+ *
+ * @param rks      Round keys, one pointer per layer.
+ * @param nb_keys  Number of layers to apply.
+ * @param iv       16-byte initial counter block (the PoT nonce).
+ * @param data     Buffer that is encrypted/decrypted in place, only its first len bytes are touched.
+ * @param len      8, 16, 24 or 32 bytes; up to 16 only one counter block is generated per key.
+ */
+void aes256_ctr_xor_layers(const struct aes256_round_keys* const rks[], int nb_keys,
+                           const uint8_t iv[AES_BLOCK_SIZE], uint8_t* data, unsigned len);
+
+/**
+ * Multi-buffer AES-256-CTR over a burst: nb independent buffers of len bytes (8, 16, 24 or 32) under
+ * the same key, each with its own IV, encrypted/decrypted in place.
+ *
+ * Packets are processed in groups whose AES rounds are interleaved, so 8 to 16 independent block
+ * pipelines hide the latency of the round instructions. The kernel (AES-NI, VAES-256 or VAES-512) is
+ * picked on first use from the CPU flags and the EAL max SIMD bitwidth. Each buffer ends up exactly
+ * as a per-packet decrypt() with the same key and IV would leave it.
+ *
+ * @param rk    Round keys shared by the whole burst.
+ * @param ivs   Per-buffer 16-byte IVs (PoT nonces).
+ * @param data  Per-buffer data (PVFs), modified in place.
+ * @param nb    Number of buffers.
+ * @param len   Bytes per buffer, nothing past them is touched.
+ */
+void aes256_ctr_xor_burst(const struct aes256_round_keys* rk, uint8_t* const ivs[], uint8_t* const data[],
+                          uint16_t nb, unsigned len);
+
+#endif // AES_CTR_H
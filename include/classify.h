@@ -0,0 +1,21 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include <rte_mbuf.h>
+#include <stdint.h>
+
+/**
+ * Splits a received burst on the header fields every PoT packet shares: a unicast destination MAC,
+ * the IPv6 EtherType and an SRv6 SRH (next_header 61, routing_type 4) right after the IPv6 header,
+ * or with the IOAM carrier a Hop-by-Hop header whose first option after the PadN is IOAM.
+ * The fields of all packets are gathered first and then compared several packets per instruction,
+ * so junk costs one header load and a fraction of a compare.
+ *
+ * Indexes of the packets that pass go to accept[], those of the others to drop[], both in burst
+ * order. Each array must have room for nb_pkts entries. No packet is freed.
+ *
+ * @return the number of accepted packets, the remaining nb_pkts minus that many are in drop[].
+ */
+uint16_t pot_classify_burst(struct rte_mbuf* const pkts[], uint16_t nb_pkts, uint16_t accept[], uint16_t drop[]);
+
+#endif // CLASSIFY_H
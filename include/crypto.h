@@ -9,28 +9,67 @@
 #include <string.h>
 
 #include "headers.h"
+#include "keystore.h"
 
 #define HMAC_MAX_LENGTH 32
 #define NONCE_LENGTH 16
 #define SID_NO 4
 #define HMAC_KEY_HEX_LENGTH (HMAC_MAX_LENGTH * 2)
 
-extern uint8_t k_pot_in[MAX_POT_NODES + 1][HMAC_MAX_LENGTH];
+// Per-lcore flow HMAC cache geometry, the size must be a power of two. Inputs longer than
+// HMAC_CACHE_MAX_INPUT (source, last_entry, flags, reserved, key id and MAX_SEGMENTS SIDs) are
+// never cached.
+#define HMAC_CACHE_SIZE 64
+#define HMAC_CACHE_MAX_INPUT (24 + MAX_SEGMENTS * 16)
+
+// Number of keys in the key set loaded last, the keys themselves live in the key store (keystore.h)
 extern uint8_t g_key_count;
 extern int num_transit_nodes;
 
 // HMAC calculation
 int calculate_hmac(uint8_t* src_addr, const struct ipv6_srh* srh, const struct hmac_tlv* hmac_tlv,
                    uint8_t* key, size_t key_len, uint8_t* hmac_out);
+// Path authenticator with the configurable algorithm (see mac.h), over the same message as
+// calculate_hmac(). nonce is the packet's PoT nonce, only used by algorithms that need one.
+struct pot_mac_ops;
+int calculate_pot_mac(const struct pot_mac_ops* mac, uint8_t* src_addr, const struct ipv6_srh* srh,
+                      const struct hmac_tlv* hmac_tlv, const struct pot_key* key, const uint8_t* nonce,
+                      uint8_t* mac_out);
+// The same over a message the caller laid out, for carriers without an SRH (see ioam.h)
+int calculate_pot_mac_input(const struct pot_mac_ops* mac, const struct pot_key* key, const uint8_t* nonce,
+                            const uint8_t* input, size_t input_len, uint8_t* mac_out);
+// Lays out the message calculate_hmac() authenticates into input, for backends that run the HMAC
+// themselves. Returns its length, or 0 if it does not fit in input_size bytes.
+size_t hmac_input_build(const uint8_t* src_addr, const struct ipv6_srh* srh, const struct hmac_tlv* hmac_tlv,
+                        uint8_t* input, size_t input_size);
+// Upper bound of the HMAC message: 24 fixed bytes plus the largest segment list an SRH can carry
+#define HMAC_INPUT_MAX_LENGTH (24 + 255 * 8)
+
+// Flow HMAC cache: calculate_hmac() serves repeated inputs from it. Must be invalidated whenever the
+// keys or the segment list are reloaded, load_pot_keys() and load_srh_segments() do so themselves.
+// Keys from the key store are hashed from their precomputed midstates, any other key with HMAC().
+void hmac_cache_invalidate(void);
+void hmac_cache_free(void);
 
 int generate_nonce(uint8_t nonce[NONCE_LENGTH]);
 int encrypt(unsigned char* plaintext, int plaintext_len, unsigned char* key, unsigned char* iv,
             unsigned char* ciphertext);
 int decrypt(unsigned char* ciphertext, int ciphertext_len, unsigned char* key, unsigned char* iv,
             unsigned char* plaintext);
-void encrypt_pvf(uint8_t k_pot_in[SID_NO][HMAC_MAX_LENGTH], uint8_t* nonce, uint8_t hmac_out[32]);
-int decrypt_pvf(uint8_t k_pot_in[SID_NO][HMAC_MAX_LENGTH], uint8_t* nonce, uint8_t pvf_out[32]);
-int compare_hmac(struct hmac_tlv* hmac, uint8_t* hmac_out, struct rte_mbuf* mbuf);
+
+// Per-lcore pool of pre-keyed AES-256-CTR contexts. aes_ctr_crypt() runs CTR with the context keyed
+// for a key store entry, only re-IVing it per call; encrypt() and decrypt() route through it
+// whenever the key they get points into the key store (see keystore_key_of()).
+int aes_ctr_crypt(const struct pot_key* key, const uint8_t* iv, const uint8_t* in, int len, uint8_t* out);
+void crypto_ctx_pool_free(void);
+
+// Onion-encrypt/decrypt the first tag_len bytes of a PVF with keys 0..num_transit_nodes of a key
+// store epoch, the bytes past the tag are left alone
+int encrypt_pvf(const struct pot_key_epoch* epoch, uint8_t* nonce, uint8_t* hmac_out, uint8_t tag_len);
+int decrypt_pvf(const struct pot_key_epoch* epoch, uint8_t* nonce, uint8_t* pvf_out, uint8_t tag_len);
+// Peels the layer of one key off a burst of PVFs in place, each PVF with its own nonce
+int decrypt_pvf_burst(const struct pot_key* key, uint8_t* const nonces[], uint8_t* const pvfs[], uint16_t nb,
+                      uint8_t tag_len);
 int load_pot_keys(const char* filepath, int keys_to_load);
 void log_hex_data(const char* label, const uint8_t* data, size_t len);
 /**
@@ -0,0 +1,62 @@
+#ifndef CRYPTODEV_H
+#define CRYPTODEV_H
+
+#include <rte_mbuf.h>
+#include <stdint.h>
+
+#include "keystore.h"
+
+// Optional rte_cryptodev backend for the PoT crypto, selected with --crypto-backend cryptodev. The EVP
+// path stays the default; this one runs the same AES-256-CTR layers and HMAC-SHA256 as crypto ops on
+// the first cryptodev of the EAL, so software PMDs (--vdev crypto_aesni_mb, --vdev crypto_openssl)
+// work as well as hardware accelerators.
+//
+// Work is submitted per packet as a job and completes asynchronously: jobs are staged on the calling
+// lcore, enqueued as bursts on its queue pair by pot_cryptodev_poll(), and their completion callback
+// runs from a later pot_cryptodev_poll() on the same lcore once the device returns the ops.
+
+// Completion callback of a job. ok is 0 if any op of the job failed or could not be enqueued, the
+// callback then owns the packet and is expected to free it. digest points at the HMAC-SHA256 result
+// for jobs with an HMAC step (NULL otherwise) and is only valid for the duration of the call.
+typedef void (*pot_cryptodev_done_fn)(struct rte_mbuf* m, const uint8_t* digest, int ok);
+
+/**
+ * One packet's worth of PoT crypto. The cipher steps run first, in key order, then the HMAC step;
+ * ops of a job are enqueued back to back on one queue pair, so they execute in that order.
+ *
+ * epoch                 Key store epoch the packet names, every key index below refers to it.
+ * first_key, nb_cipher  AES-256-CTR with keys first_key .. first_key + nb_cipher - 1 applied in
+ *                       place to the pvf_len byte PVF found pvf_offset bytes into the packet data.
+ * nonce                 16-byte CTR IV shared by every cipher step.
+ * hmac_input            HMAC-SHA256 message (see hmac_input_build()) keyed with key hmac_key,
+ *                       NULL for jobs without an HMAC step.
+ */
+struct pot_cryptodev_job {
+  const struct pot_key_epoch* epoch;
+  uint8_t first_key;
+  uint8_t nb_cipher;
+  uint16_t pvf_offset;
+  uint8_t pvf_len;
+  const uint8_t* nonce;
+  uint8_t hmac_key;
+  uint16_t hmac_input_len;
+  const uint8_t* hmac_input;
+  pot_cryptodev_done_fn done;
+};
+
+// Sets up the first available cryptodev with one queue pair per lcore and a cipher and an HMAC
+// session per key of every key store epoch. Must run after the keys are loaded; sessions of later
+// epochs are created by a key store publish callback before the epoch goes live. Returns 0 on
+// success, -1 on error.
+int pot_cryptodev_init(void);
+void pot_cryptodev_close(void);
+
+// Stages a job for the calling lcore. Returns 0 if it was staged, in which case the callback will
+// eventually run exactly once; -1 if it could not be, in which case the packet is still the caller's.
+int pot_cryptodev_submit(struct rte_mbuf* m, const struct pot_cryptodev_job* job);
+
+// Enqueues the staged jobs of the calling lcore and runs the callbacks of completed ones. Called
+// from the forwarding loop on every iteration, including idle ones.
+void pot_cryptodev_poll(void);
+
+#endif // CRYPTODEV_H
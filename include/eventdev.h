@@ -0,0 +1,47 @@
+#ifndef EVENTDEV_H
+#define EVENTDEV_H
+
+#include <rte_mbuf.h>
+#include <stdint.h>
+
+// Event scheduling mode, selected with --eventdev <workers>. The parse, crypto and TX stages become
+// event queues of an rte_eventdev, the event_sw software PMD, so it runs wherever the EAL does. Parse
+// and crypto are atomic queues keyed by a flow hash: any worker lcore can pick up any flow, the
+// scheduler balances them by load, and a flow is only ever on one lcore at a time and keeps its
+// order. The NIC TX queue is not multi-thread safe, so TX is a single-link queue drained by one TX
+// lcore; the atomic stages before it feed it each flow in order.
+//
+// The RX lcore receives, hashes every packet's flow into mbuf->hash.rss and injects it as a new
+// event. It also runs the software scheduler's service between bursts.
+#define POT_EVDEV_NAME "event_sw0"
+// Every worker has an event port next to the RX and TX ones, event_sw has at most 64
+#define POT_EVDEV_MAX_WORKERS 62
+// Events in flight in the device, what the RX lcore cannot inject beyond that is dropped
+#define POT_EVDEV_NB_EVENTS 4096
+#define POT_EVDEV_NB_FLOWS 1024
+#define POT_EVDEV_BURST 32
+
+enum pot_evdev_queue {
+  POT_EVDEV_Q_PARSE = 0, // atomic, transit and egress find the PoT headers, the ingress skips it
+  POT_EVDEV_Q_CRYPTO,    // atomic, the role handlers
+  POT_EVDEV_Q_TX,        // single link to the TX lcore
+  POT_EVDEV_NB_QUEUES,
+};
+
+// Number of worker lcores, 0 unless the event scheduling mode is enabled
+extern int g_eventdev_workers;
+
+// Creates the event_sw device with its queues and one port per RX, worker and TX lcore, and starts
+// it. Needs nb_workers + 2 worker lcores, returns -1 if there are fewer or the device cannot be set up.
+int pot_eventdev_init(unsigned nb_workers);
+void pot_eventdev_close(void);
+// Mbufs the device can hold on top of what the ports need
+unsigned pot_eventdev_mbufs_needed(void);
+// Launches the RX lcore, the workers and the TX lcore on the ports, {RX, TX}, and waits for them
+void pot_eventdev_launch(uint16_t* ports);
+
+// Called on the way out of a role handler. On a worker lcore the frame is taken for the TX stage and
+// 1 returned, on any other lcore it returns 0 and the caller sends the frame itself.
+int pot_eventdev_tx_stage(struct rte_mbuf* mbuf, uint16_t tx_port_id);
+
+#endif // EVENTDEV_H
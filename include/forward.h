@@ -22,10 +22,47 @@
 #include <stdalign.h>
 #include <stdint.h>
 
+#include "utils/role.h"
+
 #define BURST_SIZE 256
 
+// Packets send_packet_to() collects per lcore and port before they go to the NIC in one burst. A
+// buffer is flushed when it fills up, at the end of every forwarding loop iteration, and while the
+// RX port is idle at least every TX_DRAIN_US microseconds, so crypto completions are not held back.
+#define TX_BUFFER_SIZE BURST_SIZE
+#define TX_DRAIN_US 100
+// How often a burst the TX ring did not take completely is offered again before the rest is dropped
+#define TX_MAX_RETRIES 4
+
+// What one forwarding lcore works on: queue_id of the RX port, and the TX queue of the same index on
+// every port it sends to, so no two lcores ever share a queue
+struct lcore_queue_conf {
+  uint16_t rx_port;
+  uint16_t tx_port;
+  uint16_t queue_id;
+};
+
+// Hands a burst to the handler of the node's role, which forwards or frees every packet
+void forward_burst(enum role role, struct rte_mbuf** pkts, uint16_t nb_pkts, uint16_t rx_port_id);
+// Takes the lcore's struct lcore_queue_conf
 int lcore_main_forward(void* arg);
+// Starts one forwarding lcore per queue pair, ports holds the RX and the TX port
 void launch_lcore_forwarding(uint16_t* ports);
+struct l2_rewrite;
+struct next_hop_entry;
+
+// Rewrites the Ethernet addresses and queues the packet on this lcore's TX buffer of the port
 void send_packet_to(struct rte_ether_addr mac_addr, struct rte_mbuf* mbuf, uint16_t tx_port_id);
+// The same for a next hop, with the L2 header precomputed for it when tx_port_id is the port it
+// was built for
+void send_packet_to_hop(const struct next_hop_entry* hop, struct rte_mbuf* mbuf, uint16_t tx_port_id);
+// Lays out dst and tx_port_id's cached MAC as the L2 header of a frame sent out of that port
+void l2_rewrite_build(struct l2_rewrite* l2, const struct rte_ether_addr* dst, uint16_t tx_port_id);
+// Queues a frame whose L2 header is already written on this lcore's TX buffer of the port
+void tx_buffer_packet(struct rte_mbuf* mbuf, uint16_t tx_port_id);
+// Sends everything this lcore has buffered, on every port
+void tx_buffers_flush(void);
+// Packets this lcore had to drop after TX_MAX_RETRIES attempts
+uint64_t tx_buffers_dropped(void);
 
 #endif // FORWARD_H
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include <rte_mbuf_core.h>
 #include <rte_mbuf_dyn.h>
 #include <stdalign.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // This is also a hard limit for the number of segments that can be defined and placed in the
@@ -34,13 +35,56 @@
 extern struct in6_addr *g_segments;
 extern int g_segment_count;
 
+// Compressed SIDs, the uSID flavour of NEXT-C-SID. Every SID of the list is a locator block of
+// g_csid_block_len bits shared by all of them, a 16-bit uSID and zeros. The SRH then carries
+// containers of the block followed by as many uSIDs as fit, zero padded after the last one, and
+// each node shifts the next uSID into the IPv6 destination instead of copying a 16-byte segment.
+// 0 sends full SIDs.
+#define POT_CSID_USID_LEN 16
+#define POT_CSID_BLOCK_MIN 16
+#define POT_CSID_BLOCK_MAX 96
+extern int g_csid_block_len;
+
+// Truncated tags. The HMAC and the PVF carry the first g_pot_tag_len bytes of the 32-byte MAC
+// field, a multiple of 8 between 8 and 32 set with --tag-len. The TLV length fields give the tag
+// length on the wire, the fields past it are not sent, so the TLVs shrink with the tag.
+#define POT_TAG_LEN_MIN 8
+#define POT_TAG_LEN_VALID(len) ((len) >= POT_TAG_LEN_MIN && (len) <= HMAC_MAX_LENGTH && (len) % 8 == 0)
+extern uint8_t g_pot_tag_len;
+
+// SRH flag marking a segment list of C-SID containers. The flags are part of the HMAC input, so it
+// cannot be flipped on the way.
+#define POT_SRH_FLAG_CSID 0x01
+
+// H.Encaps instead of SRH insertion. The ingress puts an outer IPv6 header with the SRH and TLVs in
+// front of the packet, which travels unchanged inside it, and the egress takes the outer header off
+// again. Packets say which they are with this SRH flag, so only the ingress has to be configured.
+#define POT_SRH_FLAG_ENCAP 0x02
+extern int g_srv6_encap;
+
+// What carries the PoT data, set with --carrier. The SRH carrier is the default, the IOAM carrier
+// (see ioam.h) replaces the SRH and TLVs with one Hop-by-Hop option and has no segment list.
+enum pot_carrier {
+  POT_CARRIER_SRH = 0,
+  POT_CARRIER_IOAM = 1,
+};
+extern int g_pot_carrier;
+
 extern int operation_bypass_bit;
 extern int tsc_dynfield_offset;
 typedef uint64_t tsc_t;
 
+// Destination and source MAC of a frame as they go on the wire, followed by 4 bytes the rewrite
+// leaves alone (EtherType and the start of the IPv6 header), so it can be put in with one 16-byte store
+struct l2_rewrite {
+  alignas(16) uint8_t bytes[16];
+};
+
 struct next_hop_entry {
   struct in6_addr ipv6;
   struct rte_ether_addr mac;
+  uint16_t l2_port;      // TX port l2 was built for, UINT16_MAX before next_hops_build_l2()
+  struct l2_rewrite l2;  // this hop's MAC behind l2_port's
 };
 
 static struct next_hop_entry next_hops[MAX_NEXT_HOPS];
@@ -79,8 +123,68 @@ struct pot_tlv {
   uint8_t encrypted_hmac[32]; // Encrypted HMAC (variable length)
 };
 
-void add_custom_header(struct rte_mbuf* pkt);
-void remove_headers(struct rte_mbuf* pkt);
+// Wire sizes of the TLVs for a tag of tag_len bytes, and the values of their length fields, which
+// do not count the type and length bytes
+#define HMAC_TLV_SIZE(tag_len) (offsetof(struct hmac_tlv, hmac_value) + (tag_len))
+#define POT_TLV_SIZE(tag_len) (offsetof(struct pot_tlv, encrypted_hmac) + (tag_len))
+#define HMAC_TLV_LENGTH(tag_len) (HMAC_TLV_SIZE(tag_len) - 2)
+#define POT_TLV_LENGTH(tag_len) (POT_TLV_SIZE(tag_len) - 2)
+
+// Verdict of parse_pot_burst() for a packet that passed the burst classifier, see classify.h
+enum pot_pkt_verdict {
+  POT_PKT_OK = 0,
+  POT_PKT_BAD_SRH,     // last_entry points past the segment list
+  POT_PKT_TRUNCATED,   // SRH and TLVs not within the first segment
+  POT_PKT_NO_CSID,     // compressed segment list but no --csid-block configured
+  POT_PKT_BAD_TAG,     // HMAC/PoT TLV lengths do not describe a valid tag
+  POT_PKT_BAD_IOAM,    // Hop-by-Hop header is not the IOAM PoT layout
+};
+
+// Where a received packet's PoT headers are, all offsets from the start of the frame. Filled in
+// once per burst right after RX so the role handlers never walk the headers again. For the IOAM
+// carrier the three header offsets all point at the Hop-by-Hop header.
+struct pot_pkt_meta {
+  uint16_t srh_off;
+  uint16_t hmac_off;
+  uint16_t pot_off;
+  uint16_t payload_off; // first byte after the PoT TLV
+  uint8_t nb_segments;
+  uint8_t tag_len;      // HMAC and PVF bytes carried in the TLVs
+  uint8_t verdict;      // enum pot_pkt_verdict
+  uint8_t carrier;      // enum pot_carrier
+};
+
+extern int pot_meta_dynfield_offset;
+static inline struct pot_pkt_meta* pot_meta(struct rte_mbuf* mbuf) {
+  return RTE_MBUF_DYNFIELD(mbuf, pot_meta_dynfield_offset, struct pot_pkt_meta*);
+}
+
+// Parses the Ethernet, IPv6, SRH, HMAC and PoT layout of every packet of a burst of at most BURST_SIZE
+// into its metadata. Packets that are not valid PoT packets are freed and the rest moved to the front
+// of pkts, in order. Returns how many are left.
+uint16_t parse_pot_burst(struct rte_mbuf** pkts, uint16_t nb_pkts);
+// Human readable reason for a verdict, for the drop logs
+const char* pot_pkt_verdict_str(uint8_t verdict);
+
+// Inserts the SRH, HMAC and PoT TLVs after the IPv6 header, or with g_srv6_encap set after a new
+// outer IPv6 header, or the IOAM Hop-by-Hop header for that carrier. The packet may come back as a
+// new head mbuf with the original chained behind it. Returns -1 if the packet was dropped (and freed).
+int add_custom_header(struct rte_mbuf** pkt);
+// Hash of the 5-tuple of a plain IPv6 packet: addresses and next header, plus the ports when TCP or
+// UDP follows the IPv6 header directly. The ingress derives the flow label it stamps from it.
+uint32_t ipv6_flow_tuple_hash(const struct rte_mbuf* pkt);
+// Strips the SRH and TLVs or the Hop-by-Hop header again at the egress, or decapsulates the inner
+// packet. Returns -1 if the packet was dropped (and freed).
+int remove_headers(struct rte_mbuf* pkt);
+// Returns the SRH and the HMAC/PoT TLVs that follow it for a packet whose metadata says it carries them
+void locate_pot_tlvs(struct rte_mbuf* pkt, struct ipv6_srh** srh, struct hmac_tlv** hmac, struct pot_tlv** pot);
+// Moves the IPv6 destination on to the next SID of the SRH: the next uSID of the active container,
+// or the next segment. Returns -1 if the segment list is exhausted.
+int srh_advance(struct ipv6_srh* srh, uint8_t nb_segments, struct in6_addr* dst);
+// The full SID the IPv6 destination currently points at, for the next hop lookup
+void srh_active_sid(const struct ipv6_srh* srh, const struct in6_addr* dst, struct in6_addr* sid);
+// The SID the segment list ends at, the destination the UDP checksum is relative to on the way
+void srh_final_sid(const struct ipv6_srh* srh, uint8_t nb_segments, struct in6_addr* sid);
 int load_srh_segments(const char* filepath);
 void free_srh_segments(void);
 
@@ -18,13 +18,18 @@
 #define NUM_MBUFS 8191
 #define MBUF_CACHE_SIZE 250
 #define EXTRA_SPACE 128
+// How often the EAL alarm thread checks whether SIGHUP asked for a key reload
+#define KEY_RELOAD_POLL_US 200000
 
 int init_eal(int argc, char* argv[]);
 void init_ports(uint16_t port_id, struct rte_mempool* mbuf_pool, PortRole role);
 int init_logging(const char* log_dir, const char* component_name, int log_level);
 struct rte_mempool* init_mempool();
 int init_topology(AppConfig* app_config);
+// Reloads POT_KEYS_FILE on SIGHUP and publishes it as a new key store epoch while forwarding runs
+int init_key_rotation(void);
 void init_lookup_table();
 void register_tsc_dynfield();
+void register_pot_meta_dynfield();
 
 #endif // INIT_H
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef IOAM_H
+#define IOAM_H
+
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "headers.h"
+
+// IOAM Proof-of-Transit carrier, selected with --carrier ioam. Instead of the SRH with its HMAC and
+// PoT TLVs the ingress inserts an IPv6 Hop-by-Hop header holding an IOAM POT option (RFC 9197, in
+// IPv6 as RFC 9486 has it) with the key set, the nonce and the PVF. There is no segment list, packets
+// are forwarded on their destination, and since the header only holds a PadN and that one option
+// every field is at a fixed offset behind the IPv6 header.
+#define IOAM_HBH_OPT_PADN 1
+#define IOAM_HBH_OPT_IOAM 0x31 // skip if unknown, data may change en route
+#define IOAM_OPT_TYPE_POT 2
+// POT type 0 is a 64-bit random and cumulative value pair, the nonce and PVF need a layout of their own
+#define IOAM_POT_TYPE_PVF 0x80
+#define IOAM_NAMESPACE_DEFAULT 0
+
+struct ioam_pot_hbh {
+  uint8_t next_header;  // protocol of the original payload
+  uint8_t hdr_ext_len;  // length in 8-byte units, not counting the first 8 bytes
+  uint8_t padn_type;    // PadN, aligns the IOAM option to 8 bytes
+  uint8_t padn_len;
+  uint8_t padn[4];
+  uint8_t opt_type;     // IOAM_HBH_OPT_IOAM
+  uint8_t opt_len;      // option data bytes, from reserved to the end of the PVF
+  uint8_t reserved;
+  uint8_t ioam_type;    // IOAM_OPT_TYPE_POT
+  uint16_t namespace_id;
+  uint8_t pot_type;     // IOAM_POT_TYPE_PVF
+  uint8_t pot_flags;
+  uint32_t key_set_id;  // key store epoch, as pot_tlv.key_set_id
+  uint32_t mac_key_id;  // MAC algorithm and key, as hmac_tlv.hmac_key_id
+  uint8_t nonce[16];
+  uint8_t pvf[32];      // only the first tag_len bytes are carried
+};
+
+// Wire size of the Hop-by-Hop header and value of its IOAM option length for a tag of tag_len bytes.
+// Tags are a multiple of 8, and so is the header.
+#define IOAM_POT_HBH_SIZE(tag_len) (offsetof(struct ioam_pot_hbh, pvf) + (tag_len))
+#define IOAM_POT_OPT_LEN(tag_len) (IOAM_POT_HBH_SIZE(tag_len) - offsetof(struct ioam_pot_hbh, reserved))
+
+// What the path MAC of an IOAM packet covers: source, destination, original protocol, namespace
+// and POT type, and the MAC key id
+#define IOAM_MAC_INPUT_LENGTH 40
+
+// Writes the header add_custom_header() stamps into every packet, with zeroed ids, nonce and PVF
+void ioam_template_init(struct ioam_pot_hbh* hbh, uint8_t tag_len);
+// Second stage of the RX parse for the IOAM carrier, returns an enum pot_pkt_verdict
+uint8_t parse_ioam_packet(struct rte_mbuf* pkt, struct pot_pkt_meta* meta);
+// Takes the Hop-by-Hop header off a verified packet again, called through remove_headers()
+int remove_ioam_header(struct rte_mbuf* pkt);
+// Lays out the message the path MAC authenticates, returns its length or 0 if it does not fit
+size_t ioam_mac_input_build(const struct rte_ipv6_hdr* ipv6, const struct ioam_pot_hbh* hbh, uint8_t* input,
+                            size_t input_size);
+
+// The IOAM option of a packet whose metadata says it carries one
+static inline struct ioam_pot_hbh* ioam_pot_of(struct rte_mbuf* pkt) {
+  return rte_pktmbuf_mtod_offset(pkt, struct ioam_pot_hbh*, pot_meta(pkt)->pot_off);
+}
+
+#endif // IOAM_H
@@ -0,0 +1,86 @@
+#ifndef KEYSTORE_H
+#define KEYSTORE_H
+
+#include <openssl/sha.h>
+#include <rte_common.h>
+#include <rte_lcore.h>
+#include <rte_rcu_qsbr.h>
+#include <stdint.h>
+
+#include "aes_ctr.h"
+#include "headers.h"
+
+#define POT_KEY_LENGTH 32
+#define POT_KEY_EPOCHS 2
+
+// Everything the datapath needs for one PoT key, cache line aligned so that no two keys share a
+// line and the raw key and its AES-256 round keys are read from one place. The HMAC-SHA256
+// midstates live in the per-lcore MAC contexts of mac.c, keyed from here.
+struct pot_key {
+  uint8_t key[POT_KEY_LENGTH];
+  uint8_t slot;  // epoch slot and position of this key, lets per-lcore caches index by key
+  uint8_t index;
+  struct aes256_round_keys rk; // only expanded when the epoch has_round_keys
+} __rte_cache_aligned;
+
+// One generation of the key table. Packets name the epoch they were signed with in
+// pot_tlv.key_set_id, so during a rotation packets already on the wire are still verified with
+// the previous epoch while new ones use the current one.
+struct pot_key_epoch {
+  uint32_t key_set_id;
+  uint32_t version; // odd while the slot is being rewritten, per-lcore caches re-key when it changes
+  uint8_t slot;
+  uint8_t nb_keys;
+  uint8_t has_round_keys;
+  struct pot_key keys[MAX_POT_NODES + 1];
+} __rte_cache_aligned;
+
+/**
+ * Publishes a new key table as the current epoch. It is written into the slot of the epoch before
+ * the current one and then made current with a single atomic store, so forwarding lcores never
+ * wait on it: they keep using whichever epoch their packets name. Packets still carrying the id of
+ * the overwritten epoch (two rotations old) fail verification and are dropped.
+ *
+ * Before that slot is rewritten, lookups are turned away from it and the publish waits for an RCU
+ * grace period: every registered reader lcore has to report a quiescent state, so none of them is
+ * still using the old epoch for a packet it looked it up for.
+ *
+ * The key set id is derived from the key material (the first four bytes of its SHA-256), so every
+ * node that loads the same key file agrees on it without any coordination.
+ *
+ * @return 0 on success, -1 on error. Must only be called from one control thread at a time.
+ */
+int keystore_publish(const uint8_t keys[][POT_KEY_LENGTH], uint8_t nb_keys);
+
+// Called by keystore_publish() once the new epoch is written but before any lookup can return it,
+// so backends holding per-key state (cryptodev sessions) can key it ahead of the first packet
+typedef void (*keystore_publish_cb)(const struct pot_key_epoch* epoch);
+void keystore_set_publish_cb(keystore_publish_cb cb);
+
+// Epoch new packets are signed with, NULL before the first publish
+const struct pot_key_epoch* keystore_current(void);
+// Epoch a received packet names (host byte order id), NULL if it is neither current nor previous
+const struct pot_key_epoch* keystore_find(uint32_t key_set_id);
+// Maps a pointer to the key bytes of a published key back to its entry, NULL for any other buffer
+const struct pot_key* keystore_key_of(const uint8_t* key);
+
+// Epoch a key store entry belongs to
+static inline const struct pot_key_epoch* keystore_epoch_of(const struct pot_key* key) {
+  return container_of(key - key->index, struct pot_key_epoch, keys[0]);
+}
+
+// QSBR variable of the epoch readers, thread ids are lcore ids. Created by the first publish.
+extern struct rte_rcu_qsbr* g_keystore_qsbr;
+
+// Registers the calling lcore as an epoch reader and puts it online, called once before its
+// forwarding loop. Keys must be published before, lcores registering earlier are not waited on.
+void keystore_reader_register(void);
+
+// Reported by every reader between bursts, once it holds no epoch it looked up any more
+static inline void keystore_quiescent(void) {
+  if (likely(g_keystore_qsbr != NULL)) rte_rcu_qsbr_quiescent(g_keystore_qsbr, rte_lcore_id());
+}
+
+void keystore_free(void);
+
+#endif // KEYSTORE_H
@@ -0,0 +1,55 @@
+#ifndef MAC_H
+#define MAC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "keystore.h"
+
+// Path authenticator algorithms. The one in use is chosen per deployment with --mac-alg and carried
+// in the top byte of hmac_tlv.hmac_key_id, so a verifier can tell a packet signed with another
+// algorithm from a forged one. HMAC-SHA256 is 0, which keeps its key id on the wire unchanged.
+enum pot_mac_alg {
+  POT_MAC_HMAC_SHA256 = 0,
+  POT_MAC_AES_CMAC = 1, // AES-256-CMAC, 16-byte tag
+  POT_MAC_AES_GMAC = 2, // AES-256-GMAC keyed per message by the PoT nonce, 16-byte tag
+  POT_MAC_POLY1305 = 3, // Poly1305 with a one-time key drawn from AES-256-CTR at the PoT nonce, 16-byte tag
+  POT_MAC_COUNT,
+};
+
+#define POT_MAC_KEY_ID(alg, id) (((uint32_t)(alg) << 24) | ((id) & 0x00ffffffu))
+#define POT_MAC_KEY_ID_ALG(key_id) ((uint8_t)((key_id) >> 24))
+
+// Tags are written into the 32-byte HMAC/PVF fields. Tags shorter than that are zero padded, so the
+// padding is covered by the PVF comparison at the egress as well.
+#define POT_MAC_FIELD_LENGTH 32
+
+/**
+ * One MAC algorithm. compute() authenticates len bytes of msg (the hmac_input_build() layout) with a
+ * key store entry and writes tag_len bytes of tag followed by zero padding into out. Algorithms with
+ * needs_nonce set are only secure with a per-packet unique nonce and must be given the PoT nonce;
+ * the others ignore it and are deterministic, so their tags can be cached per flow.
+ *
+ * @return 0 on success, -1 on error.
+ */
+struct pot_mac_ops {
+  const char* name;
+  uint8_t alg;
+  uint8_t tag_len;
+  uint8_t needs_nonce;
+  int (*compute)(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                 uint8_t out[POT_MAC_FIELD_LENGTH]);
+};
+
+// Algorithm used to sign and verify, HMAC-SHA256 until pot_mac_configure() says otherwise
+extern const struct pot_mac_ops* g_pot_mac;
+
+// Looks up an algorithm by id, NULL if unknown
+const struct pot_mac_ops* pot_mac_get(int alg);
+// Parses a --mac-alg name, -1 if unknown
+int pot_mac_parse(const char* name);
+// Selects the algorithm, meant to be called once before the forwarding lcores start
+void pot_mac_configure(int alg);
+void pot_mac_free(void);
+
+#endif // MAC_H
@@ -6,7 +6,14 @@
 
 extern int g_node_index;
 
+struct next_hop_entry;
+
 void add_next_hop(const char *ipv6_str, const char *mac_str);
 struct rte_ether_addr *lookup_mac_for_ipv6(struct in6_addr *ipv6);
+// The next hop entry of an IPv6 address, NULL if there is none
+const struct next_hop_entry *lookup_next_hop(const struct in6_addr *ipv6);
+// Precomputes the L2 header of every next hop for frames sent out of tx_port, whose MAC has to be
+// cached already (see setup_port())
+void next_hops_build_l2(uint16_t tx_port);
 
 #endif // CONTROLLER_H
\ No newline at end of file
@@ -60,4 +60,14 @@ static inline void process_egress_packet(struct rte_mbuf *mbuf);
  */
 void process_egress(struct rte_mbuf **pkts, uint16_t nb_rx);
 
+/**
+ * @brief Builds the L2 header of the iperf server the egress forwards to.
+ *
+ * Called once the ports' MACs are cached and before the lcores are launched, like
+ * next_hops_build_l2(), so the forwarding path only reads the header.
+ *
+ * @param tx_port The port the egress sends on.
+ */
+void egress_build_l2(uint16_t tx_port);
+
 #endif // TRANSIT_H
\ No newline at end of file
@@ -50,16 +50,29 @@
 void process_transit(struct rte_mbuf **pkts, uint16_t nb_rx);
 
 /**
- * process_transit - Processes an array of received packets.
+ * transit_validate_packet - Checks a received packet before any crypto work is done on it.
  *
- * This function iterates over the provided array of packet pointers
- * and calls process_transit_packet for each packet.
+ * Checks the tag length and, for the SRH carrier, that segments remain, the layout was already
+ * validated by parse_pot_burst(). Packets failing the checks are freed.
  *
- * @pkts: Pointer to an array of rte_mbuf pointers containing the received packets.
- * @nb_rx: Number of packets in the pkts array.
+ * @mbuf: The received packet.
+ * @key_set_id: Set to the key set the packet was signed with.
+ * @nonce: Set to the packet's nonce, in the PoT TLV or the IOAM option.
+ * @pvf: Set to the packet's PVF, likewise.
  *
- * // Iterates over each packet in the array
- * // Calls process_transit_packet for each packet, passing the packet and its index
+ * Returns 0, or -1 if the packet was dropped.
  */
-static inline void process_transit_packet(struct rte_mbuf *mbuf, int i);
+static inline int transit_validate_packet(struct rte_mbuf *mbuf, uint32_t *key_set_id, uint8_t **nonce,
+                                          uint8_t **pvf);
+
+/**
+ * transit_forward_packet - Advances the SRH to the next segment and forwards the packet.
+ *
+ * Called once this node's PVF layer has been peeled off. Decrements segments_left, rewrites
+ * the IPv6 destination to the next SID and sends the packet to its MAC, dropping it if the
+ * SID has no next hop entry. IOAM packets are sent on to their destination unchanged.
+ *
+ * @mbuf: A packet that passed transit_validate_packet().
+ */
+static inline void transit_forward_packet(struct rte_mbuf *mbuf);
 #endif // TRANSIT_H
\ No newline at end of file
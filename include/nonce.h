@@ -0,0 +1,32 @@
+#ifndef NONCE_H
+#define NONCE_H
+
+#include <stdint.h>
+
+// Per-lcore PoT nonce generator behind generate_nonce(). Nonces are produced in bulk instead of one
+// RAND_bytes() call per packet, so ingress takes one in O(1) without touching the OpenSSL DRBG locks.
+enum nonce_mode {
+  // Random nonces read from a per-lcore AES-256-CTR DRBG keyed from RAND_bytes(), buffered in a ring
+  // that is topped up in batches and re-keyed every reseed interval
+  NONCE_MODE_DRBG = 0,
+  // Per-lcore random 64-bit salt followed by a 64-bit big-endian counter. The salt is redrawn every
+  // reseed interval, when the counter restarts.
+  NONCE_MODE_COUNTER = 1,
+};
+
+#define NONCE_POOL_SIZE 512
+#define NONCE_RESEED_DEFAULT (1u << 20)
+
+// Selects the mode and the number of nonces handed out between two reseeds. Meant to be called once
+// before the forwarding lcores start; pools created afterwards pick the settings up.
+void nonce_pool_configure(int mode, uint32_t reseed_interval);
+
+// Copies the next nonce of the calling lcore's pool. Returns 0 on success, -1 on error.
+int nonce_pool_next(uint8_t nonce[16]);
+
+// Tops the calling lcore's ring up, so the forwarding loop can pay for refills while idle
+void nonce_pool_fill(void);
+
+void nonce_pool_free(void);
+
+#endif // NONCE_H
@@ -0,0 +1,38 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <rte_mbuf.h>
+#include <stdint.h>
+
+// Pipeline mode, selected with --pipeline <workers>, for nodes whose crypto one core cannot keep up
+// with. Instead of every lcore running RX, the role handler and TX on a queue of its own, one RX lcore
+// receives and parses bursts and hands them round-robin to the crypto workers over rte_rings. The
+// workers run the unchanged role handlers, whatever those send goes over a second ring per worker to
+// one TX lcore, which puts the packets back into arrival order with rte_reorder and transmits them.
+//
+// The RX lcore numbers the packets in the rte_reorder sequence number dynfield. A packet a handler
+// drops would leave a gap the reorder buffer waits on, so the worker sends an empty mbuf with that
+// number in its place, and the TX lcore frees it when it comes out of the buffer.
+#define PIPELINE_MAX_WORKERS 64
+// Packets queued from the RX lcore to each worker, and from each worker to the TX lcore
+#define PIPELINE_RING_SIZE 1024
+// Packets the TX lcore can hold back while it waits for an earlier one, a power of two
+#define PIPELINE_REORDER_SIZE 8192
+
+// Number of crypto workers, 0 when every lcore runs to completion on its own queue
+extern int g_pipeline_workers;
+
+// Creates the rings and the reorder buffer. Needs nb_workers + 2 worker lcores, returns -1 if there
+// are fewer or an allocation fails.
+int pipeline_init(unsigned nb_workers);
+void pipeline_free(void);
+// Mbufs the rings and the reorder buffer can hold on top of what the ports need
+unsigned pipeline_mbufs_needed(void);
+// Launches the RX lcore, the workers and the TX lcore on the ports, {RX, TX}, and waits for them
+void pipeline_launch(uint16_t* ports);
+
+// Called on the way out of a role handler. On a worker lcore the frame is taken for the TX lcore and
+// 1 returned, on any other lcore it returns 0 and the caller sends the frame itself.
+int pipeline_tx_stage(struct rte_mbuf* mbuf, uint16_t tx_port_id);
+
+#endif // PIPELINE_H
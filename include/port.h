@@ -16,8 +16,26 @@
     }                                                                                                        \
   } while (0)
 
+// Set while every configured port has RTE_ETH_TX_OFFLOAD_MULTI_SEGS enabled
+extern int g_tx_multi_seg;
+
+// Source MAC of every port setup_port() brought up, read once so the TX path never asks the ethdev
+extern struct rte_ether_addr g_port_mac[RTE_MAX_ETHPORTS];
+
+// Flow types RSS spreads over the queues. The NIC cannot hash the IPv6 flow label, the addresses
+// are what identifies a flow of PoT packets, plain TCP and UDP at the ingress also hash on ports.
+#define PORT_RSS_HF                                                                                          \
+  (RTE_ETH_RSS_IPV6 | RTE_ETH_RSS_FRAG_IPV6 | RTE_ETH_RSS_NONFRAG_IPV6_OTHER | RTE_ETH_RSS_IPV6_EX |         \
+   RTE_ETH_RSS_NONFRAG_IPV6_TCP | RTE_ETH_RSS_NONFRAG_IPV6_UDP)
+
+// RX/TX queue pairs setup_port() configures on every port, one per forwarding lcore
+extern uint16_t g_nb_queues;
+
 typedef enum { PORT_ROLE_LATENCY_RX, PORT_ROLE_LATENCY_TX } PortRole;
 
+// Sets g_nb_queues to one queue pair per lcore polling the ports, as far as the ports support it.
+// Called before the mbuf pool is created and any port is set up.
+uint16_t port_queues_configure(unsigned nb_pollers);
 int setup_port(uint16_t port, struct rte_mempool* mbuf_pool);
 void display_mac_address(uint16_t port_id);
 int get_and_configure_dev_info(uint16_t port, struct rte_eth_conf* port_conf,
@@ -26,10 +26,28 @@ typedef struct {
   } topology;
   int follow_flag;
   int virtual_machine; // Flag to indicate if running in a virtual machine
+  int crypto_backend;  // enum crypto_backend, EVP unless --crypto-backend says otherwise
+  int nonce_mode;      // enum nonce_mode, see nonce.h
+  unsigned nonce_reseed; // nonces handed out per lcore between two reseeds
+  int mac_alg;         // enum pot_mac_alg, see mac.h
+  int csid_block_len;  // C-SID locator block in bits, 0 for full 128-bit SIDs, see headers.h
+  int tag_len;         // HMAC/PVF bytes carried per packet, see headers.h
+  int srv6_encap;      // 1 for H.Encaps, 0 to insert the SRH into the packet, see headers.h
+  int pot_carrier;     // enum pot_carrier, see headers.h
+  int pipeline_workers; // crypto workers of the pipeline mode, 0 to run to completion, see pipeline.h
+  int eventdev_workers; // worker lcores of the eventdev mode, 0 to run to completion, see eventdev.h
 } AppConfig;
 
+// Where the PoT AES-CTR and HMAC-SHA256 operations run
+enum crypto_backend {
+  CRYPTO_BACKEND_EVP = 0,       // OpenSSL EVP, synchronously inside the RX loop (default)
+  CRYPTO_BACKEND_CRYPTODEV = 1, // rte_cryptodev ops, enqueued and completed asynchronously
+};
+
 // Virtual machine global variable
 extern int g_is_virtual_machine;
+// Selected crypto backend global variable
+extern int g_crypto_backend;
 
 void config_init(AppConfig* config);
 int load_app_config(AppConfig* config);
@@ -15,7 +15,17 @@ struct latency_numbers_t {
   uint64_t total_pkts;
 };
 
-extern struct latency_numbers_t latency_numbers;
+#define LATENCY_BATCH_SIZE 1000
+
+// Latency state of one TX queue. Each queue is only ever sent on by one lcore, so calc_latency gets
+// the queue's own state as its user_param and needs no locking until it writes out a batch.
+struct latency_queue {
+  struct latency_numbers_t numbers;
+  double buffer[LATENCY_BATCH_SIZE];
+  int buffer_index;
+};
+
+struct latency_queue* latency_queue_alloc(uint16_t port_id);
 
 int getenv_int(const char* name);
 void parse_args(AppConfig* config, int argc, char* argv[]);
@@ -1,8 +1,16 @@
 #include "crypto.h"
+#include "cryptodev.h"
+#include "eventdev.h"
 #include "forward.h"
 #include "headers.h"
 #include "utils/config.h"
 #include "init.h"
+#include "keystore.h"
+#include "mac.h"
+#include "nonce.h"
+#include "node/controller.h"
+#include "node/egress.h"
+#include "pipeline.h"
 #include "port.h"
 #include "utils/config.h"
 #include "utils/role.h"
@@ -34,12 +42,8 @@ int main(int argc, char* argv[]) {
   // application with an error message. And afterwards if everyhing works fine initializes the
   // ports, and sets up the memory pool for the mbufs.
   check_ports();
-
-  // Initialize the memory pool, that is used for the mbufs, that are used to store the packets
-  // that are received from the ports, and sent to the ports. The memory pool is a shared resource
-  // that is used by the DPDK framework to allocate and deallocate memory for the mbufs.
-  struct rte_mempool* mbuf_pool = init_mempool();
   register_tsc_dynfield();
+  register_pot_meta_dynfield();
 
   // Initialize the topology configurations, this is manily the transit node set up, number of
   // tranist nodes, in between ingress and egress nodes, however these creates topology.ini file
@@ -59,6 +63,33 @@ int main(int argc, char* argv[]) {
   parse_args(&config, argc, argv);
   global_role = setup_node_role(config.node.type);
   sync_config_to_env(&config);
+  nonce_pool_configure(config.nonce_mode, config.nonce_reseed);
+  pot_mac_configure(config.mac_alg);
+
+  // Pipeline mode brings up its rings and reorder buffer, eventdev mode its device, the mbuf pool below
+  // makes room for what they hold
+  if (config.pipeline_workers > 0) {
+    if (pipeline_init(config.pipeline_workers) < 0) {
+      rte_exit(EXIT_FAILURE, "Failed to initialize the pipeline\n");
+    }
+    atexit(pipeline_free);
+  }
+  if (config.eventdev_workers > 0) {
+    if (pot_eventdev_init(config.eventdev_workers) < 0) {
+      rte_exit(EXIT_FAILURE, "Failed to initialize the eventdev\n");
+    }
+    atexit(pot_eventdev_close);
+  }
+
+  // One RX/TX queue pair per worker lcore on every port, in pipeline and eventdev mode only the RX and
+  // TX lcores use the ports and one pair is enough
+  int staged = g_pipeline_workers > 0 || g_eventdev_workers > 0;
+  port_queues_configure(staged ? 1 : (rte_lcore_count() > 1 ? rte_lcore_count() - 1 : 1));
+
+  // Initialize the memory pool, that is used for the mbufs, that are used to store the packets
+  // that are received from the ports, and sent to the ports. The memory pool is a shared resource
+  // that is used by the DPDK framework to allocate and deallocate memory for the mbufs.
+  struct rte_mempool* mbuf_pool = init_mempool();
 
   // TODO before initializing the topology force the index of the current node from the
   // environment variable that is supplied when running the script `setup_container_veth.sh`
@@ -79,6 +110,18 @@ int main(int argc, char* argv[]) {
   // setting them here, since we are not using the config struct in the rest of the
   // application, we are just using the global variables.
   num_transit_nodes = config.topology.num_transit;
+
+  // Keys can be rotated under live traffic from here on, a failure only disables rotation
+  init_key_rotation();
+
+  // Bring up the cryptodev backend if selected, it builds its sessions from the keys loaded by
+  // init_topology, so it has to come after it
+  if (g_crypto_backend == CRYPTO_BACKEND_CRYPTODEV) {
+    if (pot_cryptodev_init() < 0) {
+      rte_exit(EXIT_FAILURE, "Failed to initialize the cryptodev backend\n");
+    }
+    atexit(pot_cryptodev_close);
+  }
   
 
   // Initialize the lookup table, that will be used to forward the packet to destined node
@@ -121,6 +164,10 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  // The ports' MACs are cached now, build every next hop's L2 header for the port the roles send on
+  next_hops_build_l2(config.virtual_machine ? 0 : 1);
+  if (global_role == ROLE_EGRESS) egress_build_l2(config.virtual_machine ? 0 : 1);
+
   // Print the system information, before starting the packet processing loop
   print_system_info(&config);
 
@@ -147,6 +194,11 @@ int main(int argc, char* argv[]) {
 
   // Free the segment list in any case
   atexit(free_srh_segments);
+  atexit(crypto_ctx_pool_free);
+  atexit(hmac_cache_free);
+  atexit(nonce_pool_free);
+  atexit(pot_mac_free);
+  atexit(keystore_free);
 
   return 0;
 }
@@ -1,4 +1,8 @@
+import csv
 import re
+import sys
+from collections import defaultdict
+
 import matplotlib.pyplot as plt
 
 # === Step 1: Parse Server Log ===
@@ -88,8 +92,53 @@ def plot_metrics(time_server, throughput_server, jitter, loss_rate, time_client,
     plt.tight_layout()
     plt.show()
 
+# === Crypto Microbenchmark (dpdk-pot-crypto-bench --csv) ===
+# Each primitive is plotted against the dimension it was swept over, one line per algorithm
+BENCH_SWEEP = {
+    "mac": "segments",
+    "mac_cached": "segments",
+    "encrypt_pvf": "transits",
+    "decrypt_pvf": "transits",
+    "decrypt": "burst",
+    "decrypt_burst": "burst",
+}
+
+def parse_crypto_bench_csv(path):
+    series = defaultdict(lambda: ([], []))
+    with open(path, newline='') as f:
+        for row in csv.DictReader(f):
+            primitive = row["primitive"]
+            x_axis = BENCH_SWEEP.get(primitive, "segments")
+            xs, ys = series[(primitive, row["alg"])]
+            xs.append(int(row[x_axis]))
+            ys.append(float(row["cycles_per_op"]))
+    return series
+
+def plot_crypto_bench(series):
+    groups = [("mac", "mac_cached"), ("encrypt_pvf", "decrypt_pvf"), ("decrypt", "decrypt_burst")]
+    plt.figure(figsize=(15, 10))
+
+    for i, primitives in enumerate(groups, start=1):
+        plt.subplot(len(groups), 1, i)
+        for (primitive, alg), (xs, ys) in sorted(series.items()):
+            if primitive in primitives:
+                plt.plot(xs, ys, marker='o', label=f"{primitive} ({alg})")
+        plt.xlabel(BENCH_SWEEP[primitives[0]].capitalize())
+        plt.ylabel("Cycles/op")
+        plt.title(" / ".join(primitives) + " cost")
+        plt.legend()
+        plt.grid(True)
+
+    plt.tight_layout()
+    plt.show()
+
 # === Step 4: Run All ===
 if __name__ == "__main__":
+    # plot.py <crypto-bench.csv> plots a dpdk-pot-crypto-bench run instead of the iperf logs
+    if len(sys.argv) > 1 and sys.argv[1].endswith(".csv"):
+        plot_crypto_bench(parse_crypto_bench_csv(sys.argv[1]))
+        sys.exit(0)
+
     # Update filenames if needed
     server_log = "/home/ubuntu/iperf_server_output_2_transits.txt"
     client_log = "/home/ubuntu/iperf_client_output_2_transits.txt"
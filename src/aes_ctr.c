@@ -0,0 +1,303 @@
+#include "aes_ctr.h"
+
+#include <rte_cpuflags.h>
+#include <rte_vect.h>
+#include <string.h>
+
+#include "utils/logging.h"
+
+// Number of keys whose rounds are kept in flight together. Each key contributes two blocks, so a
+// group keeps eight independent AES pipelines busy without spilling registers.
+#define AES_CTR_LAYER_GROUP 4
+
+// Packets per interleaved group in the burst kernels. 128-bit AES-NI keeps 4 packets (8 blocks) in
+// flight, VAES packs both blocks of a packet into one ymm lane pair so 8 packets fit, and the 512-bit
+// variant carries two packets per zmm for 16 packets per group.
+#define AES_CTR_BURST_AESNI 4
+#define AES_CTR_BURST_VAES256 8
+#define AES_CTR_BURST_VAES512 16
+
+// Increments a 128-bit big-endian counter block, same carry semantics as OpenSSL's CTR mode
+static inline void ctr128_inc(uint8_t counter[AES_BLOCK_SIZE]) {
+  for (int i = AES_BLOCK_SIZE - 1; i >= 0; i--) {
+    if (++counter[i] != 0) break;
+  }
+}
+
+#if defined(RTE_ARCH_X86)
+#include <immintrin.h>
+
+#define AESNI_TARGET __attribute__((target("aes,sse4.1")))
+
+typedef void (*ctr_burst_fn)(const struct aes256_round_keys* rk, uint8_t* const ivs[], uint8_t* const data[],
+                             uint16_t nb, unsigned len);
+static ctr_burst_fn ctr_burst_impl = NULL;
+
+int aes_ctr_accel_available(void) {
+  static int available = -1;
+  if (available < 0) {
+    available = rte_cpu_get_flag_enabled(RTE_CPUFLAG_AES) > 0;
+    LOG_MAIN(INFO, "AES-NI %s for PoT AES-CTR kernels\n", available ? "enabled" : "not available");
+  }
+  return available;
+}
+
+static inline AESNI_TARGET __m128i expand_assist_even(__m128i key, __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, 0xff);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+static inline AESNI_TARGET __m128i expand_assist_odd(__m128i even, __m128i key) {
+  __m128i assist = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(even, 0x00), 0xaa);
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+// _mm_aeskeygenassist_si128 needs the round constant as an immediate, hence the macro
+#define EXPAND_ROUND(i, rcon)                                                                        \
+  do {                                                                                               \
+    k0 = expand_assist_even(k0, _mm_aeskeygenassist_si128(k1, rcon));                               \
+    _mm_store_si128((__m128i*)rk->rk[i], k0);                                                        \
+    if ((i) + 1 <= AES256_ROUNDS) {                                                                  \
+      k1 = expand_assist_odd(k0, k1);                                                                \
+      _mm_store_si128((__m128i*)rk->rk[(i) + 1], k1);                                                \
+    }                                                                                                \
+  } while (0)
+
+AESNI_TARGET void aes256_expand_key(const uint8_t key[32], struct aes256_round_keys* rk) {
+  __m128i k0 = _mm_loadu_si128((const __m128i*)key);
+  __m128i k1 = _mm_loadu_si128((const __m128i*)(key + AES_BLOCK_SIZE));
+  _mm_store_si128((__m128i*)rk->rk[0], k0);
+  _mm_store_si128((__m128i*)rk->rk[1], k1);
+
+  EXPAND_ROUND(2, 0x01);
+  EXPAND_ROUND(4, 0x02);
+  EXPAND_ROUND(6, 0x04);
+  EXPAND_ROUND(8, 0x08);
+  EXPAND_ROUND(10, 0x10);
+  EXPAND_ROUND(12, 0x20);
+  EXPAND_ROUND(14, 0x40);
+}
+
+// XORs the first len bytes of the two keystream blocks ks0, ks1 into d. Tags are a multiple of 8
+// bytes, so a partial block is always its lower half.
+static inline AESNI_TARGET void xor_keystream(uint8_t* d, __m128i ks0, __m128i ks1, unsigned len) {
+  if (len >= AES_BLOCK_SIZE) {
+    _mm_storeu_si128((__m128i*)d, _mm_xor_si128(_mm_loadu_si128((const __m128i*)d), ks0));
+    d += AES_BLOCK_SIZE;
+    len -= AES_BLOCK_SIZE;
+    ks0 = ks1;
+  }
+  if (len >= AES_BLOCK_SIZE)
+    _mm_storeu_si128((__m128i*)d, _mm_xor_si128(_mm_loadu_si128((const __m128i*)d), ks0));
+  else if (len > 0)
+    _mm_storel_epi64((__m128i*)d, _mm_xor_si128(_mm_loadl_epi64((const __m128i*)d), ks0));
+}
+
+AESNI_TARGET void aes256_ctr_xor_layers(const struct aes256_round_keys* const rks[], int nb_keys,
+                                        const uint8_t iv[AES_BLOCK_SIZE], uint8_t* data, unsigned len) {
+  // Tags of up to one block only need the first counter block
+  const int two_blocks = len > AES_BLOCK_SIZE;
+  uint8_t next_iv[AES_BLOCK_SIZE];
+  memcpy(next_iv, iv, AES_BLOCK_SIZE);
+  ctr128_inc(next_iv);
+
+  const __m128i ctr0 = _mm_loadu_si128((const __m128i*)iv);
+  const __m128i ctr1 = _mm_loadu_si128((const __m128i*)next_iv);
+  __m128i acc0 = _mm_setzero_si128();
+  __m128i acc1 = _mm_setzero_si128();
+
+  for (int base = 0; base < nb_keys; base += AES_CTR_LAYER_GROUP) {
+    int n = RTE_MIN(AES_CTR_LAYER_GROUP, nb_keys - base);
+    const struct aes256_round_keys* const* group = rks + base;
+    __m128i s0[AES_CTR_LAYER_GROUP], s1[AES_CTR_LAYER_GROUP];
+
+    for (int l = 0; l < n; l++) {
+      __m128i k = _mm_load_si128((const __m128i*)group[l]->rk[0]);
+      s0[l] = _mm_xor_si128(ctr0, k);
+      if (two_blocks) s1[l] = _mm_xor_si128(ctr1, k);
+    }
+
+    // Round-major order so consecutive aesenc instructions are independent of each other
+    for (int r = 1; r < AES256_ROUNDS; r++) {
+      for (int l = 0; l < n; l++) {
+        __m128i k = _mm_load_si128((const __m128i*)group[l]->rk[r]);
+        s0[l] = _mm_aesenc_si128(s0[l], k);
+        if (two_blocks) s1[l] = _mm_aesenc_si128(s1[l], k);
+      }
+    }
+
+    for (int l = 0; l < n; l++) {
+      __m128i k = _mm_load_si128((const __m128i*)group[l]->rk[AES256_ROUNDS]);
+      acc0 = _mm_xor_si128(acc0, _mm_aesenclast_si128(s0[l], k));
+      if (two_blocks) acc1 = _mm_xor_si128(acc1, _mm_aesenclast_si128(s1[l], k));
+    }
+  }
+
+  xor_keystream(data, acc0, acc1, len);
+}
+
+// Multi-buffer kernels. Every buffer uses the same key but its own IV, the rounds of a whole group
+// are issued back to back so the AES unit pipeline stays full instead of waiting on one dependency
+// chain per packet.
+
+AESNI_TARGET static void ctr_burst_aesni(const struct aes256_round_keys* rk, uint8_t* const ivs[],
+                                         uint8_t* const data[], uint16_t nb, unsigned len) {
+  // The group always keeps 2 * AES_CTR_BURST_AESNI blocks in flight, twice the packets for tags of
+  // a single block
+  const int blocks = len > AES_BLOCK_SIZE ? 2 : 1;
+  const int group = 2 * AES_CTR_BURST_AESNI / blocks;
+  for (uint16_t base = 0; base < nb; base += group) {
+    int n = RTE_MIN(group, nb - base);
+    __m128i s[2 * AES_CTR_BURST_AESNI];
+    __m128i k = _mm_load_si128((const __m128i*)rk->rk[0]);
+
+    for (int p = 0; p < n; p++) {
+      s[blocks * p] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)ivs[base + p]), k);
+      if (blocks == 2) {
+        uint8_t next_iv[AES_BLOCK_SIZE];
+        memcpy(next_iv, ivs[base + p], AES_BLOCK_SIZE);
+        ctr128_inc(next_iv);
+        s[2 * p + 1] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)next_iv), k);
+      }
+    }
+    for (int r = 1; r < AES256_ROUNDS; r++) {
+      k = _mm_load_si128((const __m128i*)rk->rk[r]);
+      for (int b = 0; b < blocks * n; b++) s[b] = _mm_aesenc_si128(s[b], k);
+    }
+    k = _mm_load_si128((const __m128i*)rk->rk[AES256_ROUNDS]);
+    for (int p = 0; p < n; p++) {
+      __m128i ks0 = _mm_aesenclast_si128(s[blocks * p], k);
+      __m128i ks1 = blocks == 2 ? _mm_aesenclast_si128(s[2 * p + 1], k) : ks0;
+      xor_keystream(data[base + p], ks0, ks1, len);
+    }
+  }
+}
+
+// Both counter blocks of one packet as a single 256-bit value
+static inline __attribute__((target("avx2"))) __m256i load_ctr_pair(const uint8_t* iv) {
+  uint8_t next_iv[AES_BLOCK_SIZE];
+  memcpy(next_iv, iv, AES_BLOCK_SIZE);
+  ctr128_inc(next_iv);
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)iv)),
+                                 _mm_loadu_si128((const __m128i*)next_iv), 1);
+}
+
+__attribute__((target("vaes,avx2"))) static void ctr_burst_vaes256(const struct aes256_round_keys* rk,
+                                                                    uint8_t* const ivs[], uint8_t* const data[],
+                                                                    uint16_t nb, unsigned len) {
+  for (uint16_t base = 0; base < nb; base += AES_CTR_BURST_VAES256) {
+    int n = RTE_MIN(AES_CTR_BURST_VAES256, nb - base);
+    __m256i s[AES_CTR_BURST_VAES256];
+    __m256i k = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)rk->rk[0]));
+
+    for (int p = 0; p < n; p++) s[p] = _mm256_xor_si256(load_ctr_pair(ivs[base + p]), k);
+    for (int r = 1; r < AES256_ROUNDS; r++) {
+      k = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)rk->rk[r]));
+      for (int p = 0; p < n; p++) s[p] = _mm256_aesenc_epi128(s[p], k);
+    }
+    k = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)rk->rk[AES256_ROUNDS]));
+    for (int p = 0; p < n; p++) {
+      __m256i ks = _mm256_aesenclast_epi128(s[p], k);
+      __m256i* d = (__m256i*)data[base + p];
+      if (len == 2 * AES_BLOCK_SIZE)
+        _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), ks));
+      else
+        xor_keystream(data[base + p], _mm256_castsi256_si128(ks), _mm256_extracti128_si256(ks, 1), len);
+    }
+  }
+}
+
+__attribute__((target("vaes,avx512f"))) static void ctr_burst_vaes512(const struct aes256_round_keys* rk,
+                                                                       uint8_t* const ivs[],
+                                                                       uint8_t* const data[], uint16_t nb,
+                                                                       unsigned len) {
+  for (uint16_t base = 0; base < nb; base += AES_CTR_BURST_VAES512) {
+    int n = RTE_MIN(AES_CTR_BURST_VAES512, nb - base);
+    int lanes = (n + 1) / 2;
+    __m512i s[AES_CTR_BURST_VAES512 / 2];
+    __m512i k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i*)rk->rk[0]));
+
+    // Two packets per zmm, an odd tail leaves the upper half with a zero counter that is never stored
+    for (int l = 0; l < lanes; l++) {
+      int p = base + 2 * l;
+      __m256i lo = load_ctr_pair(ivs[p]);
+      __m256i hi = (2 * l + 1 < n) ? load_ctr_pair(ivs[p + 1]) : _mm256_setzero_si256();
+      s[l] = _mm512_xor_si512(_mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1), k);
+    }
+    for (int r = 1; r < AES256_ROUNDS; r++) {
+      k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i*)rk->rk[r]));
+      for (int l = 0; l < lanes; l++) s[l] = _mm512_aesenc_epi128(s[l], k);
+    }
+    k = _mm512_broadcast_i32x4(_mm_load_si128((const __m128i*)rk->rk[AES256_ROUNDS]));
+    for (int l = 0; l < lanes; l++) {
+      __m512i ks = _mm512_aesenclast_epi128(s[l], k);
+      for (int h = 0; h < 2 && 2 * l + h < n; h++) {
+        __m256i ks_pkt = h == 0 ? _mm512_castsi512_si256(ks) : _mm512_extracti64x4_epi64(ks, 1);
+        __m256i* d = (__m256i*)data[base + 2 * l + h];
+        if (len == 2 * AES_BLOCK_SIZE)
+          _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), ks_pkt));
+        else
+          xor_keystream(data[base + 2 * l + h], _mm256_castsi256_si128(ks_pkt), _mm256_extracti128_si256(ks_pkt, 1),
+                        len);
+      }
+    }
+  }
+}
+
+// Picks the widest burst kernel the CPU supports and the EAL allows (--force-max-simd-bitwidth)
+static ctr_burst_fn select_ctr_burst_impl(void) {
+  uint16_t simd_width = rte_vect_get_max_simd_bitwidth();
+  if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_VAES) > 0 && rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX512F) > 0 &&
+      simd_width >= RTE_VECT_SIMD_512) {
+    LOG_MAIN(INFO, "Using VAES-512 multi-buffer AES-CTR kernel (%d packets per group)\n",
+             AES_CTR_BURST_VAES512);
+    return ctr_burst_vaes512;
+  }
+  if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_VAES) > 0 && rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0 &&
+      simd_width >= RTE_VECT_SIMD_256) {
+    LOG_MAIN(INFO, "Using VAES-256 multi-buffer AES-CTR kernel (%d packets per group)\n",
+             AES_CTR_BURST_VAES256);
+    return ctr_burst_vaes256;
+  }
+  LOG_MAIN(INFO, "Using AES-NI multi-buffer AES-CTR kernel (%d packets per group)\n", AES_CTR_BURST_AESNI);
+  return ctr_burst_aesni;
+}
+
+void aes256_ctr_xor_burst(const struct aes256_round_keys* rk, uint8_t* const ivs[], uint8_t* const data[],
+                          uint16_t nb, unsigned len) {
+  if (unlikely(ctr_burst_impl == NULL)) ctr_burst_impl = select_ctr_burst_impl();
+  // The VAES kernels work on two-block pairs, single-block tags are better served by AES-NI with
+  // twice the packets per group
+  if (len <= AES_BLOCK_SIZE)
+    ctr_burst_aesni(rk, ivs, data, nb, len);
+  else
+    ctr_burst_impl(rk, ivs, data, nb, len);
+}
+
+#else
+
+int aes_ctr_accel_available(void) { return 0; }
+
+void aes256_expand_key(const uint8_t key[32] __rte_unused, struct aes256_round_keys* rk) {
+  memset(rk, 0, sizeof(*rk));
+}
+
+void aes256_ctr_xor_layers(const struct aes256_round_keys* const rks[] __rte_unused, int nb_keys __rte_unused,
+                           const uint8_t iv[AES_BLOCK_SIZE] __rte_unused, uint8_t* data __rte_unused,
+                           unsigned len __rte_unused) {
+  LOG_MAIN(ERR, "AES-CTR kernels are not available on this architecture\n");
+}
+
+void aes256_ctr_xor_burst(const struct aes256_round_keys* rk __rte_unused, uint8_t* const ivs[] __rte_unused,
+                          uint8_t* const data[] __rte_unused, uint16_t nb __rte_unused,
+                          unsigned len __rte_unused) {
+  LOG_MAIN(ERR, "AES-CTR kernels are not available on this architecture\n");
+}
+
+#endif
@@ -0,0 +1,150 @@
+#include "classify.h"
+
+#include <rte_cpuflags.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_vect.h>
+
+#include "headers.h"
+#include "ioam.h"
+#include "utils/logging.h"
+
+// The SRH directly follows the fixed IPv6 header
+#define CLASSIFY_SRH_OFF (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr))
+
+// Packets whose keys are compared into one accept mask
+#define CLASSIFY_CHUNK 64
+// How many packets ahead the headers are prefetched while the keys are gathered
+#define CLASSIFY_PREFETCH 4
+
+// The prefiltered fields of a packet folded into one word: the multicast bit of the destination MAC,
+// the EtherType bytes as they are on the wire, and the SRH next_header and routing_type. For the
+// IOAM carrier the last two are the IPv6 next header and the type of the first option after the PadN.
+#define CLASSIFY_KEY(mcast, type_hi, type_lo, nh, rt)                                                   \
+  ((uint64_t)(mcast) | (uint64_t)(type_hi) << 8 | (uint64_t)(type_lo) << 16 | (uint64_t)(nh) << 24 |   \
+   (uint64_t)(rt) << 32)
+#define CLASSIFY_KEY_POT CLASSIFY_KEY(0, RTE_ETHER_TYPE_IPV6 >> 8, RTE_ETHER_TYPE_IPV6 & 0xff, 61, 4)
+#define CLASSIFY_KEY_IOAM                                                                                \
+  CLASSIFY_KEY(0, RTE_ETHER_TYPE_IPV6 >> 8, RTE_ETHER_TYPE_IPV6 & 0xff, IPPROTO_HOPOPTS, IOAM_HBH_OPT_IOAM)
+
+static inline uint64_t classify_key(const struct rte_mbuf* pkt, int ioam) {
+  // Frames too short to carry an SRH (or the IOAM option type) get 0, which is nobody's key
+  const size_t min_len = ioam ? offsetof(struct ioam_pot_hbh, opt_len) : sizeof(struct ipv6_srh);
+  if (unlikely(rte_pktmbuf_data_len(pkt) < CLASSIFY_SRH_OFF + min_len)) return 0;
+  const uint8_t* p = rte_pktmbuf_mtod(pkt, const uint8_t*);
+  if (ioam) {
+    const struct ioam_pot_hbh* hbh = (const struct ioam_pot_hbh*)(p + CLASSIFY_SRH_OFF);
+    return CLASSIFY_KEY(p[0] & 0x01, p[12], p[13], p[sizeof(struct rte_ether_hdr) + 6], hbh->opt_type);
+  }
+  const struct ipv6_srh* srh = (const struct ipv6_srh*)(p + CLASSIFY_SRH_OFF);
+  return CLASSIFY_KEY(p[0] & 0x01, p[12], p[13], srh->next_header, srh->routing_type);
+}
+
+// Returns a mask with bit i set for every keys[i] equal to want, nb is at most CLASSIFY_CHUNK
+typedef uint64_t (*classify_match_fn)(const uint64_t* keys, uint16_t nb, uint64_t want);
+static classify_match_fn classify_match_impl = NULL;
+
+static uint64_t classify_match_scalar(const uint64_t* keys, uint16_t nb, uint64_t want) {
+  uint64_t mask = 0;
+  for (uint16_t i = 0; i < nb; i++) mask |= (uint64_t)(keys[i] == want) << i;
+  return mask;
+}
+
+#if defined(RTE_ARCH_X86)
+#include <immintrin.h>
+
+__attribute__((target("avx2"))) static uint64_t classify_match_avx2(const uint64_t* keys, uint16_t nb, uint64_t want) {
+  const __m256i pot = _mm256_set1_epi64x((long long)want);
+  uint64_t mask = 0;
+  uint16_t i = 0;
+  for (; i + 4 <= nb; i += 4) {
+    __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)&keys[i]), pot);
+    mask |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+  }
+  if (i < nb) mask |= classify_match_scalar(keys + i, nb - i, want) << i;
+  return mask;
+}
+
+__attribute__((target("sse4.1"))) static uint64_t classify_match_sse(const uint64_t* keys, uint16_t nb, uint64_t want) {
+  const __m128i pot = _mm_set1_epi64x((long long)want);
+  uint64_t mask = 0;
+  uint16_t i = 0;
+  for (; i + 2 <= nb; i += 2) {
+    __m128i eq = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)&keys[i]), pot);
+    mask |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+  }
+  if (i < nb) mask |= classify_match_scalar(keys + i, nb - i, want) << i;
+  return mask;
+}
+
+#elif defined(RTE_ARCH_ARM64)
+
+static uint64_t classify_match_neon(const uint64_t* keys, uint16_t nb, uint64_t want) {
+  const uint64x2_t pot = vdupq_n_u64(want);
+  uint64_t mask = 0;
+  uint16_t i = 0;
+  for (; i + 2 <= nb; i += 2) {
+    uint64x2_t eq = vceqq_u64(vld1q_u64(&keys[i]), pot);
+    mask |= (vgetq_lane_u64(eq, 0) & 1) << i | (vgetq_lane_u64(eq, 1) & 1) << (i + 1);
+  }
+  if (i < nb) mask |= classify_match_scalar(keys + i, nb - i, want) << i;
+  return mask;
+}
+
+#endif
+
+// Picks the widest compare the CPU supports and the EAL allows (--force-max-simd-bitwidth)
+static classify_match_fn select_classify_match_impl(void) {
+  uint16_t simd_width = rte_vect_get_max_simd_bitwidth();
+#if defined(RTE_ARCH_X86)
+  if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0 && simd_width >= RTE_VECT_SIMD_256) {
+    LOG_MAIN(INFO, "Using AVX2 burst classifier\n");
+    return classify_match_avx2;
+  }
+  if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE4_1) > 0 && simd_width >= RTE_VECT_SIMD_128) {
+    LOG_MAIN(INFO, "Using SSE4.1 burst classifier\n");
+    return classify_match_sse;
+  }
+#elif defined(RTE_ARCH_ARM64)
+  if (simd_width >= RTE_VECT_SIMD_128) {
+    LOG_MAIN(INFO, "Using NEON burst classifier\n");
+    return classify_match_neon;
+  }
+#endif
+  RTE_SET_USED(simd_width);
+  LOG_MAIN(INFO, "Using scalar burst classifier\n");
+  return classify_match_scalar;
+}
+
+uint16_t pot_classify_burst(struct rte_mbuf* const pkts[], uint16_t nb_pkts, uint16_t accept[], uint16_t drop[]) {
+  if (unlikely(classify_match_impl == NULL)) classify_match_impl = select_classify_match_impl();
+
+  for (uint16_t i = 0; i < RTE_MIN(nb_pkts, CLASSIFY_PREFETCH); i++) rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void*));
+
+  // The carrier is fixed for the run, but read once per burst rather than per packet
+  const int ioam = g_pot_carrier == POT_CARRIER_IOAM;
+  const uint64_t want = ioam ? CLASSIFY_KEY_IOAM : CLASSIFY_KEY_POT;
+  uint64_t keys[CLASSIFY_CHUNK];
+  uint16_t nb_accept = 0;
+  uint16_t nb_drop = 0;
+  for (uint16_t base = 0; base < nb_pkts; base += CLASSIFY_CHUNK) {
+    uint16_t n = RTE_MIN(nb_pkts - base, CLASSIFY_CHUNK);
+    for (uint16_t i = 0; i < n; i++) {
+      if (base + i + CLASSIFY_PREFETCH < nb_pkts)
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[base + i + CLASSIFY_PREFETCH], void*));
+      keys[i] = classify_key(pkts[base + i], ioam);
+    }
+
+    // Both index vectors are written for every packet and only one of them advances, which keeps
+    // the split free of branches a hostile traffic mix could make mispredict
+    uint64_t match = classify_match_impl(keys, n, want);
+    for (uint16_t i = 0; i < n; i++) {
+      uint16_t hit = (match >> i) & 1;
+      accept[nb_accept] = base + i;
+      drop[nb_drop] = base + i;
+      nb_accept += hit;
+      nb_drop += hit ^ 1;
+    }
+  }
+  return nb_accept;
+}
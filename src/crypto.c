@@ -1,14 +1,69 @@
 #include "crypto.h"
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <rte_hash_crc.h>
+#include <rte_malloc.h>
 #include <stdlib.h>
 
+#include "aes_ctr.h"
+#include "keystore.h"
+#include "mac.h"
+#include "nonce.h"
 #include "utils/logging.h"
 
 uint8_t g_key_count = 0;
 int num_transit_nodes = 0;
-uint8_t k_pot_in[MAX_POT_NODES + 1][HMAC_MAX_LENGTH];
+
+// Per-lcore pool of AES-256-CTR contexts, one per key of each key store epoch. Each context is
+// initialized once with its key so the AES key schedule is expanded only when the keys change; per
+// packet the context is only re-IV'd before running the block function. A slot remembers the
+// version of the epoch it was keyed from and is re-keyed lazily on the next packet after a rotation,
+// so the control path never touches it. Pools are only touched by their own lcore, so no locking is
+// needed on the datapath.
+struct crypto_ctx_pool {
+  uint32_t version[POT_KEY_EPOCHS];
+  uint8_t nb_keys[POT_KEY_EPOCHS];
+  EVP_CIPHER_CTX* ctx[POT_KEY_EPOCHS][MAX_POT_NODES + 1];
+} __rte_cache_aligned;
+
+static struct crypto_ctx_pool* g_ctx_pools[RTE_MAX_LCORE];
+
+// Flow-level HMAC result cache. The HMAC input only covers the source address, last_entry, flags,
+// hmac_key_id and the segment list, so every packet of a policy hashes the exact same bytes. Each
+// lcore keeps its own direct-mapped table of recent inputs and their digests, so lookups are
+// lock-free; the full input is stored and compared on a hit so a CRC collision can never return
+// the digest of a different policy. Entries are tagged with the generation they were computed in,
+// reloading keys or segments bumps it and every table goes cold without being touched.
+struct hmac_cache_entry {
+  uint32_t generation;
+  uint32_t key_version; // version of the key's epoch, a rotation into the same slot changes it
+  uint32_t hash;
+  uint16_t input_len;
+  uint8_t key_id; // epoch slot and key index, see hmac_cache_key_id()
+  uint8_t alg;    // enum pot_mac_alg the digest was computed with
+  uint8_t hmac[HMAC_MAX_LENGTH];
+  uint8_t input[HMAC_CACHE_MAX_INPUT];
+} __rte_cache_aligned;
+
+struct hmac_cache {
+  struct hmac_cache_entry entries[HMAC_CACHE_SIZE];
+  uint64_t hits;
+  uint64_t misses;
+} __rte_cache_aligned;
+
+static struct hmac_cache* g_hmac_caches[RTE_MAX_LCORE];
+static uint32_t g_hmac_cache_generation = 1;
+
+static int encrypt_oneshot(unsigned char* plaintext, int plaintext_len, unsigned char* key, unsigned char* iv,
+                           unsigned char* ciphertext);
+static int hex_char_to_int(char c);
+
+static inline uint8_t hmac_cache_key_id(const struct pot_key* key) {
+  return (uint8_t)(key->slot * (MAX_POT_NODES + 1) + key->index);
+}
 
 int load_pot_keys(const char* filepath, int keys_to_load) {
   FILE* file = fopen(filepath, "r");
@@ -20,9 +75,11 @@ int load_pot_keys(const char* filepath, int keys_to_load) {
   // Her satırı okumak için yeterli büyüklükte bir tampon.
   // +2: newline ve null terminator için
   char line[HMAC_KEY_HEX_LENGTH + 2];
-  g_key_count = 0;
+  uint8_t keys[MAX_POT_NODES + 1][POT_KEY_LENGTH];
+  uint8_t nb_keys = 0;
+  if (keys_to_load > MAX_POT_NODES + 1) keys_to_load = MAX_POT_NODES + 1;
 
-  while (fgets(line, sizeof(line), file) && g_key_count < keys_to_load) {
+  while (fgets(line, sizeof(line), file) && nb_keys < keys_to_load) {
     // Satır sonundaki newline karakterini kaldır
     line[strcspn(line, "\n")] = 0;
 
@@ -37,25 +94,160 @@ int load_pot_keys(const char* filepath, int keys_to_load) {
       continue;
     }
 
-    // Hex string'i byte dizisine çevir
-    for (int i = 0; i < HMAC_MAX_LENGTH; i++) {
-      char byte_str[3] = {line[i * 2], line[i * 2 + 1], '\0'};
-      k_pot_in[g_key_count][i] = (uint8_t)strtol(byte_str, NULL, 16);
+    // Hex string'i byte dizisine çevir, geçersiz karakter içeren satırları atla
+    int valid = 1;
+    for (int i = 0; i < HMAC_MAX_LENGTH && valid; i++) {
+      int high = hex_char_to_int(line[i * 2]);
+      int low = hex_char_to_int(line[i * 2 + 1]);
+      if (high < 0 || low < 0) valid = 0;
+      keys[nb_keys][i] = (uint8_t)((high << 4) | low);
+    }
+    if (!valid) {
+      LOG_MAIN(WARNING, "Geçersiz hex karakteri, satır atlanıyor\n");
+      continue;
     }
-    g_key_count++;
+    nb_keys++;
   }
 
   fclose(file);
 
-  if (g_key_count == 0) {
+  if (nb_keys == 0) {
     LOG_MAIN(WARNING, "%s dosyasından geçerli anahtar okunamadı\n", filepath);
     return -1;
   }
 
+  // The keys go live as a new key store epoch, packets signed with the previous one keep verifying
+  int ret = keystore_publish((const uint8_t(*)[POT_KEY_LENGTH])keys, nb_keys);
+  OPENSSL_cleanse(keys, sizeof(keys));
+  if (ret < 0) return -1;
+  g_key_count = nb_keys;
+  hmac_cache_invalidate();
+
   LOG_MAIN(INFO, "%s dosyasından %u adet PoT anahtarı başarıyla yüklendi\n", filepath, g_key_count);
   return 0;
 }
 
+void hmac_cache_invalidate(void) { __atomic_add_fetch(&g_hmac_cache_generation, 1, __ATOMIC_RELEASE); }
+
+void hmac_cache_free(void) {
+  for (unsigned lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+    struct hmac_cache* cache = g_hmac_caches[lcore_id];
+    if (cache == NULL) continue;
+    LOG_MAIN(INFO, "HMAC cache on lcore %u: %" PRIu64 " hits, %" PRIu64 " misses\n", lcore_id, cache->hits,
+             cache->misses);
+    rte_free(cache);
+    g_hmac_caches[lcore_id] = NULL;
+  }
+}
+
+static struct hmac_cache* get_lcore_hmac_cache(void) {
+  unsigned lcore_id = rte_lcore_id();
+  if (lcore_id >= RTE_MAX_LCORE) return NULL;
+
+  struct hmac_cache* cache = g_hmac_caches[lcore_id];
+  if (unlikely(cache == NULL)) {
+    cache = rte_zmalloc_socket("hmac_cache", sizeof(*cache), RTE_CACHE_LINE_SIZE,
+                               rte_lcore_to_socket_id(lcore_id));
+    if (cache == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate HMAC cache for lcore %u\n", lcore_id);
+      return NULL;
+    }
+    g_hmac_caches[lcore_id] = cache;
+  }
+  return cache;
+}
+
+size_t hmac_input_build(const uint8_t* src_addr, const struct ipv6_srh* srh, const struct hmac_tlv* hmac_tlv,
+                        uint8_t* input, size_t input_size) {
+  // Same layout as calculate_hmac(): source, last_entry, flags, 2 reserved bytes, key id, segments
+  size_t segment_list_len = (srh->hdr_ext_len * 8) + 8 - sizeof(struct ipv6_srh);
+  size_t input_len = 16 + 1 + 1 + 2 + 4 + segment_list_len;
+  if (input_len > input_size) return 0;
+
+  memcpy(input, src_addr, 16);
+  input[16] = srh->last_entry;
+  input[17] = srh->flags;
+  input[18] = 0;
+  input[19] = 0;
+  memcpy(input + 20, &hmac_tlv->hmac_key_id, sizeof(hmac_tlv->hmac_key_id));
+  memcpy(input + 24, (const uint8_t*)srh + sizeof(struct ipv6_srh), segment_list_len);
+  return input_len;
+}
+
+// Deterministic MACs of a key store key. Packets of an already seen policy reuse the cached tag and
+// skip the MAC entirely. The key is part of the entry through its slot, index and the version of
+// its epoch, so a key set rotated into the slot never hits a tag of the key it replaced, even
+// before the generation bump that follows the publish.
+static int mac_cached_compute(const struct pot_mac_ops* mac, const struct pot_key* key, const uint8_t* input,
+                              size_t input_len, uint8_t* mac_out) {
+  uint8_t key_id = hmac_cache_key_id(key);
+  uint32_t key_version = __atomic_load_n(&keystore_epoch_of(key)->version, __ATOMIC_ACQUIRE);
+  struct hmac_cache* cache = input_len <= HMAC_CACHE_MAX_INPUT ? get_lcore_hmac_cache() : NULL;
+  struct hmac_cache_entry* entry = NULL;
+  uint32_t generation = __atomic_load_n(&g_hmac_cache_generation, __ATOMIC_ACQUIRE);
+  uint32_t hash = 0;
+  if (cache != NULL) {
+    hash = rte_hash_crc(input, input_len, ((uint32_t)mac->alg << 8) | key_id);
+    entry = &cache->entries[hash & (HMAC_CACHE_SIZE - 1)];
+    if (entry->generation == generation && entry->hash == hash && entry->key_id == key_id &&
+        entry->key_version == key_version && entry->alg == mac->alg && entry->input_len == input_len && memcmp(entry->input, input, input_len) == 0) {
+      memcpy(mac_out, entry->hmac, HMAC_MAX_LENGTH);
+      cache->hits++;
+      LOG_MAIN(DEBUG, "%s served from flow cache (key %u).\n", mac->name, key->index);
+      return 0;
+    }
+    cache->misses++;
+  }
+
+  if (mac->compute(key, NULL, input, input_len, mac_out) < 0) {
+    LOG_MAIN(ERR, "%s calculation failed.\n", mac->name);
+    return -1;
+  }
+  LOG_MAIN(DEBUG, "%s calculated with key %u.\n", mac->name, key->index);
+
+  if (entry != NULL) {
+    memcpy(entry->input, input, input_len);
+    memcpy(entry->hmac, mac_out, HMAC_MAX_LENGTH);
+    entry->input_len = input_len;
+    entry->key_id = key_id;
+    entry->key_version = key_version;
+    entry->alg = mac->alg;
+    entry->hash = hash;
+    entry->generation = generation;
+  }
+  return 0;
+}
+
+int calculate_pot_mac(const struct pot_mac_ops* mac, uint8_t* src_addr, const struct ipv6_srh* srh,
+                      const struct hmac_tlv* hmac_tlv, const struct pot_key* key, const uint8_t* nonce,
+                      uint8_t* mac_out) {
+  // HMAC-SHA256 keeps its own path with the input logging
+  if (mac->alg == POT_MAC_HMAC_SHA256)
+    return calculate_hmac(src_addr, srh, hmac_tlv, (uint8_t*)key->key, POT_KEY_LENGTH, mac_out);
+
+  uint8_t input[HMAC_INPUT_MAX_LENGTH];
+  size_t input_len = hmac_input_build(src_addr, srh, hmac_tlv, input, sizeof(input));
+  if (input_len == 0) {
+    LOG_MAIN(ERR, "%s input does not fit, SRH too long.\n", mac->name);
+    return -1;
+  }
+
+  return calculate_pot_mac_input(mac, key, nonce, input, input_len, mac_out);
+}
+
+int calculate_pot_mac_input(const struct pot_mac_ops* mac, const struct pot_key* key, const uint8_t* nonce,
+                            const uint8_t* input, size_t input_len, uint8_t* mac_out) {
+  // Nonce based MACs differ for every packet, there is nothing to cache
+  if (mac->needs_nonce) {
+    if (mac->compute(key, nonce, input, input_len, mac_out) < 0) {
+      LOG_MAIN(ERR, "%s calculation failed.\n", mac->name);
+      return -1;
+    }
+    return 0;
+  }
+  return mac_cached_compute(mac, key, input, input_len, mac_out);
+}
+
 int calculate_hmac(uint8_t* src_addr, const struct ipv6_srh* srh, const struct hmac_tlv* hmac_tlv,
                    uint8_t* key, size_t key_len, uint8_t* hmac_out) {
   // Calculate the length of the segment list within the SRH.
@@ -125,12 +317,11 @@ int calculate_hmac(uint8_t* src_addr, const struct ipv6_srh* srh, const struct h
   //          offset);
   const struct in6_addr *segments = (const struct in6_addr *)((const uint8_t *)srh + sizeof(struct ipv6_srh));
   int num_segments = segment_list_len / sizeof(struct in6_addr);
-  for (int i = 0; i < num_segments; i++) {
+  // Only format the segments when logging is on, this runs for every packet
+  for (int i = 0; g_logging_enabled && i < num_segments; i++) {
       inet_ntop(AF_INET6, &segments[i], addr_str, sizeof(addr_str));
       char label[32];
-      if(g_logging_enabled) {
-        sprintf(label, "Segment[%d]\n", i);
-      }
+      sprintf(label, "Segment[%d]\n", i);
       LOG_MAIN(DEBUG, "HMAC INPUT | %-18s: %s\n", label, addr_str);
   }
 
@@ -139,6 +330,12 @@ int calculate_hmac(uint8_t* src_addr, const struct ipv6_srh* srh, const struct h
   LOG_MAIN(DEBUG, "Calculating HMAC: Copied SRH Segments (%zu bytes). Offset: %zu\n", segment_list_len,
            offset);  
 
+  // Keys from the key store resume from their precomputed ipad/opad midstates, so only the message
+  // blocks and the outer digest block are compressed here.
+  const struct pot_key* pot_key = keystore_key_of(key);
+  if (pot_key != NULL && key_len == POT_KEY_LENGTH)
+    return mac_cached_compute(pot_mac_get(POT_MAC_HMAC_SHA256), pot_key, input, input_len, hmac_out);
+
   // Perform the actual HMAC calculation using OpenSSL's HMAC function.
   // EVP_sha256() specifies SHA-256 as the hash algorithm.
   // key: The secret key used for HMAC.
@@ -215,8 +412,79 @@ static int hex_string_to_bytes(const char* hex_str, uint8_t* buf, size_t buf_len
   return (int)bytes_needed;
 }
 
-int decrypt(unsigned char* ciphertext, int ciphertext_len, unsigned char* key, unsigned char* iv,
-            unsigned char* plaintext) {
+static struct crypto_ctx_pool* get_lcore_ctx_pool(const struct pot_key_epoch* epoch) {
+  unsigned lcore_id = rte_lcore_id();
+  if (lcore_id >= RTE_MAX_LCORE) return NULL;
+
+  struct crypto_ctx_pool* pool = g_ctx_pools[lcore_id];
+  if (unlikely(pool == NULL)) {
+    pool = rte_zmalloc_socket("crypto_ctx_pool", sizeof(*pool), RTE_CACHE_LINE_SIZE,
+                              rte_lcore_to_socket_id(lcore_id));
+    if (pool == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate crypto context pool for lcore %u\n", lcore_id);
+      return NULL;
+    }
+    g_ctx_pools[lcore_id] = pool;
+  }
+
+  uint8_t slot = epoch->slot;
+  uint32_t version = __atomic_load_n(&epoch->version, __ATOMIC_ACQUIRE);
+  if (likely(pool->version[slot] == version)) return pool;
+
+  // The epoch in this slot was (re)published since the contexts were keyed, expand the key
+  // schedules again. A context is created once per slot and re-keyed in place afterwards.
+  for (uint8_t i = 0; i < epoch->nb_keys; i++) {
+    EVP_CIPHER_CTX** ctx = &pool->ctx[slot][i];
+    if ((*ctx == NULL && (*ctx = EVP_CIPHER_CTX_new()) == NULL) ||
+        1 != EVP_EncryptInit_ex(*ctx, EVP_aes_256_ctr(), NULL, epoch->keys[i].key, NULL)) {
+      LOG_MAIN(ERR, "Cipher context key setup failed for key %u on lcore %u\n", i, lcore_id);
+      pool->version[slot] = 0;
+      pool->nb_keys[slot] = 0;
+      return NULL;
+    }
+  }
+  pool->nb_keys[slot] = epoch->nb_keys;
+  pool->version[slot] = version;
+  LOG_MAIN(DEBUG, "Crypto context pool keyed with %u keys of key set 0x%08x on lcore %u\n", epoch->nb_keys,
+           epoch->key_set_id, lcore_id);
+  return pool;
+}
+
+int aes_ctr_crypt(const struct pot_key* key, const uint8_t* iv, const uint8_t* in, int len, uint8_t* out) {
+  struct crypto_ctx_pool* pool = get_lcore_ctx_pool(keystore_epoch_of(key));
+  if (unlikely(pool == NULL || key->index >= pool->nb_keys[key->slot])) {
+    // Non-EAL threads, or a pool that could not be keyed, use a throwaway context instead
+    return encrypt_oneshot((unsigned char*)in, len, (unsigned char*)key->key, (unsigned char*)iv, out);
+  }
+
+  // AES-CTR is symmetric, so the same pre-keyed context serves both directions. Passing a NULL
+  // cipher and key keeps the expanded key schedule and only resets the counter block.
+  EVP_CIPHER_CTX* ctx = pool->ctx[key->slot][key->index];
+  int out_len;
+  if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv)) {
+    LOG_MAIN(ERR, "Cipher context IV reset failed for key %u.\n", key->index);
+    return -1;
+  }
+  if (1 != EVP_EncryptUpdate(ctx, out, &out_len, in, len)) {
+    LOG_MAIN(ERR, "Cipher update failed for key %u.\n", key->index);
+    return -1;
+  }
+  return out_len;
+}
+
+void crypto_ctx_pool_free(void) {
+  for (unsigned lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+    struct crypto_ctx_pool* pool = g_ctx_pools[lcore_id];
+    if (pool == NULL) continue;
+    for (int s = 0; s < POT_KEY_EPOCHS; s++)
+      for (int i = 0; i < MAX_POT_NODES + 1; i++) EVP_CIPHER_CTX_free(pool->ctx[s][i]);
+    rte_free(pool);
+    g_ctx_pools[lcore_id] = NULL;
+  }
+}
+
+static int decrypt_oneshot(unsigned char* ciphertext, int ciphertext_len, unsigned char* key,
+                           unsigned char* iv, unsigned char* plaintext) {
   EVP_CIPHER_CTX* ctx;
   int len;
   int plaintext_len;
@@ -279,29 +547,74 @@ int decrypt(unsigned char* ciphertext, int ciphertext_len, unsigned char* key, u
   return plaintext_len;
 }
 
-int decrypt_pvf(uint8_t k_pot_in[][HMAC_MAX_LENGTH], uint8_t* nonce, uint8_t pvf_out[32]) {
-  uint8_t plaintext[128];
-  int cipher_len = 32;
-  LOG_MAIN(DEBUG, "Decrypting PVF: Ciphertext length = %d bytes.\n", cipher_len);
+int decrypt(unsigned char* ciphertext, int ciphertext_len, unsigned char* key, unsigned char* iv,
+            unsigned char* plaintext) {
+  // Keys from the key store have a pre-keyed context in the per-lcore pool, anything else is
+  // decrypted with a throwaway context.
+  const struct pot_key* pot_key = keystore_key_of(key);
+  if (pot_key != NULL) return aes_ctr_crypt(pot_key, iv, ciphertext, ciphertext_len, plaintext);
+  return decrypt_oneshot(ciphertext, ciphertext_len, key, iv, plaintext);
+}
+
+// Applies the CTR layers of keys 0..nb_layers-1 of an epoch to a PVF in place. Since every layer
+// uses the same nonce the layers commute into a single XOR of keystreams, so the order of the onion
+// does not matter and one pass covers both encrypt_pvf() and decrypt_pvf().
+static int pvf_xor_layers(const struct pot_key_epoch* epoch, int nb_layers, const uint8_t* nonce, uint8_t* pvf,
+                          uint8_t tag_len) {
+  if (nb_layers <= 0 || nb_layers > epoch->nb_keys || tag_len > HMAC_MAX_LENGTH) return -1;
+
+  if (epoch->has_round_keys) {
+    const struct aes256_round_keys* rks[MAX_POT_NODES + 1];
+    for (int i = 0; i < nb_layers; i++) rks[i] = &epoch->keys[i].rk;
+    aes256_ctr_xor_layers(rks, nb_layers, nonce, pvf, tag_len);
+    return 0;
+  }
 
-  // Decrypt onion-style: loop from 0 to num_transit_nodes (egress to last transit)
-  memcpy(plaintext, pvf_out, cipher_len);
-  LOG_MAIN(DEBUG, "Number of transit nodes: %d\n", num_transit_nodes);
-  for (int i = 0; i <= num_transit_nodes; i++) {
-    int dec_len = decrypt(plaintext, cipher_len, k_pot_in[i], nonce, pvf_out);
-    if (dec_len < 0) {
-      LOG_MAIN(ERR, "PVF decryption failed at layer %d.\n", i);
+  // No AES-NI, still fuse the layers: collect each key's keystream from the pre-keyed contexts and
+  // XOR the accumulated keystream into the PVF once.
+  static const uint8_t zero[HMAC_MAX_LENGTH] = {0};
+  uint8_t keystream[HMAC_MAX_LENGTH];
+  uint8_t acc[HMAC_MAX_LENGTH] = {0};
+  for (int i = 0; i < nb_layers; i++) {
+    if (aes_ctr_crypt(&epoch->keys[i], nonce, zero, tag_len, keystream) != tag_len) return -1;
+    for (int j = 0; j < tag_len; j++) acc[j] ^= keystream[j];
+  }
+  for (int j = 0; j < tag_len; j++) pvf[j] ^= acc[j];
+  return 0;
+}
+
+int decrypt_pvf(const struct pot_key_epoch* epoch, uint8_t* nonce, uint8_t* pvf_out, uint8_t tag_len) {
+  LOG_MAIN(DEBUG, "Decrypting PVF: Ciphertext length = %u bytes.\n", tag_len);
+
+  // Decrypt onion-style, egress to last transit, all layers are stripped in one pass
+  if (pvf_xor_layers(epoch, num_transit_nodes + 1, nonce, pvf_out, tag_len) < 0) {
+    LOG_MAIN(ERR, "PVF decryption failed, key set 0x%08x holds %u keys.\n", epoch->key_set_id, epoch->nb_keys);
+    return -1;
+  }
+  LOG_MAIN(DEBUG, "PVF decryption: %d layers removed in a single pass.\n", num_transit_nodes + 1);
+  return 0;
+}
+
+int decrypt_pvf_burst(const struct pot_key* key, uint8_t* const nonces[], uint8_t* const pvfs[], uint16_t nb,
+                      uint8_t tag_len) {
+  // Multi-buffer kernel when the round keys are available, the whole burst in one interleaved pass
+  if (keystore_epoch_of(key)->has_round_keys) {
+    aes256_ctr_xor_burst(&key->rk, nonces, pvfs, nb, tag_len);
+    return 0;
+  }
+
+  // Otherwise peel each PVF in place with the pre-keyed context of this lcore
+  for (uint16_t i = 0; i < nb; i++) {
+    if (aes_ctr_crypt(key, nonces[i], pvfs[i], tag_len, pvfs[i]) < 0) {
+      LOG_MAIN(ERR, "PVF burst decryption failed at packet %u.\n", i);
       return -1;
     }
-    LOG_MAIN(DEBUG, "PVF decryption layer %d successful.\n", i);
-    memcpy(plaintext, pvf_out, cipher_len);
   }
-  LOG_MAIN(DEBUG, "PVF decryption: All layers completed. Final decrypted HMAC in pvf_out.\n");
   return 0;
 }
 
-int encrypt(unsigned char* plaintext, int plaintext_len, unsigned char* key, unsigned char* iv,
-            unsigned char* ciphertext) {
+static int encrypt_oneshot(unsigned char* plaintext, int plaintext_len, unsigned char* key, unsigned char* iv,
+                           unsigned char* ciphertext) {
   EVP_CIPHER_CTX* ctx;
   int len;
   int ciphertext_len;
@@ -362,6 +675,14 @@ int encrypt(unsigned char* plaintext, int plaintext_len, unsigned char* key, uns
   return ciphertext_len;
 }
 
+int encrypt(unsigned char* plaintext, int plaintext_len, unsigned char* key, unsigned char* iv,
+            unsigned char* ciphertext) {
+  // Same as decrypt(), pooled context for table keys and a one-shot context for everything else
+  const struct pot_key* pot_key = keystore_key_of(key);
+  if (pot_key != NULL) return aes_ctr_crypt(pot_key, iv, plaintext, plaintext_len, ciphertext);
+  return encrypt_oneshot(plaintext, plaintext_len, key, iv, ciphertext);
+}
+
 // void encrypt_pvf(uint8_t k_pot_in[][HMAC_MAX_LENGTH], uint8_t* nonce, uint8_t hmac_out[32]) {
 //   uint8_t buffer[HMAC_MAX_LENGTH];
 //   memcpy(buffer, hmac_out, HMAC_MAX_LENGTH);
@@ -382,64 +703,25 @@ int encrypt(unsigned char* plaintext, int plaintext_len, unsigned char* key, uns
 //   LOG_MAIN(DEBUG, "PVF Encryption: All rounds completed. Final encrypted HMAC in hmac_out.\n");
 // }
 
-void encrypt_pvf(uint8_t k_pot_in[][HMAC_MAX_LENGTH], uint8_t* nonce, uint8_t hmac_out[32]) {
-  uint8_t buffer[HMAC_MAX_LENGTH];
-  memcpy(buffer, hmac_out, HMAC_MAX_LENGTH);
-
-  // 1. First, encrypt the innermost layer with the Egress key (k[0])
-  int enc_len = encrypt(buffer, HMAC_MAX_LENGTH, k_pot_in[0], nonce, hmac_out);
-  if (enc_len < 0) { 
-    return;
-  }
-  memcpy(buffer, hmac_out, HMAC_MAX_LENGTH);
-
-  // 2. Then, encrypt outward with the transit keys in order (k[1], k[2], ...)
-  // This creates the onion layers in the correct order.
+int encrypt_pvf(const struct pot_key_epoch* epoch, uint8_t* nonce, uint8_t* hmac_out, uint8_t tag_len) {
+  // Innermost layer is the egress key (k[0]), then the transit keys k[1], k[2], ... outward. The
+  // layers share the nonce so they are applied in a single pass, producing the same bytes as
+  // chaining encrypt() per key, and transit nodes keep peeling one layer each.
   LOG_MAIN(DEBUG, "Number of transit nodes: %d\n", num_transit_nodes);
-  for (int i = 1; i <= num_transit_nodes; i++) {
-    enc_len = encrypt(buffer, HMAC_MAX_LENGTH, k_pot_in[i], nonce, hmac_out);
-    if (enc_len < 0) { 
-      return;
-    }
-    memcpy(buffer, hmac_out, HMAC_MAX_LENGTH);
-  }
-  LOG_MAIN(DEBUG, "PVF Encryption: All rounds completed.\n");
-}
-
-int compare_hmac(struct hmac_tlv* hmac, uint8_t* hmac_out, struct rte_mbuf* mbuf) {
-  LOG_MAIN(DEBUG, "Comparing HMAC for mbuf %p\n", mbuf);
-
-  // Compares the received HMAC value (from the packet's hmac_tlv structure)
-  // with a newly computed HMAC value (hmac_out).
-  // memcmp() performs a byte-by-byte comparison of two memory blocks.
-  // hmac->hmac_value: The HMAC value extracted from the incoming packet's HMAC TLV.
-  // hmac_out: The HMAC value that was *calculated* by the local device based on the packet's content.
-  // 32: The size in bytes of the HMAC hash. This assumes a fixed HMAC length (e.g., HMAC-SHA256 output is 32
-  // bytes). If the two HMAC values do not match (memcmp returns non-zero), it indicates tampering or an
-  // error.
-  if (memcmp(hmac->hmac_value, hmac_out, 32) != 0) {
-    // If the HMACs do not match, the packet is considered invalid or compromised.
-    // The mbuf is immediately freed, preventing it from being processed further and
-    // returning its memory to the pool. This is a security measure to drop invalid packets.
-    rte_pktmbuf_free(mbuf);
-    LOG_MAIN(ERR, "HMAC mismatch for mbuf %p\n", mbuf);
-    return 0;
-  } else {
-    LOG_MAIN(DEBUG, "HMAC match for mbuf %p\n", mbuf);
-    return 1;
+  if (pvf_xor_layers(epoch, num_transit_nodes + 1, nonce, hmac_out, tag_len) < 0) {
+    LOG_MAIN(ERR, "PVF Encryption failed, key set 0x%08x holds %u keys.\n", epoch->key_set_id, epoch->nb_keys);
+    return -1;
   }
+  LOG_MAIN(DEBUG, "PVF Encryption: %d layers applied in a single pass.\n", num_transit_nodes + 1);
+  return 0;
 }
 
 int generate_nonce(uint8_t nonce[NONCE_LENGTH]) {
-  // Generate cryptographically secure random bytes for the nonce.
-  // RAND_bytes() is an OpenSSL function that fills the specified buffer with
-  // cryptographically secure pseudo-random bytes.
-  // nonce: The buffer to fill with random bytes.
-  // NONCE_LENGTH: The number of random bytes to generate (size of the nonce).
-  // Returns 1 on success, 0 or -1 on failure.
-  if (RAND_bytes(nonce, NONCE_LENGTH) != 1) {
-    // If RAND_bytes fails, it indicates a problem with the random number generator.
-    // This is a security-critical failure, as non-random nonces can compromise encryption.
+  // Nonces come from the calling lcore's pool (see nonce.h), which is seeded from RAND_bytes() and
+  // hands out batched DRBG output or salt+counter nonces instead of hitting OpenSSL per packet.
+  if (nonce_pool_next(nonce) != 0) {
+    // A failing generator is a security-critical failure, as non-random nonces can compromise
+    // encryption, so the caller has to drop the packet.
     LOG_MAIN(ERR, "Failed to generate cryptographically secure nonce.\n");
     return 1;
   }
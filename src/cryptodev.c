@@ -0,0 +1,412 @@
+#include "cryptodev.h"
+
+#include <rte_cryptodev.h>
+#include <rte_errno.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+
+#include "crypto.h"
+#include "forward.h"
+#include "mac.h"
+#include "utils/logging.h"
+
+#define POT_CDEV_NB_OPS 8192
+#define POT_CDEV_OP_CACHE 256
+#define POT_CDEV_NB_SCRATCH 4096
+#define POT_CDEV_SCRATCH_CACHE 256
+#define POT_CDEV_QP_DESC 2048
+// Staging room per lcore, a full burst plus the largest job (ingress: every layer and the HMAC)
+#define POT_CDEV_STAGE_SIZE (BURST_SIZE + MAX_POT_NODES + 2)
+
+// The CTR IV lives at the start of each op's private area, right after the symmetric op
+#define POT_CDEV_IV_OFFSET (sizeof(struct rte_crypto_op) + sizeof(struct rte_crypto_sym_op))
+
+// Private area of every op. done is only set on the last op of a job, the earlier ones complete
+// silently and only contribute their status.
+struct pot_cdev_op_priv {
+  uint8_t iv[NONCE_LENGTH];
+  struct rte_mbuf* pkt;
+  struct rte_mbuf* scratch; // holds the HMAC message and digest for HMAC ops
+  uint8_t* digest;
+  pot_cryptodev_done_fn done;
+  uint8_t force_fail;
+};
+
+// Per-lcore submission state, only touched by its own lcore
+struct pot_cdev_lcore {
+  uint16_t qp_id;
+  uint16_t nb_staged;
+  uint8_t job_failed; // an op of the job currently being dequeued failed
+  struct rte_crypto_op* staged[POT_CDEV_STAGE_SIZE];
+} __rte_cache_aligned;
+
+static struct {
+  uint8_t dev_id;
+  uint16_t nb_qps;
+  uint16_t next_qp;
+  struct rte_mempool* sess_pool;
+  struct rte_mempool* op_pool;
+  struct rte_mempool* scratch_pool;
+  uint8_t in_place_sgl; // the PMD takes chained mbufs as cipher op sources
+  // Sessions per key store epoch slot. Sessions replaced by a rotation are only freed on the next
+  // one, so ops still in flight with them never see a freed session.
+  uint8_t nb_keys[POT_KEY_EPOCHS];
+  void* cipher_sess[POT_KEY_EPOCHS][MAX_POT_NODES + 1];
+  void* auth_sess[POT_KEY_EPOCHS][MAX_POT_NODES + 1];
+  uint8_t nb_retired;
+  void* retired_sess[2 * (MAX_POT_NODES + 1)];
+} g_cdev;
+
+static struct pot_cdev_lcore* g_cdev_lcores[RTE_MAX_LCORE];
+
+static inline struct pot_cdev_op_priv* op_priv(struct rte_crypto_op* op) {
+  return rte_crypto_op_ctod_offset(op, struct pot_cdev_op_priv*, POT_CDEV_IV_OFFSET);
+}
+
+static struct pot_cdev_lcore* get_lcore_state(void) {
+  unsigned lcore_id = rte_lcore_id();
+  if (lcore_id >= RTE_MAX_LCORE || g_cdev.op_pool == NULL) return NULL;
+
+  struct pot_cdev_lcore* st = g_cdev_lcores[lcore_id];
+  if (unlikely(st == NULL)) {
+    st = rte_zmalloc_socket("pot_cdev_lcore", sizeof(*st), RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+    if (st == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate cryptodev state for lcore %u\n", lcore_id);
+      return NULL;
+    }
+    // Queue pairs are handed out in lcore start order; lcores beyond the device's queue pair count
+    // would share one, which the cryptodev API does not allow, so they are refused instead.
+    uint16_t qp = __atomic_fetch_add(&g_cdev.next_qp, 1, __ATOMIC_RELAXED);
+    if (qp >= g_cdev.nb_qps) {
+      LOG_MAIN(ERR, "No cryptodev queue pair left for lcore %u (%u configured)\n", lcore_id, g_cdev.nb_qps);
+      rte_free(st);
+      return NULL;
+    }
+    st->qp_id = qp;
+    g_cdev_lcores[lcore_id] = st;
+    LOG_MAIN(INFO, "Lcore %u uses cryptodev %u queue pair %u\n", lcore_id, g_cdev.dev_id, qp);
+  }
+  return st;
+}
+
+static void release_op(struct rte_crypto_op* op) {
+  struct pot_cdev_op_priv* priv = op_priv(op);
+  if (priv->scratch != NULL) rte_pktmbuf_free(priv->scratch);
+  rte_crypto_op_free(op);
+}
+
+static void flush_staged(struct pot_cdev_lcore* st) {
+  if (st->nb_staged == 0) return;
+
+  uint16_t nb = st->nb_staged;
+  uint16_t sent = rte_cryptodev_enqueue_burst(g_cdev.dev_id, st->qp_id, st->staged, nb);
+  st->nb_staged = 0;
+  if (likely(sent == nb)) return;
+
+  // The queue pair is full. Jobs that did not make it at all are failed right away. A job cut in
+  // the middle already has ops in flight, so its last accepted op takes over the callback and
+  // reports the job as failed once it comes back. Only our own private area is rewritten here, the
+  // device never reads past the IV.
+  struct rte_mbuf* cut = NULL;
+  struct pot_cdev_op_priv* cut_priv = NULL;
+  if (sent > 0 && op_priv(st->staged[sent - 1])->done == NULL) {
+    cut_priv = op_priv(st->staged[sent - 1]);
+    cut_priv->force_fail = 1;
+    cut = cut_priv->pkt;
+  }
+
+  LOG_MAIN(WARNING, "Cryptodev queue pair %u full, %u of %u ops not enqueued\n", st->qp_id, nb - sent, nb);
+  for (uint16_t i = sent; i < nb; i++) {
+    struct pot_cdev_op_priv* priv = op_priv(st->staged[i]);
+    if (priv->done != NULL) {
+      if (priv->pkt == cut)
+        cut_priv->done = priv->done;
+      else
+        priv->done(priv->pkt, NULL, 0);
+    }
+    release_op(st->staged[i]);
+  }
+}
+
+int pot_cryptodev_submit(struct rte_mbuf* m, const struct pot_cryptodev_job* job) {
+  struct pot_cdev_lcore* st = get_lcore_state();
+  if (unlikely(st == NULL)) return -1;
+
+  uint8_t slot = job->epoch->slot;
+  uint8_t nb_keys = __atomic_load_n(&g_cdev.nb_keys[slot], __ATOMIC_ACQUIRE);
+  uint16_t nb_ops = job->nb_cipher + (job->hmac_input != NULL ? 1 : 0);
+  if (unlikely(nb_ops == 0 || job->first_key + job->nb_cipher > nb_keys ||
+               (job->nb_cipher > 0 && (job->pvf_len == 0 || job->pvf_len > HMAC_MAX_LENGTH)) ||
+               (job->hmac_input != NULL && job->hmac_key >= nb_keys))) {
+    LOG_MAIN(ERR, "Cryptodev: invalid job (keys %u+%u, hmac key %u, %u keys in key set 0x%08x)\n",
+             job->first_key, job->nb_cipher, job->hmac_key, nb_keys, job->epoch->key_set_id);
+    return -1;
+  }
+
+  // The PVF is always in the first segment, but a PMD without SGL support rejects chained sources
+  if (unlikely(job->nb_cipher > 0 && !g_cdev.in_place_sgl && !rte_pktmbuf_is_contiguous(m))) {
+    LOG_MAIN(WARNING, "Cryptodev: %s cannot cipher chained mbufs (%u segments)\n",
+             rte_cryptodev_name_get(g_cdev.dev_id), m->nb_segs);
+    return -1;
+  }
+
+  // Jobs are staged whole so a flush never splits one on our side
+  if (st->nb_staged + nb_ops > POT_CDEV_STAGE_SIZE) flush_staged(st);
+
+  struct rte_crypto_op** ops = &st->staged[st->nb_staged];
+  if (unlikely(rte_crypto_op_bulk_alloc(g_cdev.op_pool, RTE_CRYPTO_OP_TYPE_SYMMETRIC, ops, nb_ops) != nb_ops)) {
+    LOG_MAIN(WARNING, "Cryptodev: out of crypto ops\n");
+    return -1;
+  }
+
+  for (uint16_t i = 0; i < nb_ops; i++) {
+    struct pot_cdev_op_priv* priv = op_priv(ops[i]);
+    priv->pkt = m;
+    priv->scratch = NULL;
+    priv->digest = NULL;
+    priv->done = NULL;
+    priv->force_fail = 0;
+  }
+
+  for (uint8_t i = 0; i < job->nb_cipher; i++) {
+    struct rte_crypto_sym_op* sym = ops[i]->sym;
+    rte_crypto_op_attach_sym_session(ops[i], g_cdev.cipher_sess[slot][job->first_key + i]);
+    sym->m_src = m;
+    sym->m_dst = NULL;
+    sym->cipher.data.offset = job->pvf_offset;
+    sym->cipher.data.length = job->pvf_len;
+    rte_memcpy(op_priv(ops[i])->iv, job->nonce, NONCE_LENGTH);
+  }
+
+  if (job->hmac_input != NULL) {
+    // The HMAC message is not contiguous in the packet, so it is laid out in a scratch mbuf with
+    // room for the digest right behind it
+    struct rte_crypto_op* op = ops[nb_ops - 1];
+    struct pot_cdev_op_priv* priv = op_priv(op);
+    struct rte_mbuf* scratch = rte_pktmbuf_alloc(g_cdev.scratch_pool);
+    uint8_t* data = scratch ? (uint8_t*)rte_pktmbuf_append(scratch, job->hmac_input_len + HMAC_MAX_LENGTH) : NULL;
+    if (unlikely(data == NULL)) {
+      LOG_MAIN(WARNING, "Cryptodev: no scratch buffer for a %u byte HMAC message\n", job->hmac_input_len);
+      if (scratch != NULL) rte_pktmbuf_free(scratch);
+      for (uint16_t i = 0; i < nb_ops; i++) rte_crypto_op_free(ops[i]);
+      return -1;
+    }
+    rte_memcpy(data, job->hmac_input, job->hmac_input_len);
+    priv->scratch = scratch;
+    priv->digest = data + job->hmac_input_len;
+
+    struct rte_crypto_sym_op* sym = op->sym;
+    rte_crypto_op_attach_sym_session(op, g_cdev.auth_sess[slot][job->hmac_key]);
+    sym->m_src = scratch;
+    sym->m_dst = NULL;
+    sym->auth.data.offset = 0;
+    sym->auth.data.length = job->hmac_input_len;
+    sym->auth.digest.data = priv->digest;
+    sym->auth.digest.phys_addr = rte_pktmbuf_iova_offset(scratch, job->hmac_input_len);
+  }
+
+  op_priv(ops[nb_ops - 1])->done = job->done;
+  st->nb_staged += nb_ops;
+  return 0;
+}
+
+void pot_cryptodev_poll(void) {
+  struct pot_cdev_lcore* st = get_lcore_state();
+  if (unlikely(st == NULL)) return;
+
+  flush_staged(st);
+
+  struct rte_crypto_op* ops[BURST_SIZE];
+  uint16_t nb = rte_cryptodev_dequeue_burst(g_cdev.dev_id, st->qp_id, ops, BURST_SIZE);
+  for (uint16_t i = 0; i < nb; i++) {
+    struct pot_cdev_op_priv* priv = op_priv(ops[i]);
+    if (unlikely(ops[i]->status != RTE_CRYPTO_OP_STATUS_SUCCESS || priv->force_fail)) {
+      LOG_MAIN(DEBUG, "Cryptodev op failed with status %u\n", ops[i]->status);
+      st->job_failed = 1;
+    }
+
+    // Ops come back in enqueue order and a job's ops are contiguous, so the one carrying the
+    // callback closes the job
+    if (priv->done != NULL) {
+      priv->done(priv->pkt, priv->digest, !st->job_failed);
+      st->job_failed = 0;
+    }
+    release_op(ops[i]);
+  }
+
+  // Callbacks may have submitted follow-up jobs (ingress encrypts once its HMAC is back)
+  flush_staged(st);
+}
+
+static void* create_session(struct rte_crypto_sym_xform* xform, const char* what, int key) {
+  void* sess = rte_cryptodev_sym_session_create(g_cdev.dev_id, xform, g_cdev.sess_pool);
+  if (sess == NULL) LOG_MAIN(ERR, "Cryptodev: %s session for key %d failed: %s\n", what, key, rte_strerror(rte_errno));
+  return sess;
+}
+
+static void free_retired_sessions(void) {
+  for (uint8_t i = 0; i < g_cdev.nb_retired; i++) rte_cryptodev_sym_session_free(g_cdev.dev_id, g_cdev.retired_sess[i]);
+  g_cdev.nb_retired = 0;
+}
+
+// Key store publish callback, also used for the epoch loaded before init. Runs while the epoch's
+// slot is not yet visible to the datapath, so only jobs of the epoch being overwritten can still
+// pick up the old sessions of the slot; those are retired instead of freed.
+static void pot_cryptodev_rekey(const struct pot_key_epoch* epoch) {
+  uint8_t slot = epoch->slot;
+  free_retired_sessions();
+  __atomic_store_n(&g_cdev.nb_keys[slot], 0, __ATOMIC_RELEASE);
+
+  // AES-CTR encryption and decryption are the same operation, so one cipher session per key serves
+  // ingress, transit and egress alike
+  for (uint8_t i = 0; i < epoch->nb_keys; i++) {
+    struct rte_crypto_sym_xform cipher = {
+        .next = NULL,
+        .type = RTE_CRYPTO_SYM_XFORM_CIPHER,
+        .cipher = {
+            .op = RTE_CRYPTO_CIPHER_OP_ENCRYPT,
+            .algo = RTE_CRYPTO_CIPHER_AES_CTR,
+            .key = {.data = epoch->keys[i].key, .length = POT_KEY_LENGTH},
+            .iv = {.offset = POT_CDEV_IV_OFFSET, .length = NONCE_LENGTH},
+        },
+    };
+    struct rte_crypto_sym_xform auth = {
+        .next = NULL,
+        .type = RTE_CRYPTO_SYM_XFORM_AUTH,
+        .auth = {
+            .op = RTE_CRYPTO_AUTH_OP_GENERATE,
+            .algo = RTE_CRYPTO_AUTH_SHA256_HMAC,
+            .key = {.data = epoch->keys[i].key, .length = POT_KEY_LENGTH},
+            .digest_length = HMAC_MAX_LENGTH,
+        },
+    };
+    void* cipher_sess = create_session(&cipher, "AES-CTR", i);
+    void* auth_sess = create_session(&auth, "HMAC-SHA256", i);
+    if (cipher_sess == NULL || auth_sess == NULL) {
+      // The slot stays without keys, jobs naming this key set are refused and their packets dropped
+      if (cipher_sess != NULL) rte_cryptodev_sym_session_free(g_cdev.dev_id, cipher_sess);
+      if (auth_sess != NULL) rte_cryptodev_sym_session_free(g_cdev.dev_id, auth_sess);
+      return;
+    }
+    if (g_cdev.cipher_sess[slot][i] != NULL) g_cdev.retired_sess[g_cdev.nb_retired++] = g_cdev.cipher_sess[slot][i];
+    if (g_cdev.auth_sess[slot][i] != NULL) g_cdev.retired_sess[g_cdev.nb_retired++] = g_cdev.auth_sess[slot][i];
+    __atomic_store_n(&g_cdev.cipher_sess[slot][i], cipher_sess, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_cdev.auth_sess[slot][i], auth_sess, __ATOMIC_RELEASE);
+  }
+  __atomic_store_n(&g_cdev.nb_keys[slot], epoch->nb_keys, __ATOMIC_RELEASE);
+  LOG_MAIN(INFO, "Cryptodev: %u keys of key set 0x%08x keyed in slot %u\n", epoch->nb_keys, epoch->key_set_id,
+           slot);
+}
+
+int pot_cryptodev_init(void) {
+  if (rte_cryptodev_count() == 0) {
+    LOG_MAIN(ERR, "No cryptodev available, start the EAL with e.g. --vdev crypto_aesni_mb\n");
+    return -1;
+  }
+  if (g_pot_mac->alg != POT_MAC_HMAC_SHA256) {
+    LOG_MAIN(ERR, "Cryptodev backend only implements HMAC-SHA256, not %s\n", g_pot_mac->name);
+    return -1;
+  }
+  const struct pot_key_epoch* current = keystore_current();
+  if (current == NULL) {
+    LOG_MAIN(ERR, "Cryptodev backend needs the PoT keys to be loaded first\n");
+    return -1;
+  }
+
+  g_cdev.dev_id = 0;
+  struct rte_cryptodev_info info;
+  rte_cryptodev_info_get(g_cdev.dev_id, &info);
+  g_cdev.in_place_sgl = (info.feature_flags & RTE_CRYPTODEV_FF_IN_PLACE_SGL) != 0;
+
+  int socket_id = rte_cryptodev_socket_id(g_cdev.dev_id);
+  if (socket_id < 0) socket_id = (int)rte_socket_id();
+
+  g_cdev.nb_qps = RTE_MIN(rte_lcore_count(), info.max_nb_queue_pairs);
+  g_cdev.next_qp = 0;
+
+  // Cipher and HMAC session per key, for both epochs and the sessions retired by the last rotation
+  uint32_t nb_sessions = 2 * (POT_KEY_EPOCHS + 1) * (MAX_POT_NODES + 1);
+  g_cdev.sess_pool = rte_cryptodev_sym_session_pool_create(
+      "POT_CDEV_SESS", nb_sessions, rte_cryptodev_sym_get_private_session_size(g_cdev.dev_id), 0, 0, socket_id);
+  g_cdev.op_pool = rte_crypto_op_pool_create("POT_CDEV_OPS", RTE_CRYPTO_OP_TYPE_SYMMETRIC, POT_CDEV_NB_OPS,
+                                             POT_CDEV_OP_CACHE, sizeof(struct pot_cdev_op_priv), socket_id);
+  g_cdev.scratch_pool = rte_pktmbuf_pool_create("POT_CDEV_SCRATCH", POT_CDEV_NB_SCRATCH, POT_CDEV_SCRATCH_CACHE, 0,
+                                                RTE_MBUF_DEFAULT_BUF_SIZE, socket_id);
+  if (g_cdev.sess_pool == NULL || g_cdev.op_pool == NULL || g_cdev.scratch_pool == NULL) {
+    LOG_MAIN(ERR, "Cryptodev: mempool creation failed: %s\n", rte_strerror(rte_errno));
+    pot_cryptodev_close();
+    return -1;
+  }
+
+  struct rte_cryptodev_config conf = {
+      .socket_id = socket_id,
+      .nb_queue_pairs = g_cdev.nb_qps,
+      .ff_disable = 0,
+  };
+  if (rte_cryptodev_configure(g_cdev.dev_id, &conf) < 0) {
+    LOG_MAIN(ERR, "Cryptodev %s: configure failed\n", rte_cryptodev_name_get(g_cdev.dev_id));
+    pot_cryptodev_close();
+    return -1;
+  }
+
+  struct rte_cryptodev_qp_conf qp_conf = {
+      .nb_descriptors = POT_CDEV_QP_DESC,
+      .mp_session = g_cdev.sess_pool,
+  };
+  for (uint16_t qp = 0; qp < g_cdev.nb_qps; qp++) {
+    if (rte_cryptodev_queue_pair_setup(g_cdev.dev_id, qp, &qp_conf, socket_id) < 0) {
+      LOG_MAIN(ERR, "Cryptodev: queue pair %u setup failed\n", qp);
+      pot_cryptodev_close();
+      return -1;
+    }
+  }
+
+  if (rte_cryptodev_start(g_cdev.dev_id) < 0) {
+    LOG_MAIN(ERR, "Cryptodev %s: start failed\n", rte_cryptodev_name_get(g_cdev.dev_id));
+    pot_cryptodev_close();
+    return -1;
+  }
+
+  pot_cryptodev_rekey(current);
+  if (g_cdev.nb_keys[current->slot] == 0) {
+    pot_cryptodev_close();
+    return -1;
+  }
+  keystore_set_publish_cb(pot_cryptodev_rekey);
+
+  LOG_MAIN(INFO, "Cryptodev backend on %s (driver %s), %u queue pair(s), %u keys\n",
+           rte_cryptodev_name_get(g_cdev.dev_id), info.driver_name, g_cdev.nb_qps, g_cdev.nb_keys[current->slot]);
+  return 0;
+}
+
+void pot_cryptodev_close(void) {
+  if (g_cdev.op_pool == NULL && g_cdev.sess_pool == NULL && g_cdev.scratch_pool == NULL) return;
+
+  for (unsigned lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+    struct pot_cdev_lcore* st = g_cdev_lcores[lcore_id];
+    if (st == NULL) continue;
+    for (uint16_t i = 0; i < st->nb_staged; i++) release_op(st->staged[i]);
+    rte_free(st);
+    g_cdev_lcores[lcore_id] = NULL;
+  }
+
+  keystore_set_publish_cb(NULL);
+  rte_cryptodev_stop(g_cdev.dev_id);
+  for (int s = 0; s < POT_KEY_EPOCHS; s++) {
+    for (int i = 0; i < MAX_POT_NODES + 1; i++) {
+      if (g_cdev.cipher_sess[s][i] != NULL) rte_cryptodev_sym_session_free(g_cdev.dev_id, g_cdev.cipher_sess[s][i]);
+      if (g_cdev.auth_sess[s][i] != NULL) rte_cryptodev_sym_session_free(g_cdev.dev_id, g_cdev.auth_sess[s][i]);
+      g_cdev.cipher_sess[s][i] = NULL;
+      g_cdev.auth_sess[s][i] = NULL;
+    }
+    g_cdev.nb_keys[s] = 0;
+  }
+  free_retired_sessions();
+
+  rte_mempool_free(g_cdev.op_pool);
+  rte_mempool_free(g_cdev.scratch_pool);
+  rte_mempool_free(g_cdev.sess_pool);
+  g_cdev.op_pool = NULL;
+  g_cdev.scratch_pool = NULL;
+  g_cdev.sess_pool = NULL;
+}
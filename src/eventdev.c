@@ -0,0 +1,375 @@
+#include "eventdev.h"
+
+#include <rte_bus_vdev.h>
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_eventdev.h>
+#include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_service.h>
+
+#include "forward.h"
+#include "headers.h"
+#include "keystore.h"
+#include "nonce.h"
+#include "utils/logging.h"
+#include "utils/role.h"
+
+int g_eventdev_workers = 0;
+
+// Event ports: the RX lcore injects on the first one, the TX lcore dequeues from the last one
+#define POT_EVDEV_RX_PORT 0
+#define POT_EVDEV_TX_PORT(nb_workers) ((nb_workers) + 1)
+
+// One worker's outgoing events. Only its own lcore touches it; every event it dequeued leaves its
+// port again as exactly one forward or release, so nb_forwarded is counted against the dequeue.
+struct pot_evdev_worker {
+  uint8_t port_id;
+  uint16_t nb_out;
+  uint16_t nb_forwarded;
+  struct rte_event out[POT_EVDEV_BURST];
+} __rte_cache_aligned;
+
+static struct {
+  uint8_t dev_id;
+  uint8_t started;
+  uint32_t service_id;
+  uint16_t rx_port;
+  struct pot_evdev_worker* workers[POT_EVDEV_MAX_WORKERS];
+} g_evdev;
+
+// The worker running on each lcore, NULL on every other one
+static struct pot_evdev_worker* g_evdev_lcores[RTE_MAX_LCORE];
+
+static int setup_queues(uint8_t dev_id) {
+  for (uint8_t q = 0; q < POT_EVDEV_NB_QUEUES; q++) {
+    struct rte_event_queue_conf conf;
+    rte_event_queue_default_conf_get(dev_id, q, &conf);
+    conf.schedule_type = RTE_SCHED_TYPE_ATOMIC;
+    conf.nb_atomic_flows = POT_EVDEV_NB_FLOWS;
+    conf.nb_atomic_order_sequences = POT_EVDEV_NB_FLOWS;
+    conf.event_queue_cfg = q == POT_EVDEV_Q_TX ? RTE_EVENT_QUEUE_CFG_SINGLE_LINK : 0;
+    if (rte_event_queue_setup(dev_id, q, &conf) < 0) {
+      LOG_MAIN(ERR, "Eventdev: queue %u setup failed\n", q);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int setup_ports(uint8_t dev_id, unsigned nb_workers) {
+  static const uint8_t worker_queues[] = {POT_EVDEV_Q_PARSE, POT_EVDEV_Q_CRYPTO};
+  static const uint8_t tx_queues[] = {POT_EVDEV_Q_TX};
+
+  for (uint8_t port = 0; port <= POT_EVDEV_TX_PORT(nb_workers); port++) {
+    struct rte_event_port_conf conf;
+    rte_event_port_default_conf_get(dev_id, port, &conf);
+    // New packets stop being injected before the device is full, so events already inside it can
+    // always be forwarded to their next stage
+    conf.new_event_threshold = port == POT_EVDEV_RX_PORT ? POT_EVDEV_NB_EVENTS * 3 / 4 : POT_EVDEV_NB_EVENTS;
+    if (rte_event_port_setup(dev_id, port, &conf) < 0) {
+      LOG_MAIN(ERR, "Eventdev: port %u setup failed\n", port);
+      return -1;
+    }
+  }
+
+  for (unsigned i = 0; i < nb_workers; i++) {
+    if (rte_event_port_link(dev_id, i + 1, worker_queues, NULL, RTE_DIM(worker_queues)) !=
+        (int)RTE_DIM(worker_queues)) {
+      LOG_MAIN(ERR, "Eventdev: linking worker port %u failed\n", i + 1);
+      return -1;
+    }
+  }
+  if (rte_event_port_link(dev_id, POT_EVDEV_TX_PORT(nb_workers), tx_queues, NULL, 1) != 1) {
+    LOG_MAIN(ERR, "Eventdev: linking the TX port failed\n");
+    return -1;
+  }
+  return 0;
+}
+
+int pot_eventdev_init(unsigned nb_workers) {
+  if (nb_workers == 0 || nb_workers > POT_EVDEV_MAX_WORKERS) {
+    LOG_MAIN(ERR, "Eventdev mode needs 1 to %u workers, got %u\n", POT_EVDEV_MAX_WORKERS, nb_workers);
+    return -1;
+  }
+  if (rte_lcore_count() < nb_workers + 3) {
+    LOG_MAIN(ERR, "Eventdev mode with %u workers needs %u lcores, the main lcore, RX, TX and the workers, "
+             "only %u are enabled\n", nb_workers, nb_workers + 3, rte_lcore_count());
+    return -1;
+  }
+
+  if (rte_vdev_init(POT_EVDEV_NAME, NULL) < 0) {
+    LOG_MAIN(ERR, "Eventdev: cannot create %s\n", POT_EVDEV_NAME);
+    return -1;
+  }
+  int dev_id = rte_event_dev_get_dev_id(POT_EVDEV_NAME);
+  if (dev_id < 0) {
+    LOG_MAIN(ERR, "Eventdev: %s not found\n", POT_EVDEV_NAME);
+    rte_vdev_uninit(POT_EVDEV_NAME);
+    return -1;
+  }
+  g_evdev.dev_id = (uint8_t)dev_id;
+
+  struct rte_event_dev_info info;
+  rte_event_dev_info_get(g_evdev.dev_id, &info);
+  if (POT_EVDEV_TX_PORT(nb_workers) + 1 > info.max_event_ports) {
+    LOG_MAIN(ERR, "Eventdev %s has %u event ports, at most %u workers next to RX and TX\n", POT_EVDEV_NAME,
+             info.max_event_ports, info.max_event_ports > 2 ? info.max_event_ports - 2 : 0);
+    pot_eventdev_close();
+    return -1;
+  }
+  struct rte_event_dev_config conf = {
+      .nb_event_queues = POT_EVDEV_NB_QUEUES,
+      .nb_event_ports = POT_EVDEV_TX_PORT(nb_workers) + 1,
+      .nb_events_limit = POT_EVDEV_NB_EVENTS,
+      .nb_event_queue_flows = POT_EVDEV_NB_FLOWS,
+      .nb_event_port_dequeue_depth = info.max_event_port_dequeue_depth,
+      .nb_event_port_enqueue_depth = info.max_event_port_enqueue_depth,
+      .dequeue_timeout_ns = 0,
+  };
+  if (rte_event_dev_configure(g_evdev.dev_id, &conf) < 0) {
+    LOG_MAIN(ERR, "Eventdev %s: configure failed\n", POT_EVDEV_NAME);
+    pot_eventdev_close();
+    return -1;
+  }
+  if (setup_queues(g_evdev.dev_id) < 0 || setup_ports(g_evdev.dev_id, nb_workers) < 0) {
+    pot_eventdev_close();
+    return -1;
+  }
+
+  // The software scheduler is a service; the RX lcore runs it between bursts instead of a service core
+  if (rte_event_dev_service_id_get(g_evdev.dev_id, &g_evdev.service_id) != 0 ||
+      rte_service_runstate_set(g_evdev.service_id, 1) != 0 ||
+      rte_service_set_runstate_mapped_check(g_evdev.service_id, 0) != 0) {
+    LOG_MAIN(ERR, "Eventdev %s: cannot set up its scheduling service\n", POT_EVDEV_NAME);
+    pot_eventdev_close();
+    return -1;
+  }
+
+  for (unsigned i = 0; i < nb_workers; i++) {
+    struct pot_evdev_worker* w =
+        rte_zmalloc_socket("pot_evdev_worker", sizeof(*w), RTE_CACHE_LINE_SIZE, rte_socket_id());
+    if (w == NULL) {
+      LOG_MAIN(ERR, "Eventdev: failed to allocate worker %u\n", i);
+      pot_eventdev_close();
+      return -1;
+    }
+    w->port_id = (uint8_t)(i + 1);
+    g_evdev.workers[i] = w;
+  }
+
+  if (rte_event_dev_start(g_evdev.dev_id) < 0) {
+    LOG_MAIN(ERR, "Eventdev %s: start failed\n", POT_EVDEV_NAME);
+    pot_eventdev_close();
+    return -1;
+  }
+  g_evdev.started = 1;
+  g_eventdev_workers = (int)nb_workers;
+  LOG_MAIN(INFO, "Eventdev %s: RX lcore, %u workers over atomic parse and crypto queues, TX lcore\n",
+           POT_EVDEV_NAME, nb_workers);
+  return 0;
+}
+
+void pot_eventdev_close(void) {
+  for (unsigned i = 0; i < POT_EVDEV_MAX_WORKERS; i++) {
+    rte_free(g_evdev.workers[i]);
+    g_evdev.workers[i] = NULL;
+  }
+  if (rte_event_dev_get_dev_id(POT_EVDEV_NAME) < 0) return;
+  if (g_evdev.started) rte_event_dev_stop(g_evdev.dev_id);
+  rte_event_dev_close(g_evdev.dev_id);
+  rte_vdev_uninit(POT_EVDEV_NAME);
+  g_evdev.started = 0;
+  g_eventdev_workers = 0;
+}
+
+unsigned pot_eventdev_mbufs_needed(void) {
+  return g_eventdev_workers > 0 ? POT_EVDEV_NB_EVENTS + ((unsigned)g_eventdev_workers + 2) * BURST_SIZE : 0;
+}
+
+// Source, destination and flow label, what RFC 6437 says identifies an IPv6 flow. The ingress
+// receives unlabeled packets whose L4 header is still right behind IPv6, those are told apart by
+// their 5-tuple; the label it stamps from that 5-tuple carries the flows on to transit and egress.
+static inline uint32_t flow_hash(struct rte_mbuf* m) {
+  if (unlikely(rte_pktmbuf_data_len(m) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr)))
+    return 0;
+  const struct rte_ipv6_hdr* ipv6 =
+      rte_pktmbuf_mtod_offset(m, const struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+  uint32_t label = rte_be_to_cpu_32(ipv6->vtc_flow) & RTE_IPV6_HDR_FL_MASK;
+  if (label == 0) return ipv6_flow_tuple_hash(m);
+  return rte_hash_crc(&ipv6->src_addr, 2 * sizeof(ipv6->src_addr), label);
+}
+
+static inline void event_fill(struct rte_event* ev, struct rte_mbuf* m, uint8_t queue_id, uint8_t op) {
+  ev->event = 0;
+  ev->flow_id = m->hash.rss & 0xfffff;
+  ev->op = op;
+  ev->sched_type = RTE_SCHED_TYPE_ATOMIC;
+  ev->queue_id = queue_id;
+  ev->event_type = RTE_EVENT_TYPE_CPU;
+  ev->priority = RTE_EVENT_DEV_PRIORITY_NORMAL;
+  ev->mbuf = m;
+}
+
+// Forwards and releases never exceed what the port dequeued, so the device takes them once it has
+// had time to schedule, the worker keeps offering them until it does
+static void worker_flush(struct pot_evdev_worker* w) {
+  uint16_t done = 0;
+  while (done < w->nb_out) {
+    done += rte_event_enqueue_burst(g_evdev.dev_id, w->port_id, w->out + done, w->nb_out - done);
+    if (done < w->nb_out) rte_pause();
+  }
+  w->nb_out = 0;
+}
+
+static inline void worker_forward(struct pot_evdev_worker* w, struct rte_mbuf* m, uint8_t queue_id) {
+  if (unlikely(w->nb_out == POT_EVDEV_BURST)) worker_flush(w);
+  event_fill(&w->out[w->nb_out++], m, queue_id, RTE_EVENT_OP_FORWARD);
+  w->nb_forwarded++;
+}
+
+int pot_eventdev_tx_stage(struct rte_mbuf* mbuf, uint16_t tx_port_id) {
+  unsigned lcore_id = rte_lcore_id();
+  struct pot_evdev_worker* w = lcore_id < RTE_MAX_LCORE ? g_evdev_lcores[lcore_id] : NULL;
+  if (w == NULL) return 0;
+
+  // The TX lcore reads the port back from the mbuf, nothing past RX looks at the input port
+  mbuf->port = tx_port_id;
+  worker_forward(w, mbuf, POT_EVDEV_Q_TX);
+  return 1;
+}
+
+// The packets the parse stage or a handler dropped still hold their flow's atomic context, it is
+// given back right away instead of on the next dequeue
+static void worker_release(struct pot_evdev_worker* w, uint16_t nb_dequeued) {
+  uint16_t nb_release = nb_dequeued - w->nb_forwarded;
+  for (uint16_t i = 0; i < nb_release; i++) {
+    if (unlikely(w->nb_out == POT_EVDEV_BURST)) worker_flush(w);
+    struct rte_event* ev = &w->out[w->nb_out++];
+    ev->event = 0;
+    ev->op = RTE_EVENT_OP_RELEASE;
+  }
+  worker_flush(w);
+  w->nb_forwarded = 0;
+}
+
+static int pot_evdev_worker_main(void* arg) {
+  struct pot_evdev_worker* w = arg;
+  enum role cur_role = global_role;
+  uint16_t rx_port_id = g_evdev.rx_port;
+  LOG_MAIN(INFO, "Eventdev worker started on lcore %u, event port %u\n", rte_lcore_id(), w->port_id);
+  keystore_reader_register();
+
+  while (1) {
+    keystore_quiescent();
+    struct rte_event ev[POT_EVDEV_BURST];
+    uint16_t nb = rte_event_dequeue_burst(g_evdev.dev_id, w->port_id, ev, POT_EVDEV_BURST, 0);
+    if (nb == 0) {
+      // Ingress tops its nonce ring up while idle so refills stay off the packet path
+      if (cur_role == ROLE_INGRESS) nonce_pool_fill();
+      rte_pause();
+      continue;
+    }
+
+    // A dequeue can mix both stages, each is run as one burst
+    struct rte_mbuf* parse[POT_EVDEV_BURST];
+    struct rte_mbuf* crypto[POT_EVDEV_BURST];
+    uint16_t nb_parse = 0, nb_crypto = 0;
+    for (uint16_t i = 0; i < nb; i++) {
+      if (ev[i].queue_id == POT_EVDEV_Q_PARSE)
+        parse[nb_parse++] = ev[i].mbuf;
+      else
+        crypto[nb_crypto++] = ev[i].mbuf;
+    }
+
+    // Parsing drops the non-PoT packets, the rest go on to the crypto stage
+    if (nb_parse > 0) {
+      nb_parse = parse_pot_burst(parse, nb_parse);
+      for (uint16_t i = 0; i < nb_parse; i++) worker_forward(w, parse[i], POT_EVDEV_Q_CRYPTO);
+    }
+    // What the handlers send comes back through pot_eventdev_tx_stage()
+    if (nb_crypto > 0) forward_burst(cur_role, crypto, nb_crypto, rx_port_id);
+
+    worker_release(w, nb);
+  }
+  return 0;
+}
+
+static int pot_evdev_rx_main(void* arg) {
+  (void)arg;
+  uint16_t rx_port_id = g_evdev.rx_port;
+  // The ingress receives plain packets, there are no PoT headers to find
+  uint8_t first_queue = global_role == ROLE_INGRESS ? POT_EVDEV_Q_CRYPTO : POT_EVDEV_Q_PARSE;
+  LOG_MAIN(INFO, "Eventdev RX started on lcore %u, port %u\n", rte_lcore_id(), rx_port_id);
+
+  while (1) {
+    rte_service_run_iter_on_app_lcore(g_evdev.service_id, 1);
+
+    struct rte_mbuf* pkts[POT_EVDEV_BURST];
+    uint16_t nb_rx = rte_eth_rx_burst(rx_port_id, 0, pkts, POT_EVDEV_BURST);
+    if (nb_rx == 0) continue;
+
+    struct rte_event ev[POT_EVDEV_BURST];
+    for (uint16_t i = 0; i < nb_rx; i++) {
+      pkts[i]->hash.rss = flow_hash(pkts[i]);
+      event_fill(&ev[i], pkts[i], first_queue, RTE_EVENT_OP_NEW);
+    }
+
+    // Past the new event threshold the device is busy with what it has, the rest of the burst is dropped
+    uint16_t nb_in = rte_event_enqueue_new_burst(g_evdev.dev_id, POT_EVDEV_RX_PORT, ev, nb_rx);
+    if (unlikely(nb_in < nb_rx)) {
+      LOG_MAIN(DEBUG, "Eventdev full, dropped %u of %u packets\n", nb_rx - nb_in, nb_rx);
+      rte_pktmbuf_free_bulk(pkts + nb_in, nb_rx - nb_in);
+    }
+  }
+  return 0;
+}
+
+static int pot_evdev_tx_main(void* arg) {
+  (void)arg;
+  uint8_t port_id = POT_EVDEV_TX_PORT(g_eventdev_workers);
+  LOG_MAIN(INFO, "Eventdev TX started on lcore %u\n", rte_lcore_id());
+
+  // Single link, nothing else is scheduled onto this port, the events are released with the next dequeue
+  while (1) {
+    struct rte_event ev[POT_EVDEV_BURST];
+    uint16_t nb = rte_event_dequeue_burst(g_evdev.dev_id, port_id, ev, POT_EVDEV_BURST, 0);
+    for (uint16_t i = 0; i < nb; i++) tx_buffer_packet(ev[i].mbuf, ev[i].mbuf->port);
+    tx_buffers_flush();
+    if (nb == 0) rte_pause();
+  }
+  return 0;
+}
+
+void pot_eventdev_launch(uint16_t* ports) {
+  unsigned nb_workers = (unsigned)g_eventdev_workers;
+  unsigned lcores[POT_EVDEV_MAX_WORKERS + 2];
+  unsigned nb_lcores = 0, lcore_id;
+  RTE_LCORE_FOREACH_WORKER(lcore_id) {
+    if (nb_lcores == nb_workers + 2) break;
+    lcores[nb_lcores++] = lcore_id;
+  }
+  if (nb_lcores < nb_workers + 2) {
+    LOG_MAIN(ERR, "Eventdev mode needs %u worker lcores, found %u\n", nb_workers + 2, nb_lcores);
+    return;
+  }
+  g_evdev.rx_port = ports[0];
+
+  // TX and the workers come up before RX injects anything: lcores[0] is RX, the last one TX
+  unsigned tx_lcore = lcores[nb_workers + 1];
+  if (rte_eal_remote_launch(pot_evdev_tx_main, NULL, tx_lcore) < 0)
+    LOG_MAIN(ERR, "Failed to launch eventdev TX on lcore %u\n", tx_lcore);
+  for (unsigned i = 0; i < nb_workers; i++) {
+    g_evdev_lcores[lcores[i + 1]] = g_evdev.workers[i];
+    if (rte_eal_remote_launch(pot_evdev_worker_main, g_evdev.workers[i], lcores[i + 1]) < 0)
+      LOG_MAIN(ERR, "Failed to launch eventdev worker %u on lcore %u\n", i, lcores[i + 1]);
+  }
+  if (rte_eal_remote_launch(pot_evdev_rx_main, NULL, lcores[0]) < 0)
+    LOG_MAIN(ERR, "Failed to launch eventdev RX on lcore %u\n", lcores[0]);
+
+  LOG_MAIN(INFO, "Waiting for all lcores to complete\n");
+  rte_eal_mp_wait_lcore();
+  LOG_MAIN(INFO, "All lcores completed\n");
+}
@@ -1,38 +1,171 @@
 #include "forward.h"
+#include "cryptodev.h"
+#include "eventdev.h"
+#include "headers.h"
+#include "keystore.h"
+#include "nonce.h"
+#include "pipeline.h"
+#include "utils/config.h"
 #include "utils/logging.h"
 #include "utils/role.h"
 #include "utils/utils.h"
 #include "node/ingress.h"
 #include "node/transit.h"
 #include "node/egress.h"
+#include "port.h"
+#include <rte_malloc.h>
+#include <rte_vect.h>
 #include <sys/resource.h>
+#if defined(RTE_ARCH_X86)
+#include <immintrin.h>
+#endif
+
+// One lcore's TX buffers, allocated on the first packet it sends to a port. Only the owning lcore
+// touches them, so neither the buffers nor the counters need locking.
+struct tx_port_buffer {
+  uint16_t port_id;
+  uint16_t queue_id;
+  uint64_t retried; // bursts the TX ring took only part of
+  uint64_t dropped; // packets still unsent after TX_MAX_RETRIES
+  struct rte_eth_dev_tx_buffer* buffer;
+};
+
+struct tx_lcore_buffers {
+  struct tx_port_buffer* ports[RTE_MAX_ETHPORTS];
+  uint16_t active[RTE_MAX_ETHPORTS]; // ids of the ports with a buffer, in allocation order
+  uint16_t nb_active;
+};
+
+static struct tx_lcore_buffers* g_tx_buffers[RTE_MAX_LCORE];
+
+// Filled by launch_lcore_forwarding() before the lcores start, read-only afterwards
+static struct lcore_queue_conf g_lcore_queues[RTE_MAX_LCORE];
+
+// The TX queue this lcore owns on every port
+static inline uint16_t lcore_tx_queue(unsigned lcore_id) {
+  return lcore_id < RTE_MAX_LCORE ? g_lcore_queues[lcore_id].queue_id : 0;
+}
+
+// Called by rte_eth_tx_buffer_flush() with what the TX ring did not take. The ring drains as the
+// NIC sends, so the rest is offered again a few times before it is freed and counted.
+static void tx_buffer_retry(struct rte_mbuf** unsent, uint16_t count, void* userdata) {
+  struct tx_port_buffer* txb = userdata;
+  uint16_t sent = 0;
+  txb->retried++;
+  for (unsigned retry = 0; retry < TX_MAX_RETRIES && sent < count; retry++) {
+    rte_pause();
+    sent += rte_eth_tx_burst(txb->port_id, txb->queue_id, unsent + sent, count - sent);
+  }
+  if (unlikely(sent < count)) {
+    txb->dropped += count - sent;
+    LOG_MAIN(DEBUG, "TX ring of port %u full, dropped %u packets\n", txb->port_id, count - sent);
+    rte_pktmbuf_free_bulk(unsent + sent, count - sent);
+  }
+}
+
+static struct tx_port_buffer* get_lcore_tx_buffer(uint16_t port_id) {
+  unsigned lcore_id = rte_lcore_id();
+  if (lcore_id >= RTE_MAX_LCORE || port_id >= RTE_MAX_ETHPORTS) return NULL;
+
+  int socket_id = rte_lcore_to_socket_id(lcore_id);
+  struct tx_lcore_buffers* bufs = g_tx_buffers[lcore_id];
+  if (unlikely(bufs == NULL)) {
+    bufs = rte_zmalloc_socket("tx_lcore_buffers", sizeof(*bufs), RTE_CACHE_LINE_SIZE, socket_id);
+    if (bufs == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate TX buffers for lcore %u\n", lcore_id);
+      return NULL;
+    }
+    g_tx_buffers[lcore_id] = bufs;
+  }
+
+  struct tx_port_buffer* txb = bufs->ports[port_id];
+  if (likely(txb != NULL)) return txb;
+
+  txb = rte_zmalloc_socket("tx_port_buffer", sizeof(*txb), RTE_CACHE_LINE_SIZE, socket_id);
+  struct rte_eth_dev_tx_buffer* buffer =
+      rte_zmalloc_socket("tx_buffer", RTE_ETH_TX_BUFFER_SIZE(TX_BUFFER_SIZE), RTE_CACHE_LINE_SIZE, socket_id);
+  if (txb == NULL || buffer == NULL || rte_eth_tx_buffer_init(buffer, TX_BUFFER_SIZE) != 0) {
+    LOG_MAIN(ERR, "Failed to allocate the TX buffer of port %u for lcore %u\n", port_id, lcore_id);
+    rte_free(buffer);
+    rte_free(txb);
+    return NULL;
+  }
+  txb->port_id = port_id;
+  txb->queue_id = lcore_tx_queue(lcore_id);
+  txb->buffer = buffer;
+  rte_eth_tx_buffer_set_err_callback(buffer, tx_buffer_retry, txb);
+  bufs->ports[port_id] = txb;
+  bufs->active[bufs->nb_active++] = port_id;
+  LOG_MAIN(DEBUG, "TX buffer of %u packets for port %u queue %u on lcore %u\n", TX_BUFFER_SIZE, port_id,
+           txb->queue_id, lcore_id);
+  return txb;
+}
+
+void tx_buffers_flush(void) {
+  unsigned lcore_id = rte_lcore_id();
+  struct tx_lcore_buffers* bufs = lcore_id < RTE_MAX_LCORE ? g_tx_buffers[lcore_id] : NULL;
+  if (bufs == NULL) return;
+  for (uint16_t i = 0; i < bufs->nb_active; i++) {
+    struct tx_port_buffer* txb = bufs->ports[bufs->active[i]];
+    rte_eth_tx_buffer_flush(txb->port_id, txb->queue_id, txb->buffer);
+  }
+}
+
+uint64_t tx_buffers_dropped(void) {
+  unsigned lcore_id = rte_lcore_id();
+  struct tx_lcore_buffers* bufs = lcore_id < RTE_MAX_LCORE ? g_tx_buffers[lcore_id] : NULL;
+  uint64_t dropped = 0;
+  if (bufs == NULL) return 0;
+  for (uint16_t i = 0; i < bufs->nb_active; i++) dropped += bufs->ports[bufs->active[i]]->dropped;
+  return dropped;
+}
 
 // Add system health monitoring function
-static void log_system_health(uint64_t packet_count) {
-  static uint64_t last_log = 0;
-  
+static void log_system_health(uint64_t packet_count, uint64_t* last_log) {
   // Only log when significant packet activity occurs (every 1000 packets)
-  if (packet_count - last_log >= 1) {
-    last_log = packet_count;
+  if (packet_count - *last_log >= 1) {
+    *last_log = packet_count;
     
     // Check memory usage
     struct rusage usage;
     if (getrusage(RUSAGE_SELF, &usage) == 0) {
-      LOG_MAIN(INFO, "Health Check: Processed %lu packets, Memory RSS: %ld KB\n", 
-               packet_count, usage.ru_maxrss);
+      LOG_MAIN(INFO, "Health Check: lcore %u processed %lu packets, Memory RSS: %ld KB, TX drops: %" PRIu64
+               "\n", rte_lcore_id(), packet_count, usage.ru_maxrss, tx_buffers_dropped());
+    }
+  }
+}
+
+void forward_burst(enum role role, struct rte_mbuf** pkts, uint16_t nb_pkts, uint16_t rx_port_id) {
+  switch (role) {
+  case ROLE_INGRESS: 
+    process_ingress(pkts, nb_pkts, rx_port_id); 
+    break;
+  case ROLE_TRANSIT: 
+    process_transit(pkts, nb_pkts); 
+    break;
+  case ROLE_EGRESS: 
+    process_egress(pkts, nb_pkts); 
+    break;
+  default: 
+    // Free unprocessed packets to prevent memory leaks
+    for (uint16_t i = 0; i < nb_pkts; i++) {
+      rte_pktmbuf_free(pkts[i]);
     }
+    LOG_MAIN(WARNING, "Unknown role, dropped %u packets\n", nb_pkts);
+    break;
   }
 }
 
 int lcore_main_forward(void* arg) {
   LOG_MAIN(INFO, "Lcore %u started for forwarding\n", rte_lcore_id());
 
-  uint16_t* ports = (uint16_t*)arg;
-  uint16_t rx_port_id = ports[0];
-  uint16_t tx_port_id = ports[1];
+  const struct lcore_queue_conf* qconf = arg;
+  uint16_t rx_port_id = qconf->rx_port;
+  uint16_t tx_port_id = qconf->tx_port;
+  uint16_t queue_id = qconf->queue_id;
   enum role cur_role = global_role;
 
-  LOG_MAIN(INFO, "RX Port ID: %u\n", rx_port_id);
+  LOG_MAIN(INFO, "RX Port ID: %u, queue %u\n", rx_port_id, queue_id);
   if (cur_role == ROLE_TRANSIT) LOG_MAIN(INFO, "TX Port ID: %u\n", tx_port_id);
   LOG_MAIN(INFO, "Current role: %s\n",
            cur_role == ROLE_INGRESS ? "INGRESS" : (cur_role == ROLE_TRANSIT ? "TRANSIT" : "EGRESS"));
@@ -40,25 +173,48 @@ int lcore_main_forward(void* arg) {
 
   // Add periodic health check counter
   uint64_t packet_count = 0;
+  uint64_t last_health_log = 0;
+
+  // Buffered packets go out at the latest this many TSC cycles after the last flush
+  const uint64_t drain_tsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * TX_DRAIN_US;
+  uint64_t last_flush_tsc = rte_rdtsc();
+
+  // Key rotations wait for this lcore to be done with the epochs of its current burst
+  keystore_reader_register();
 
   while (1) {
+    keystore_quiescent();
+
     // Attempt to receive a burst of packets from the specified Ethernet device.
     // Arguments to rte_eth_rx_burst():
     // 1. rx_port_id: The ID of the Ethernet port (device) from which to receive packets.
-    // 2. 0: The ID of the receive queue on that port. Most simple applications use queue 0.
+    // 2. queue_id: The ID of the receive queue on that port, this lcore's own.
     // 3. pkts: A pointer to the array where the received mbuf pointers will be stored.
     // 4. BURST_SIZE: The maximum number of packets to attempt to receive in this burst.
     //
     // The function returns the actual number of packets received (nb_rx),
     // which may be less than or equal to BURST_SIZE.
     struct rte_mbuf* pkts[BURST_SIZE];
-    uint16_t nb_rx = rte_eth_rx_burst(rx_port_id, 0, pkts, BURST_SIZE);
+    uint16_t nb_rx = rte_eth_rx_burst(rx_port_id, queue_id, pkts, BURST_SIZE);
     // LOG_MAIN(DEBUG, "Received %u packets on port %u", nb_rx, rx_port_id);
 
     // If no packets were received in this burst (nb_rx is 0),
     // continue to the next iteration of the loop to try again.
     // This avoids unnecessary processing when no data is available.
     if (nb_rx == 0) {
+      // Crypto ops of earlier bursts keep completing while the port is idle
+      if (g_crypto_backend == CRYPTO_BACKEND_CRYPTODEV) pot_cryptodev_poll();
+
+      // Ingress tops its nonce ring up while idle so refills stay off the packet path
+      if (cur_role == ROLE_INGRESS) nonce_pool_fill();
+
+      // Whatever the crypto completions queued above goes out once the drain timeout is up
+      uint64_t now = rte_rdtsc();
+      if (now - last_flush_tsc > drain_tsc) {
+        tx_buffers_flush();
+        last_flush_tsc = now;
+      }
+
       // Add a small delay when no packets to prevent CPU spinning
       rte_delay_us_block(1); // 1 microsecond delay
       continue;
@@ -68,7 +224,7 @@ int lcore_main_forward(void* arg) {
     packet_count += nb_rx;
     
     // Log health check based on packet count instead of loop iterations
-    log_system_health(packet_count);
+    log_system_health(packet_count, &last_health_log);
     
     // Log burst info periodically for debugging
     if (packet_count % 10000 == 0 && nb_rx > 0) {
@@ -88,147 +244,148 @@ int lcore_main_forward(void* arg) {
       // uint8_t* data = rte_pktmbuf_mtod(pkts[0], uint8_t*);
     }
 
-    switch (cur_role) {
-    case ROLE_INGRESS: 
-      process_ingress(pkts, nb_rx, rx_port_id); 
-      break;
-    case ROLE_TRANSIT: 
-      process_transit(pkts, nb_rx); 
-      break;
-    case ROLE_EGRESS: 
-      process_egress(pkts, nb_rx); 
-      break;
-    default: 
-      // Free unprocessed packets to prevent memory leaks
-      for (uint16_t i = 0; i < nb_rx; i++) {
-        rte_pktmbuf_free(pkts[i]);
-      }
-      LOG_MAIN(WARNING, "Unknown role, dropped %u packets\n", nb_rx);
-      break;
-    }
+    // Transit and egress only act on PoT packets, anything else is dropped here for the whole burst
+    // and the headers of the rest are found once. The ingress receives plain packets and records
+    // the layout when it inserts the headers.
+    if (cur_role == ROLE_TRANSIT || cur_role == ROLE_EGRESS) nb_rx = parse_pot_burst(pkts, nb_rx);
+
+    forward_burst(cur_role, pkts, nb_rx, rx_port_id);
+
+    // With the cryptodev backend the role handlers only submit crypto jobs. Enqueue this burst's ops
+    // and finish the packets whose ops completed since the last iteration.
+    if (g_crypto_backend == CRYPTO_BACKEND_CRYPTODEV) pot_cryptodev_poll();
+
+    // Everything the roles forwarded in this iteration leaves in one TX burst per port
+    tx_buffers_flush();
+    last_flush_tsc = rte_rdtsc();
   }
   return 0;
 }
 
 void launch_lcore_forwarding(uint16_t* ports) {
-  LOG_MAIN(INFO, "Launching forwarding on lcore %u\n", rte_get_next_lcore(-1, 1, 0));
-  unsigned lcore_id = rte_get_next_lcore(-1, 1, 0);
-  LOG_MAIN(INFO, "Selected lcore ID: %u\n", lcore_id);
+  // Pipeline mode splits RX, the role handlers and TX over lcores of their own
+  if (g_pipeline_workers > 0) {
+    pipeline_launch(ports);
+    return;
+  }
+  // Event mode runs the same stages as event queues, the eventdev balances the flows over the workers
+  if (g_eventdev_workers > 0) {
+    pot_eventdev_launch(ports);
+    return;
+  }
 
-  // If only one lcore is enabled, run on the master lcore
+  // If only one lcore is enabled, run on the master lcore, it polls the only queue
   if (rte_lcore_count() == 1) {
-    LOG_MAIN(INFO, "Only one lcore available, running forwarding on master lcore %u\n", rte_lcore_id());
-    lcore_main_forward((void*)ports);
+    unsigned lcore_id = rte_lcore_id();
+    LOG_MAIN(INFO, "Only one lcore available, running forwarding on master lcore %u\n", lcore_id);
+    g_lcore_queues[lcore_id] =
+        (struct lcore_queue_conf){.rx_port = ports[0], .tx_port = ports[1], .queue_id = 0};
+    lcore_main_forward(&g_lcore_queues[lcore_id]);
     return;
-  }  
+  }
 
-  LOG_MAIN(INFO, "Launching forwarding on lcore %u\n", lcore_id);
-  LOG_MAIN(INFO, "Selected lcore ID: %u\n", lcore_id);
+  // One worker per queue pair. RSS keeps a flow on one RX queue, so its packets are handled by one
+  // lcore, in order, with that lcore's crypto contexts, nonce pool and TX queue.
+  uint16_t queue_id = 0;
+  unsigned lcore_id;
+  RTE_LCORE_FOREACH_WORKER(lcore_id) {
+    if (queue_id >= g_nb_queues) {
+      LOG_MAIN(INFO, "No queue left for lcore %u, it stays idle\n", lcore_id);
+      continue;
+    }
+    g_lcore_queues[lcore_id] =
+        (struct lcore_queue_conf){.rx_port = ports[0], .tx_port = ports[1], .queue_id = queue_id};
 
-  // Get the actual lcore ID that will execute the forwarding logic.
-  // This call is the same as in the LOG_MAIN, ensuring consistency.
-  int ret = rte_eal_remote_launch(lcore_main_forward, (void*)ports, lcore_id);
-  if (ret < 0) {
-    LOG_MAIN(ERR, "Failed to launch forwarding on lcore %u (error %d)\n", lcore_id, ret);
-    return;
+    // Remotely launch 'lcore_main_forward' on the worker, with its queue assignment as argument
+    int ret = rte_eal_remote_launch(lcore_main_forward, &g_lcore_queues[lcore_id], lcore_id);
+    if (ret < 0) {
+      LOG_MAIN(ERR, "Failed to launch forwarding on lcore %u (error %d)\n", lcore_id, ret);
+      continue;
+    }
+    LOG_MAIN(INFO, "Launched forwarding of port %u queue %u on lcore %u\n", ports[0], queue_id, lcore_id);
+    queue_id++;
   }
-  LOG_MAIN(INFO, "Waiting for all lcores to complete\n");
+  if (queue_id < g_nb_queues)
+    LOG_MAIN(ERR, "Only %u of %u RX queues are polled, the flows RSS puts on the rest are lost\n", queue_id,
+             g_nb_queues);
 
-  // Remotely launch the 'lcore_main_forward' function on the selected 'lcore_id'.
-  // For distributing tasks across different lcores.
-  // Arguments:
-  // 1. lcore_main_forward: A function pointer to the function that contains
-  //    the actual packet forwarding logic (e.g., the while(1) receive loop,
-  //    processing, and transmit). This function will execute on 'lcore_id'.
-  // 2. (void *)ports: A generic pointer to arguments that will be passed to
-  //    'lcore_main_forward'. In this case, it's casting a pointer to an array
-  //    of port IDs, likely indicating which network ports this lcore should
-  //    monitor or forward between.
-  // 3. lcore_id: The specific logical core on which 'lcore_main_forward'
-  //    will be launched and executed.
+  LOG_MAIN(INFO, "Waiting for all lcores to complete\n");
   rte_eal_mp_wait_lcore();
   LOG_MAIN(INFO, "All lcores completed\n");
 }
 
-void send_packet_to(struct rte_ether_addr mac_addr, struct rte_mbuf* mbuf, uint16_t tx_port_id) {
-  LOG_MAIN(DEBUG, "Sending packet to port %u with MAC %02x:%02x:%02x:%02x:%02x:%02x\n", tx_port_id,
-           mac_addr.addr_bytes[0], mac_addr.addr_bytes[1], mac_addr.addr_bytes[2], mac_addr.addr_bytes[3],
-           mac_addr.addr_bytes[4], mac_addr.addr_bytes[5]);
-  struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
-
-  struct rte_ether_addr src_mac;
-  int ret = rte_eth_macaddr_get(tx_port_id, &src_mac);
-  if (ret != 0) {
-      LOG_MAIN(ERR, "Failed to get MAC address for port %u: %s\n", tx_port_id, strerror(-ret));
-      rte_pktmbuf_free(mbuf);
-      return;
-  }  
-
-  rte_ether_addr_copy(&src_mac, &eth_hdr->src_addr);
-  rte_ether_addr_copy(&mac_addr, &eth_hdr->dst_addr);  
-
-  LOG_MAIN(DEBUG, "Final MACs -> Src: %02x:%02x:%02x:%02x:%02x:%02x, Dst: %02x:%02x:%02x:%02x:%02x:%02x\n",
-        src_mac.addr_bytes[0], src_mac.addr_bytes[1], src_mac.addr_bytes[2],
-        src_mac.addr_bytes[3], src_mac.addr_bytes[4], src_mac.addr_bytes[5],
-        mac_addr.addr_bytes[0], mac_addr.addr_bytes[1], mac_addr.addr_bytes[2],
-        mac_addr.addr_bytes[3], mac_addr.addr_bytes[4], mac_addr.addr_bytes[5]);  
-  
-  // Check if the Ethernet frame's EtherType field indicates that the payload
-  // is an IPv6 packet.
-  // rte_be_to_cpu_16() converts a 16-bit value from big-endian (network byte order)
-  // to the CPU's native byte order, as network protocols use big-endian.
-  // RTE_ETHER_TYPE_IPV6 is a DPDK macro defining the EtherType value for IPv6.
-  if (rte_be_to_cpu_16(eth_hdr->ether_type) == RTE_ETHER_TYPE_IPV6) {
-    LOG_MAIN(DEBUG, "Packet is IPv6, processing headers\n");
-    struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr + 1);
-    char src_str[INET6_ADDRSTRLEN];
-    char dst_str[INET6_ADDRSTRLEN];
-
-    LOG_MAIN(DEBUG, "IPv6 Source: %s, Destination: %s\n",
-             inet_ntop(AF_INET6, &ipv6_hdr->src_addr, src_str, sizeof(src_str)),
-             inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_str, sizeof(dst_str)));
-
-    // inet_ntop(AF_INET6, &ipv6_hdr->src_addr, src_str, sizeof(src_str));
-    // inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_str, sizeof(dst_str));
-  }
-
-  // Check if the destination MAC address of the Ethernet frame is NOT a broadcast address.
-  // rte_is_broadcast_ether_addr() returns 1 if the address is a broadcast address (FF:FF:FF:FF:FF:FF),
-  // and 0 otherwise.
-  // if (rte_is_broadcast_ether_addr(&eth_hdr->dst_addr) != 1) {
-  //   LOG_MAIN(DEBUG, "Packet is not broadcast, MAC addresses\n");
-  //   rte_ether_addr_copy(&eth_hdr->dst_addr, &eth_hdr->src_addr);
-  //   rte_ether_addr_copy(&mac_addr, &eth_hdr->dst_addr);
-
-  //   LOG_MAIN(
-  //       DEBUG, "New MAC Source: %02x:%02x:%02x:%02x:%02x:%02x, Destination: %02x:%02x:%02x:%02x:%02x:%02x\n",
-  //       eth_hdr->src_addr.addr_bytes[0], eth_hdr->src_addr.addr_bytes[1], eth_hdr->src_addr.addr_bytes[2],
-  //       eth_hdr->src_addr.addr_bytes[3], eth_hdr->src_addr.addr_bytes[4], eth_hdr->src_addr.addr_bytes[5],
-  //       eth_hdr->dst_addr.addr_bytes[0], eth_hdr->dst_addr.addr_bytes[1], eth_hdr->dst_addr.addr_bytes[2],
-  //       eth_hdr->dst_addr.addr_bytes[3], eth_hdr->dst_addr.addr_bytes[4], eth_hdr->dst_addr.addr_bytes[5]);
-  // }
-
-  // Check if the packet length is less than the size of an Ethernet header.
-  // If it is, free the mbuf and return early to avoid sending an invalid packet
-  // This is a safety check to ensure that the packet has enough data to be a valid Ethernet frame.
-  // rte_pktmbuf_pkt_len() returns the total length of the packet, including all headers and payload.
-  // sizeof(struct rte_ether_hdr) is the size of the Ethernet header
-  if (rte_pktmbuf_pkt_len(mbuf) < sizeof(struct rte_ether_hdr)) {
+void l2_rewrite_build(struct l2_rewrite* l2, const struct rte_ether_addr* dst, uint16_t tx_port_id) {
+  memset(l2->bytes, 0, sizeof(l2->bytes));
+  rte_ether_addr_copy(dst, (struct rte_ether_addr*)l2->bytes);
+  rte_ether_addr_copy(&g_port_mac[tx_port_id], (struct rte_ether_addr*)(l2->bytes + RTE_ETHER_ADDR_LEN));
+}
+
+// Puts both MACs into the frame. The 16 bytes from the start of the frame are read, the last 4 kept
+// and the rest replaced, which takes one load and one store instead of two address copies.
+static inline void l2_rewrite_apply(struct rte_mbuf* mbuf, const struct l2_rewrite* l2) {
+  uint8_t* frame = rte_pktmbuf_mtod(mbuf, uint8_t*);
+  if (unlikely(rte_pktmbuf_data_len(mbuf) < sizeof(l2->bytes))) {
+    memcpy(frame, l2->bytes, 2 * RTE_ETHER_ADDR_LEN);
+    return;
+  }
+#if defined(RTE_ARCH_X86)
+  const __m128i keep = _mm_set_epi32(-1, 0, 0, 0);
+  __m128i hdr = _mm_and_si128(_mm_loadu_si128((const __m128i*)frame), keep);
+  _mm_storeu_si128((__m128i*)frame, _mm_or_si128(hdr, _mm_load_si128((const __m128i*)l2->bytes)));
+#elif defined(RTE_ARCH_ARM64)
+  static const uint8_t keep[16] = {[12] = 0xff, [13] = 0xff, [14] = 0xff, [15] = 0xff};
+  vst1q_u8(frame, vbslq_u8(vld1q_u8(keep), vld1q_u8(frame), vld1q_u8(l2->bytes)));
+#else
+  memcpy(frame, l2->bytes, 2 * RTE_ETHER_ADDR_LEN);
+#endif
+}
+
+void tx_buffer_packet(struct rte_mbuf* mbuf, uint16_t tx_port_id) {
+  struct tx_port_buffer* txb = get_lcore_tx_buffer(tx_port_id);
+  if (likely(txb != NULL)) {
+    rte_eth_tx_buffer(txb->port_id, txb->queue_id, txb->buffer, mbuf);
+    return;
+  }
+  if (rte_eth_tx_burst(tx_port_id, lcore_tx_queue(rte_lcore_id()), &mbuf, 1) == 0) {
+    LOG_MAIN(ERR, "Failed to send packet on port %u, freeing mbuf\n", tx_port_id);
+    rte_pktmbuf_free(mbuf);
+  }
+}
+
+// Rewrites the frame's MACs and queues it on this lcore's TX buffer of the port, the forwarding loop
+// flushes it with the rest of the burst. Without a buffer it is sent on its own.
+static inline void send_with_l2(struct rte_mbuf* mbuf, const struct l2_rewrite* l2, uint16_t tx_port_id) {
+  if (unlikely(rte_pktmbuf_pkt_len(mbuf) < sizeof(struct rte_ether_hdr))) {
     LOG_MAIN(ERR, "Packet length %u is less than Ethernet header size %zu, dropping packet\n",
              rte_pktmbuf_pkt_len(mbuf), sizeof(struct rte_ether_hdr));
     rte_pktmbuf_free(mbuf);
     return;
   }
+  l2_rewrite_apply(mbuf, l2);
 
-  // Send the packet using DPDK's Ethernet transmit function.
-  // rte_eth_tx_burst() attempts to send a burst of packets on the specified transmit
-  // port and queue. It returns the number of packets successfully sent.
-  uint16_t sent = rte_eth_tx_burst(tx_port_id, 0, &mbuf, 1);
-  if (sent == 0) {
-    LOG_MAIN(ERR, "Failed to send packet on port %u, freeing mbuf\n", tx_port_id);
-    rte_pktmbuf_free(mbuf);
-  } else {
-    LOG_MAIN(DEBUG, "Sent %u packet(s) on port %u\n", sent, tx_port_id);
+  // A pipeline worker hands the packet to the TX lcore, which restores the arrival order
+  if (unlikely(g_pipeline_workers > 0) && pipeline_tx_stage(mbuf, tx_port_id)) return;
+  // An eventdev worker forwards it to the TX stage, the atomic stages before kept its flow in order
+  if (unlikely(g_eventdev_workers > 0) && pot_eventdev_tx_stage(mbuf, tx_port_id)) return;
+  tx_buffer_packet(mbuf, tx_port_id);
+}
+
+void send_packet_to_hop(const struct next_hop_entry* hop, struct rte_mbuf* mbuf, uint16_t tx_port_id) {
+  // The header precomputed for the port the node sends on, anything else is built on the spot
+  if (likely(hop->l2_port == tx_port_id)) {
+    send_with_l2(mbuf, &hop->l2, tx_port_id);
     return;
   }
+  struct l2_rewrite l2;
+  l2_rewrite_build(&l2, &hop->mac, tx_port_id);
+  send_with_l2(mbuf, &l2, tx_port_id);
+}
+
+void send_packet_to(struct rte_ether_addr mac_addr, struct rte_mbuf* mbuf, uint16_t tx_port_id) {
+  LOG_MAIN(DEBUG, "Sending packet to port %u with MAC %02x:%02x:%02x:%02x:%02x:%02x\n", tx_port_id,
+           mac_addr.addr_bytes[0], mac_addr.addr_bytes[1], mac_addr.addr_bytes[2], mac_addr.addr_bytes[3],
+           mac_addr.addr_bytes[4], mac_addr.addr_bytes[5]);
+  struct l2_rewrite l2;
+  l2_rewrite_build(&l2, &mac_addr, tx_port_id);
+  send_with_l2(mbuf, &l2, tx_port_id);
 }
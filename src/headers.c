@@ -1,12 +1,140 @@
 #include "headers.h"
+#include "classify.h"
+#include "crypto.h"
+#include "forward.h"
+#include "ioam.h"
+#include "mac.h"
+#include "port.h"
 #include "utils/config.h"
 #include "utils/logging.h"
+#include <rte_hash_crc.h>
 #include <rte_malloc.h>
+#include <rte_udp.h>
 
 // Global segment list pointer to store IPv6 addresses read from file
 struct in6_addr* g_segments = NULL;
 int g_segment_count = 0;
 int operation_bypass_bit = 0;
+int pot_meta_dynfield_offset = -1;
+int g_csid_block_len = 0;
+uint8_t g_pot_tag_len = HMAC_MAX_LENGTH;
+int g_srv6_encap = 0;
+int g_pot_carrier = POT_CARRIER_SRH;
+
+// SRH + HMAC TLV + PoT TLV image add_custom_header() stamps into every packet, compiled from the
+// segment list whenever it is loaded. For the IOAM carrier it is the Hop-by-Hop header, without SRH.
+static uint8_t* g_hdr_template = NULL;
+static size_t g_hdr_template_len = 0;
+static size_t g_hdr_template_srh_len = 0;
+
+// Packs the segment list into C-SID containers, each the shared block followed by as many uSIDs as
+// fit and zero padded after the last one (End-of-Carrier). Returns the number of containers, -1 if
+// a SID is not of the block:uSID:: form.
+static int csid_pack(const struct in6_addr* sids, int nb_sids, struct in6_addr* containers) {
+  const unsigned block = g_csid_block_len / 8;
+  const unsigned usid = POT_CSID_USID_LEN / 8;
+  const unsigned per_container = (sizeof(struct in6_addr) - block) / usid;
+
+  int nb_containers = 0;
+  for (int i = 0; i < nb_sids; i++) {
+    const uint8_t* sid = sids[i].s6_addr;
+    char str[INET6_ADDRSTRLEN];
+    if (memcmp(sid, sids[0].s6_addr, block) != 0) {
+      LOG_MAIN(ERR, "SID %s is outside the /%d C-SID block of the first one\n",
+               inet_ntop(AF_INET6, sid, str, sizeof(str)), g_csid_block_len);
+      return -1;
+    }
+    for (unsigned b = block + usid; b < sizeof(struct in6_addr); b++) {
+      if (sid[b] != 0) {
+        LOG_MAIN(ERR, "SID %s has bits set after its %d-bit uSID\n", inet_ntop(AF_INET6, sid, str, sizeof(str)),
+                 POT_CSID_USID_LEN);
+        return -1;
+      }
+    }
+    if (sid[block] == 0 && sid[block + 1] == 0) {
+      LOG_MAIN(ERR, "SID %s has a zero uSID, which marks the end of a container\n",
+               inet_ntop(AF_INET6, sid, str, sizeof(str)));
+      return -1;
+    }
+
+    if (i % per_container == 0) {
+      memset(&containers[nb_containers], 0, sizeof(struct in6_addr));
+      memcpy(containers[nb_containers].s6_addr, sid, block);
+      nb_containers++;
+    }
+    memcpy(containers[nb_containers - 1].s6_addr + block + (i % per_container) * usid, sid + block, usid);
+  }
+  return nb_containers;
+}
+
+static int build_ioam_template(void) {
+  size_t len = IOAM_POT_HBH_SIZE(g_pot_tag_len);
+  uint8_t* template = rte_zmalloc("ioam_template", len, RTE_CACHE_LINE_SIZE);
+  if (template == NULL) {
+    LOG_MAIN(ERR, "Failed to allocate the %zu byte IOAM template\n", len);
+    return -1;
+  }
+  ioam_template_init((struct ioam_pot_hbh*)template, g_pot_tag_len);
+
+  rte_free(g_hdr_template);
+  g_hdr_template = template;
+  g_hdr_template_len = len;
+  g_hdr_template_srh_len = 0;
+  LOG_MAIN(DEBUG, "IOAM template: %u byte tags, %zu bytes\n", g_pot_tag_len, len);
+  return 0;
+}
+
+static int build_header_template(void) {
+  if (g_pot_carrier == POT_CARRIER_IOAM) return build_ioam_template();
+
+  // The SRH carries the SIDs as they are, or packed into C-SID containers
+  struct in6_addr containers[MAX_SEGMENTS];
+  const struct in6_addr* segments = g_segments;
+  int nb_segments = g_segment_count;
+  if (g_csid_block_len > 0) {
+    nb_segments = csid_pack(g_segments, g_segment_count, containers);
+    if (nb_segments < 0) return -1;
+    segments = containers;
+    LOG_MAIN(INFO, "Packed %d SIDs into %d C-SID containers (/%d block)\n", g_segment_count, nb_segments,
+             g_csid_block_len);
+  }
+
+  size_t srh_segments_size = nb_segments * sizeof(struct in6_addr);
+  size_t total_srh_size = sizeof(struct ipv6_srh) + srh_segments_size;
+  size_t len = total_srh_size + HMAC_TLV_SIZE(g_pot_tag_len) + POT_TLV_SIZE(g_pot_tag_len);
+
+  uint8_t* template = rte_zmalloc("srh_template", len, RTE_CACHE_LINE_SIZE);
+  if (template == NULL) {
+    LOG_MAIN(ERR, "Failed to allocate the %zu byte SRH template\n", len);
+    return -1;
+  }
+
+  struct ipv6_srh* srh_hdr = (struct ipv6_srh*)template;
+  srh_hdr->next_header = 61;  // Example next header
+  srh_hdr->hdr_ext_len = (total_srh_size - 8) / 8;
+  srh_hdr->routing_type = 4;
+  srh_hdr->segments_left = nb_segments;   // Set to the total number of segments
+  srh_hdr->last_entry = nb_segments - 1;  // Index of the last element
+  srh_hdr->flags = (g_csid_block_len > 0 ? POT_SRH_FLAG_CSID : 0) | (g_srv6_encap ? POT_SRH_FLAG_ENCAP : 0);
+  rte_memcpy(template + sizeof(struct ipv6_srh), segments, srh_segments_size);
+
+  struct hmac_tlv* hmac_hdr = (struct hmac_tlv*)(template + total_srh_size);
+  hmac_hdr->type = 5;
+  hmac_hdr->length = HMAC_TLV_LENGTH(g_pot_tag_len);
+
+  struct pot_tlv* pot_hdr = (struct pot_tlv*)((uint8_t*)hmac_hdr + HMAC_TLV_SIZE(g_pot_tag_len));
+  pot_hdr->type = 1;
+  pot_hdr->length = POT_TLV_LENGTH(g_pot_tag_len);
+  pot_hdr->nonce_length = NONCE_LENGTH;
+
+  rte_free(g_hdr_template);
+  g_hdr_template = template;
+  g_hdr_template_len = len;
+  g_hdr_template_srh_len = total_srh_size;
+  LOG_MAIN(DEBUG, "SRH template: %d segments, hdr_ext_len %u, %u byte tags, %zu bytes\n", nb_segments,
+           srh_hdr->hdr_ext_len, g_pot_tag_len, len);
+  return 0;
+}
 
 // Function to read segment list from a file
 int load_srh_segments(const char* filepath) {
@@ -82,6 +210,16 @@ int load_srh_segments(const char* filepath) {
     return -1;
   }
 
+  if (build_header_template() < 0) {
+    free(g_segments);
+    g_segments = NULL;
+    g_segment_count = 0;
+    return -1;
+  }
+
+  // HMACs cached for the previous segment list are stale now
+  hmac_cache_invalidate();
+
   LOG_MAIN(INFO, "Successfully loaded %d SRH segments from %s\n", g_segment_count, filepath);
   return 0;
 }
@@ -95,275 +233,456 @@ void free_srh_segments(void) {
     g_segments = NULL;
     g_segment_count = 0;
   }
+  rte_free(g_hdr_template);
+  g_hdr_template = NULL;
+  g_hdr_template_len = 0;
 }
 
-void remove_headers(struct rte_mbuf* pkt) {
-  struct rte_ether_hdr* eth_hdr_6 = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr*);
-  struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr_6 + 1);
-  struct ipv6_srh* srh = (struct ipv6_srh*)(ipv6_hdr + 1);
-
-  // Calculate dynamic SRH size from header
-  size_t actual_srh_size = (srh->hdr_ext_len * 8) + 8;  // Convert back from 8-byte units
-  struct hmac_tlv* hmac = (struct hmac_tlv*)((uint8_t*)srh + actual_srh_size);
-  struct pot_tlv* pot = (struct pot_tlv*)(hmac + 1);
-  uint8_t* payload = (uint8_t*)(pot + 1);
-  // struct hmac_tlv* hmac = (struct hmac_tlv*)(srh + 1);
-  // struct pot_tlv* pot = (struct pot_tlv*)(hmac + 1);
-  // uint8_t* payload = (uint8_t*)(pot + 1);
-
-  // Add bounds checking before accessing headers
-  // size_t expected_headers_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + 
-  //                               sizeof(struct ipv6_srh) + sizeof(struct hmac_tlv) + sizeof(struct pot_tlv);
-  size_t expected_headers_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + 
-                                actual_srh_size + sizeof(struct hmac_tlv) + sizeof(struct pot_tlv);
-    
-  
-  if (rte_pktmbuf_pkt_len(pkt) < expected_headers_size) {
-    LOG_MAIN(ERR, "Packet too small for header removal, expected %zu bytes, got %u\n", 
-             expected_headers_size, rte_pktmbuf_pkt_len(pkt));
-    rte_pktmbuf_free(pkt);
-    return;
-  }  
+// Second stage of the RX parse, for packets the burst classifier already found to be unicast IPv6
+// with an SRv6 SRH
+static inline uint8_t parse_pot_packet(struct rte_mbuf* pkt, struct pot_pkt_meta* meta) {
+  const size_t srh_off = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr);
+  const struct ipv6_srh* srh = rte_pktmbuf_mtod_offset(pkt, const struct ipv6_srh*, srh_off);
+
+  // Segments are 16 bytes, i.e. two of the SRH's 8-byte length units each
+  size_t srh_size = (srh->hdr_ext_len * 8) + 8;
+  if (srh->last_entry >= srh->hdr_ext_len / 2) return POT_PKT_BAD_SRH;
+  if (unlikely((srh->flags & POT_SRH_FLAG_CSID) && g_csid_block_len == 0)) return POT_PKT_NO_CSID;
+
+  // The roles write to the SRH and TLVs in place, so they have to be in the first segment. The
+  // tag length comes from the HMAC TLV, the PoT TLV has to agree with it.
+  size_t hmac_off = srh_off + srh_size;
+  if (rte_pktmbuf_data_len(pkt) < hmac_off + HMAC_TLV_SIZE(0)) return POT_PKT_TRUNCATED;
+  const struct hmac_tlv* hmac = rte_pktmbuf_mtod_offset(pkt, const struct hmac_tlv*, hmac_off);
+  int tag_len = hmac->length + 2 - (int)HMAC_TLV_SIZE(0);
+  if (!POT_TAG_LEN_VALID(tag_len)) return POT_PKT_BAD_TAG;
+
+  size_t pot_off = hmac_off + HMAC_TLV_SIZE(tag_len);
+  size_t payload_off = pot_off + POT_TLV_SIZE(tag_len);
+  if (rte_pktmbuf_data_len(pkt) < payload_off) return POT_PKT_TRUNCATED;
+  const struct pot_tlv* pot = rte_pktmbuf_mtod_offset(pkt, const struct pot_tlv*, pot_off);
+  if (pot->length != POT_TLV_LENGTH(tag_len) || pot->nonce_length != NONCE_LENGTH) return POT_PKT_BAD_TAG;
+
+  meta->srh_off = (uint16_t)srh_off;
+  meta->hmac_off = (uint16_t)hmac_off;
+  meta->pot_off = (uint16_t)pot_off;
+  meta->payload_off = (uint16_t)payload_off;
+  meta->nb_segments = (uint8_t)(srh->last_entry + 1);
+  meta->tag_len = (uint8_t)tag_len;
+  meta->carrier = POT_CARRIER_SRH;
+  return POT_PKT_OK;
+}
 
-  char pre_dst_str[INET6_ADDRSTRLEN];
-  inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, pre_dst_str, sizeof(pre_dst_str));
-  LOG_MAIN(DEBUG, "Pre-modification IPv6 destination: %s\n", pre_dst_str);
+uint16_t parse_pot_burst(struct rte_mbuf** pkts, uint16_t nb_pkts) {
+  struct rte_mbuf* drop[BURST_SIZE];
+  uint16_t accept_idx[BURST_SIZE];
+  uint16_t drop_idx[BURST_SIZE];
+
+  // Junk is split off for the whole burst before any packet gets a full parse
+  uint16_t nb_accept = pot_classify_burst(pkts, nb_pkts, accept_idx, drop_idx);
+  uint16_t nb_drop = 0;
+  for (uint16_t i = 0; i < nb_pkts - nb_accept; i++) drop[nb_drop++] = pkts[drop_idx[i]];
+
+  // accept_idx is ascending, so compacting in place never overwrites a packet still to be parsed
+  const int ioam = g_pot_carrier == POT_CARRIER_IOAM;
+  uint16_t nb_ok = 0;
+  for (uint16_t i = 0; i < nb_accept; i++) {
+    struct rte_mbuf* pkt = pkts[accept_idx[i]];
+    struct pot_pkt_meta* meta = pot_meta(pkt);
+    meta->verdict = ioam ? parse_ioam_packet(pkt, meta) : parse_pot_packet(pkt, meta);
+    if (likely(meta->verdict == POT_PKT_OK)) {
+      pkts[nb_ok++] = pkt;
+    } else {
+      LOG_MAIN(DEBUG, "Dropping packet, %s\n", pot_pkt_verdict_str(meta->verdict));
+      drop[nb_drop++] = pkt;
+    }
+  }
 
-  // size_t headers_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct ipv6_srh) +
-  //                       sizeof(struct hmac_tlv) + sizeof(struct pot_tlv);
-  size_t headers_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + actual_srh_size +
-                        sizeof(struct hmac_tlv) + sizeof(struct pot_tlv);  
-  LOG_MAIN(DEBUG, "Headers size: %zu bytes\n", headers_size);
+  if (nb_drop > 0) {
+    LOG_MAIN(DEBUG, "Dropped %u of %u received packets that are not PoT packets\n", nb_drop, nb_pkts);
+    rte_pktmbuf_free_bulk(drop, nb_drop);
+  }
+  return nb_ok;
+}
 
-  size_t payload_size = rte_pktmbuf_pkt_len(pkt) - headers_size;
-  LOG_MAIN(DEBUG, "Payload size: %zu bytes\n", payload_size);
+const char* pot_pkt_verdict_str(uint8_t verdict) {
+  switch (verdict) {
+  case POT_PKT_OK: return "valid";
+  case POT_PKT_BAD_SRH: return "SRH last_entry beyond its segment list";
+  case POT_PKT_TRUNCATED: return "SRH and TLVs truncated";
+  case POT_PKT_NO_CSID: return "compressed SIDs without --csid-block";
+  case POT_PKT_BAD_TAG: return "HMAC/PoT TLV lengths not a valid tag";
+  case POT_PKT_BAD_IOAM: return "Hop-by-Hop header not an IOAM PoT option";
+  default: return "unknown verdict";
+  }
+}
 
-  uint8_t* tmp_payload = malloc(payload_size);
-  if (tmp_payload == NULL) {
-    LOG_MAIN(ERR, "Failed to allocate memory for tmp_payload\n");
-    rte_pktmbuf_free(pkt);
+void locate_pot_tlvs(struct rte_mbuf* pkt, struct ipv6_srh** srh, struct hmac_tlv** hmac, struct pot_tlv** pot) {
+  const struct pot_pkt_meta* meta = pot_meta(pkt);
+  *srh = rte_pktmbuf_mtod_offset(pkt, struct ipv6_srh*, meta->srh_off);
+  *hmac = rte_pktmbuf_mtod_offset(pkt, struct hmac_tlv*, meta->hmac_off);
+  *pot = rte_pktmbuf_mtod_offset(pkt, struct pot_tlv*, meta->pot_off);
+}
+
+int srh_advance(struct ipv6_srh* srh, uint8_t nb_segments, struct in6_addr* dst) {
+  const struct in6_addr* segments = (const struct in6_addr*)((const uint8_t*)srh + sizeof(struct ipv6_srh));
+
+  // A container is consumed by shifting the next uSID in behind the block, zero filling from the
+  // right; the next segment is only needed once a zero uSID comes up
+  if (srh->flags & POT_SRH_FLAG_CSID) {
+    const unsigned block = g_csid_block_len / 8;
+    const unsigned usid = POT_CSID_USID_LEN / 8;
+    uint8_t* addr = dst->s6_addr;
+    memmove(addr + block, addr + block + usid, sizeof(struct in6_addr) - block - usid);
+    memset(addr + sizeof(struct in6_addr) - usid, 0, usid);
+    if (addr[block] != 0 || addr[block + 1] != 0) return 0;
+  }
+
+  if (srh->segments_left == 0) return -1;
+  srh->segments_left--;
+  int next_sid_index = nb_segments - srh->segments_left;
+  if (next_sid_index >= nb_segments) return -1;
+  rte_memcpy(dst, &segments[next_sid_index], sizeof(*dst));
+  return 0;
+}
+
+void srh_active_sid(const struct ipv6_srh* srh, const struct in6_addr* dst, struct in6_addr* sid) {
+  if (!(srh->flags & POT_SRH_FLAG_CSID)) {
+    rte_memcpy(sid, dst, sizeof(*sid));
     return;
   }
-  rte_memcpy(tmp_payload, payload, payload_size);
-  LOG_MAIN(DEBUG, "Copied %zu bytes of payload to tmp_payload\n", payload_size);
+  const unsigned active_end = g_csid_block_len / 8 + POT_CSID_USID_LEN / 8;
+  memcpy(sid->s6_addr, dst->s6_addr, active_end);
+  memset(sid->s6_addr + active_end, 0, sizeof(*sid) - active_end);
+}
 
-  size_t trim_size = rte_be_to_cpu_16(ipv6_hdr->payload_len);
-  rte_pktmbuf_trim(pkt, trim_size);
-  ipv6_hdr->proto = 17;
-  LOG_MAIN(DEBUG, "Trimmed packet by %zu bytes\n", trim_size);
-
-  struct in6_addr iperf_server_ipv6;
-  if(g_is_virtual_machine == 0) {
-    if (inet_pton(AF_INET6, "2001:db8:1::d1", &iperf_server_ipv6) != 1) {
-      free(tmp_payload);
-      LOG_MAIN(ERR, "Error converting IPv6 address, freeing tmp_payload\n");
-      return;
+void srh_final_sid(const struct ipv6_srh* srh, uint8_t nb_segments, struct in6_addr* sid) {
+  const struct in6_addr* segments = (const struct in6_addr*)((const uint8_t*)srh + sizeof(struct ipv6_srh));
+  const struct in6_addr* last = &segments[nb_segments - 1];
+  if (!(srh->flags & POT_SRH_FLAG_CSID)) {
+    rte_memcpy(sid, last, sizeof(*sid));
+    return;
+  }
+
+  // The last uSID of the last container, in front of its End-of-Carrier padding
+  const unsigned block = g_csid_block_len / 8;
+  const unsigned usid = POT_CSID_USID_LEN / 8;
+  unsigned off = sizeof(struct in6_addr) - usid;
+  while (off > block && last->s6_addr[off] == 0 && last->s6_addr[off + 1] == 0) off -= usid;
+  memset(sid, 0, sizeof(*sid));
+  memcpy(sid->s6_addr, last->s6_addr, block);
+  memcpy(sid->s6_addr + block, last->s6_addr + off, usid);
+}
+
+// Address the egress delivers decapsulated packets to, parsed once
+static const struct in6_addr* egress_delivery_addr(void) {
+  static struct in6_addr addr[2];
+  static int parsed[2];
+  int vm = g_is_virtual_machine != 0;
+  if (unlikely(!parsed[vm])) {
+    const char* str = vm ? "2a05:d014:dc7:12ef:2dc:bf79:a352:6efe" : "2001:db8:1::d1";
+    if (inet_pton(AF_INET6, str, &addr[vm]) != 1) {
+      LOG_MAIN(ERR, "Error converting IPv6 address %s\n", str);
+      return NULL;
     }
-  } else {
-    if (inet_pton(AF_INET6, "2a05:d014:dc7:12ef:2dc:bf79:a352:6efe", &iperf_server_ipv6) != 1) {
-      free(tmp_payload);
-      LOG_MAIN(ERR, "Error converting IPv6 address, freeing tmp_payload\n");
-      return;
-    }    
+    parsed[vm] = 1;
   }
+  return &addr[vm];
+}
 
-  rte_memcpy(&ipv6_hdr->dst_addr, &iperf_server_ipv6, sizeof(struct in6_addr));
-  LOG_MAIN(DEBUG, "Updated IPv6 destination to: %s\n",
-           inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, pre_dst_str, sizeof(pre_dst_str)));
+// RFC 1624 incremental update of a ones' complement checksum for len bytes changing from old to new
+static inline uint16_t cksum_adjust(uint16_t cksum, const void* old, const void* new, size_t len) {
+  uint32_t sum = (uint16_t)~cksum + (uint16_t)~rte_raw_cksum(old, len) + rte_raw_cksum(new, len);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (uint16_t)~sum;
+}
 
-  uint8_t* new_payload = (uint8_t*)rte_pktmbuf_append(pkt, payload_size);
-  if (new_payload == NULL) {
-    free(tmp_payload);
-    LOG_MAIN(ERR, "Failed to append payload back to packet, freeing tmp_payload\n");
-    return;
+// Moves the UDP checksum of a packet from one pseudo-header destination to another. The ingress
+// points it at the last SID, the SRH's final destination as RFC 8200 8.1 has it, so transit nodes
+// rewriting the IPv6 destination never have to touch it; the egress moves it on to the address it
+// delivers to. Both ends do so without reading the payload.
+static inline void udp_cksum_move_dst(struct rte_udp_hdr* udp_hdr, const void* old_dst, const void* new_dst) {
+  // A zero checksum is invalid over IPv6, leave it for the receiver to drop
+  if (udp_hdr->dgram_cksum == 0) return;
+  uint16_t cksum = cksum_adjust(udp_hdr->dgram_cksum, old_dst, new_dst, sizeof(struct in6_addr));
+  udp_hdr->dgram_cksum = cksum == 0 ? 0xffff : cksum;
+}
+
+// Header at offset off of a packet that may be chained, NULL if it is not within one segment
+static void *pkt_mtod_chained(struct rte_mbuf *pkt, size_t off, size_t len) {
+  struct rte_mbuf *seg = pkt;
+  while (seg != NULL && off >= seg->data_len) {
+    off -= seg->data_len;
+    seg = seg->next;
+  }
+  if (seg == NULL || seg->data_len - off < len) return NULL;
+  return rte_pktmbuf_mtod_offset(seg, void *, off);
+}
+
+int remove_headers(struct rte_mbuf* pkt) {
+  const struct pot_pkt_meta* meta = pot_meta(pkt);
+  struct rte_ether_hdr* eth_hdr_6 = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr*);
+  struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr_6 + 1);
+  struct ipv6_srh* srh = rte_pktmbuf_mtod_offset(pkt, struct ipv6_srh*, meta->srh_off);
+
+  // The RX parser made sure everything up to the payload is in the first segment, so it can be
+  // moved in place
+  size_t header_size = meta->srh_off;
+  size_t strip_size = meta->payload_off - header_size;
+  if (unlikely(meta->verdict != POT_PKT_OK)) {
+    LOG_MAIN(ERR, "Cannot remove headers of a packet that is %s\n", pot_pkt_verdict_str(meta->verdict));
+    rte_pktmbuf_free(pkt);
+    return -1;
+  }
+  if (meta->carrier == POT_CARRIER_IOAM) return remove_ioam_header(pkt);
+
+  // Encapsulated packets only lose the outer IPv6 header, SRH and TLVs. The inner packet is
+  // delivered as the source sent it, so there is no address or checksum to fix up.
+  if (srh->flags & POT_SRH_FLAG_ENCAP) {
+    uint8_t* old_start = rte_pktmbuf_mtod(pkt, uint8_t*);
+    strip_size = meta->payload_off - sizeof(struct rte_ether_hdr);
+    rte_memcpy(old_start + strip_size, old_start, sizeof(struct rte_ether_hdr));
+    rte_pktmbuf_adj(pkt, strip_size);
+    LOG_MAIN(DEBUG, "Decapsulated, stripped %zu bytes of outer IPv6, SRH and TLVs\n", strip_size);
+    return 0;
   }
-  rte_memcpy(new_payload, tmp_payload, payload_size);
-  LOG_MAIN(DEBUG, "Copied %zu bytes of payload back to packet\n", payload_size);
 
+  const struct in6_addr* delivery_addr = egress_delivery_addr();
+  if (delivery_addr == NULL) {
+    rte_pktmbuf_free(pkt);
+    return -1;
+  }
+
+  char pre_dst_str[INET6_ADDRSTRLEN];
+  LOG_MAIN(DEBUG, "Pre-modification IPv6 destination: %s\n",
+           inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, pre_dst_str, sizeof(pre_dst_str)));
+
+  // Keep the final SID, the UDP checksum is relative to it, before the SRH is overwritten
+  struct in6_addr final_sid;
+  srh_final_sid(srh, meta->nb_segments, &final_sid);
+
+  // Slide Ethernet+IPv6 forward over the SRH and TLVs and drop the bytes in front of them. The
+  // payload is not moved; strip_size is never below header_size, so the copy does not overlap.
+  uint8_t* old_start = rte_pktmbuf_mtod(pkt, uint8_t*);
+  rte_memcpy(old_start + strip_size, old_start, header_size);
+  rte_pktmbuf_adj(pkt, strip_size);
+  LOG_MAIN(DEBUG, "Stripped %zu bytes of SRH and TLVs\n", strip_size);
+
+  eth_hdr_6 = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr*);
+  ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr_6 + 1);
+  ipv6_hdr->proto = 17;
+  rte_memcpy(&ipv6_hdr->dst_addr, delivery_addr, sizeof(struct in6_addr));
+  LOG_MAIN(DEBUG, "Updated IPv6 destination to: %s\n",
+           inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, pre_dst_str, sizeof(pre_dst_str)));
+
+  size_t payload_size = rte_pktmbuf_pkt_len(pkt) - header_size;
   ipv6_hdr->payload_len = rte_cpu_to_be_16(payload_size);
-  if (ipv6_hdr->proto == 17 && payload_size >= sizeof(struct rte_udp_hdr)) {
-    LOG_MAIN(DEBUG, "Updating UDP header checksum\n");
-    struct rte_udp_hdr* udp_hdr = (struct rte_udp_hdr*)new_payload;
-    udp_hdr->dgram_len = rte_cpu_to_be_16(payload_size);
-    udp_hdr->dgram_cksum = 0;
-    udp_hdr->dgram_cksum = rte_ipv6_udptcp_cksum(ipv6_hdr, udp_hdr);
+  struct rte_udp_hdr* udp_hdr = pkt_mtod_chained(pkt, header_size, sizeof(*udp_hdr));
+  if (udp_hdr != NULL) {
+    udp_cksum_move_dst(udp_hdr, &final_sid, delivery_addr);
+
+    // The pseudo-header length is the IPv6 payload length, back to what the source sent; only the
+    // UDP length field itself may still change
+    uint16_t dgram_len = rte_cpu_to_be_16(payload_size);
+    if (udp_hdr->dgram_len != dgram_len && udp_hdr->dgram_cksum != 0) {
+      uint16_t cksum = cksum_adjust(udp_hdr->dgram_cksum, &udp_hdr->dgram_len, &dgram_len, sizeof(dgram_len));
+      udp_hdr->dgram_cksum = cksum == 0 ? 0xffff : cksum;
+    }
+    udp_hdr->dgram_len = dgram_len;
     LOG_MAIN(DEBUG, "Updated UDP checksum: %04x\n", udp_hdr->dgram_cksum);
   }
 
-  char dst_str[INET6_ADDRSTRLEN];
-  inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_str, sizeof(dst_str));
-  free(tmp_payload);
-  LOG_MAIN(DEBUG, "New destination IPv6: %s\n", dst_str);
-  LOG_MAIN(DEBUG, "Headers removed and payload restored successfully\n");
+  LOG_MAIN(DEBUG, "Headers removed, payload left in place (%zu bytes)\n", payload_size);
+  return 0;
 }
 
-void add_custom_header(struct rte_mbuf *pkt) {
+// Puts Ethernet+IPv6 and room for insert_size bytes of SRH and TLVs into a header mbuf of its own
+// and chains the packet behind it, minus the headers that moved. Neither the payload nor the rest
+// of the chain is touched, so this works for jumbo frames of any length. Returns the new head.
+static struct rte_mbuf *prepend_header_mbuf(struct rte_mbuf *pkt, size_t header_size, size_t insert_size) {
+  if (pkt->nb_segs >= RTE_MBUF_MAX_NB_SEGS) return NULL;
+  struct rte_mbuf *hdr = rte_pktmbuf_alloc(pkt->pool);
+  if (hdr == NULL) return NULL;
+  uint8_t *data = (uint8_t *)rte_pktmbuf_append(hdr, header_size + insert_size);
+  if (data == NULL) {
+    rte_pktmbuf_free(hdr);
+    return NULL;
+  }
+  rte_memcpy(data, rte_pktmbuf_mtod(pkt, uint8_t *), header_size);
+  rte_pktmbuf_adj(pkt, header_size);
+
+  // The head carries the packet's metadata from here on, the RX timestamp dynfield included
+  hdr->port = pkt->port;
+  // Not the attachment flags though, the head is a direct mbuf of our pool whatever pkt is
+  hdr->ol_flags = pkt->ol_flags & ~(RTE_MBUF_F_EXTERNAL | RTE_MBUF_F_INDIRECT);
+  hdr->packet_type = pkt->packet_type;
+  hdr->hash = pkt->hash;
+  hdr->vlan_tci = pkt->vlan_tci;
+  rte_mbuf_dynfield_copy(hdr, pkt);
+
+  // A first segment that held nothing but the headers would go out as an empty TX descriptor
+  if (pkt->data_len == 0 && pkt->next != NULL) {
+    struct rte_mbuf *rest = pkt->next;
+    rest->nb_segs = pkt->nb_segs - 1;
+    rest->pkt_len = pkt->pkt_len;
+    pkt->next = NULL;
+    pkt->nb_segs = 1;
+    rte_pktmbuf_free_seg(pkt);
+    pkt = rest;
+  }
+  rte_pktmbuf_chain(hdr, pkt);
+  return hdr;
+}
+
+uint32_t ipv6_flow_tuple_hash(const struct rte_mbuf *pkt) {
+  const size_t l3_off = sizeof(struct rte_ether_hdr);
+  if (unlikely(rte_pktmbuf_data_len(pkt) < l3_off + sizeof(struct rte_ipv6_hdr))) return 0;
+  const struct rte_ipv6_hdr *ipv6 = rte_pktmbuf_mtod_offset(pkt, const struct rte_ipv6_hdr *, l3_off);
+
+  uint32_t hash = rte_hash_crc(&ipv6->src_addr, 2 * sizeof(ipv6->src_addr), ipv6->proto);
+  // Source and destination port are the first four bytes of both
+  size_t l4_off = l3_off + sizeof(struct rte_ipv6_hdr);
+  if ((ipv6->proto == IPPROTO_TCP || ipv6->proto == IPPROTO_UDP) && rte_pktmbuf_data_len(pkt) >= l4_off + 4)
+    hash = rte_hash_crc_4byte(*rte_pktmbuf_mtod_offset(pkt, const uint32_t *, l4_off), hash);
+  return hash;
+}
+
+// RFC 6437: an unlabeled packet gets a label derived from its 5-tuple, so the transit and egress
+// can tell its flows apart from the IPv6 header alone once the 5-tuple is behind the SRH
+static inline void ipv6_flow_label_stamp(struct rte_mbuf *pkt) {
+  struct rte_ipv6_hdr *ipv6 = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr *, sizeof(struct rte_ether_hdr));
+  uint32_t vtc_flow = rte_be_to_cpu_32(ipv6->vtc_flow);
+  if ((vtc_flow & RTE_IPV6_HDR_FL_MASK) != 0) return;
+  uint32_t label = ipv6_flow_tuple_hash(pkt) & RTE_IPV6_HDR_FL_MASK;
+  ipv6->vtc_flow = rte_cpu_to_be_32(vtc_flow | (label != 0 ? label : 1));
+}
+
+int add_custom_header(struct rte_mbuf **pkt_p) {
+  struct rte_mbuf *pkt = *pkt_p;
   LOG_MAIN(DEBUG, "Adding custom headers to packet\n");
-  LOG_MAIN(DEBUG, "g_segments pointer: %p, g_segment_count: %d\n", g_segments, g_segment_count);
 
   // Check if segments are loaded properly
-  if (g_segments == NULL || g_segment_count <= 0) {
-    LOG_MAIN(ERR, "ERROR: g_segments is NULL or empty - cannot add custom headers\n");
+  if (g_hdr_template == NULL) {
+    LOG_MAIN(ERR, "ERROR: No segment list loaded - cannot add custom headers\n");
     rte_pktmbuf_free(pkt);
-    return;
+    return -1;
   }
-  
-  // Calculating the dynamic SRH size based on actual segment count
-  size_t srh_segments_size = g_segment_count * sizeof(struct in6_addr);
-  size_t total_srh_size = sizeof(struct ipv6_srh) + srh_segments_size;
-  size_t needed_tailroom = total_srh_size + sizeof(struct hmac_tlv) + sizeof(struct pot_tlv);
-  
-  // Check if there's enough tailroom
-  // size_t needed_tailroom = sizeof(struct ipv6_srh) + sizeof(struct hmac_tlv) + sizeof(struct pot_tlv);
-  if (rte_pktmbuf_tailroom(pkt) < needed_tailroom) {
-    LOG_MAIN(ERR, "ERROR: Not enough tailroom in mbuf (%zu needed, %u available) - cannot add custom headers\n",
-             needed_tailroom, rte_pktmbuf_tailroom(pkt));
+
+  size_t insert_size = g_hdr_template_len;
+  size_t header_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr);
+
+  if (rte_pktmbuf_data_len(pkt) < header_size) {
+    LOG_MAIN(ERR, "ERROR: Packet too short for Ethernet and IPv6 headers (%u bytes)\n", rte_pktmbuf_data_len(pkt));
     rte_pktmbuf_free(pkt);
-    return;
+    return -1;
   }
 
-  if (g_segment_count > 0) {
-    char addr_str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, g_segments, addr_str, sizeof(addr_str));
-    LOG_MAIN(DEBUG, "First segment address: %s\n", addr_str);
-  }
+  ipv6_flow_label_stamp(pkt);
 
-  struct ipv6_srh *srh_hdr;
-  struct hmac_tlv *hmac_hdr;
-  struct pot_tlv *pot_hdr;
-  struct rte_ether_hdr *eth_hdr_6 = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
-  struct rte_ipv6_hdr *ipv6_hdr = (struct rte_ipv6_hdr *)(eth_hdr_6 + 1);
-  LOG_MAIN(DEBUG, "IPv6 header at %p, next header: %u\n", ipv6_hdr, ipv6_hdr->proto);
+  // For H.Encaps the outer IPv6 header is inserted along with the SRH and TLVs and only Ethernet
+  // moves, the inner IPv6 header stays with its payload. The outer one is built from a copy of it.
+  struct rte_ipv6_hdr inner_ipv6;
+  if (g_srv6_encap) {
+    rte_memcpy(&inner_ipv6, rte_pktmbuf_mtod_offset(pkt, void *, sizeof(struct rte_ether_hdr)), sizeof(inner_ipv6));
+    header_size = sizeof(struct rte_ether_hdr);
+    insert_size += sizeof(struct rte_ipv6_hdr);
+  }
 
-  // Calculate the exact offset to payload based on actual header sizes
-  size_t header_size = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr);
-  uint8_t *payload = (uint8_t *)(ipv6_hdr + 1);
-  LOG_MAIN(DEBUG, "Payload starts at %p\n", payload);
-
-  // Safe calculation of payload size
-  size_t total_pkt_len = rte_pktmbuf_pkt_len(pkt);
-  size_t payload_size = (total_pkt_len > header_size) ? (total_pkt_len - header_size) : 0;
-  LOG_MAIN(DEBUG, "Total packet length: %zu, Header size: %zu, Payload size: %zu bytes\n", 
-           total_pkt_len, header_size, payload_size);
-  
-  // Safely allocate temporary buffer with size check
-  uint8_t *tmp_payload = NULL;
-  if (payload_size > 0) {
-    tmp_payload = malloc(payload_size);
-    if (tmp_payload == NULL) {
-      LOG_MAIN(ERR, "Failed to allocate memory for tmp_payload (size: %zu)\n", payload_size);
+  // The SRH and the TLVs go between the IPv6 header and the payload. The payload stays where the
+  // NIC wrote it: the packet grows into the headroom and only Ethernet+IPv6 are moved to the new
+  // start. The IOAM option with a short tag is smaller than Ethernet+IPv6, so the two may overlap.
+  uint8_t *old_start = rte_pktmbuf_mtod(pkt, uint8_t *);
+  uint8_t *new_start = (uint8_t *)rte_pktmbuf_prepend(pkt, insert_size);
+  if (new_start != NULL) {
+    memmove(new_start, old_start, header_size);
+  } else if (g_tx_multi_seg) {
+    // Segment lists too long for the headroom get a header mbuf when the ports can send chains
+    struct rte_mbuf *head = prepend_header_mbuf(pkt, header_size, insert_size);
+    if (head == NULL) {
+      LOG_MAIN(ERR, "ERROR: No header mbuf for %zu bytes of SRH and TLVs - cannot add custom headers\n", insert_size);
       rte_pktmbuf_free(pkt);
-      return;
+      return -1;
     }
-    
-    // Copy payload safely
-    rte_memcpy(tmp_payload, payload, payload_size);
-    LOG_MAIN(DEBUG, "Copied %zu bytes of payload to tmp_payload\n", payload_size);
-    
-    // Trim packet safely
-    if (rte_pktmbuf_trim(pkt, payload_size) < 0) {
-      LOG_MAIN(ERR, "Failed to trim packet\n");
-      free(tmp_payload);
+    pkt = *pkt_p = head;
+    LOG_MAIN(DEBUG, "Headroom too small for %zu bytes, chained a header mbuf (%u segments)\n", insert_size,
+             pkt->nb_segs);
+  } else {
+    // Otherwise the payload moves back into the tailroom, in place, the only path whose cost still
+    // grows with the payload
+    if (rte_pktmbuf_tailroom(pkt) < insert_size || pkt->nb_segs > 1) {
+      LOG_MAIN(ERR, "ERROR: Not enough room in mbuf (%zu needed, %u headroom, %u tailroom) - cannot add custom headers\n",
+               insert_size, rte_pktmbuf_headroom(pkt), rte_pktmbuf_tailroom(pkt));
       rte_pktmbuf_free(pkt);
-      return;
+      return -1;
     }
-    LOG_MAIN(DEBUG, "Trimmed packet by %zu bytes\n", payload_size);
-  } else {
-    LOG_MAIN(DEBUG, "No payload to save (payload_size is 0)\n");
-  }
-
-  // Append headers with NULL checks
-  LOG_MAIN(DEBUG, "Appending custom headers to packet\n");
-  // srh_hdr = (struct ipv6_srh *)rte_pktmbuf_append(pkt, sizeof(struct ipv6_srh));
-  srh_hdr = (struct ipv6_srh *)rte_pktmbuf_append(pkt, total_srh_size);
-  if (srh_hdr == NULL) {
-    LOG_MAIN(ERR, "Failed to append SRH header\n");
-    if (tmp_payload) free(tmp_payload);
-    rte_pktmbuf_free(pkt);
-    return;
+    size_t payload_size = rte_pktmbuf_data_len(pkt) - header_size;
+    rte_pktmbuf_append(pkt, insert_size);
+    memmove(old_start + header_size + insert_size, old_start + header_size, payload_size);
+    LOG_MAIN(DEBUG, "Headroom %u too small for %zu bytes, moved %zu bytes of payload\n", rte_pktmbuf_headroom(pkt),
+             insert_size, payload_size);
   }
-  LOG_MAIN(DEBUG, "SRH header appended at %p\n", srh_hdr);
 
-  hmac_hdr = (struct hmac_tlv *)rte_pktmbuf_append(pkt, sizeof(struct hmac_tlv));
-  if (hmac_hdr == NULL) {
-    LOG_MAIN(ERR, "Failed to append HMAC header\n");
-    if (tmp_payload) free(tmp_payload); 
-    rte_pktmbuf_free(pkt);
-    return;
+  struct rte_ether_hdr *eth_hdr_6 = rte_pktmbuf_mtod(pkt, struct rte_ether_hdr *);
+  struct rte_ipv6_hdr *ipv6_hdr = (struct rte_ipv6_hdr *)(eth_hdr_6 + 1);
+  struct pot_pkt_meta *meta = pot_meta(pkt);
+  const struct pot_key_epoch* epoch = keystore_current();
+
+  // The IOAM option names the original protocol and the ids itself, the destination stays as it is
+  if (g_pot_carrier == POT_CARRIER_IOAM) {
+    struct ioam_pot_hbh *hbh = (struct ioam_pot_hbh *)(ipv6_hdr + 1);
+    rte_memcpy(hbh, g_hdr_template, insert_size);
+    hbh->next_header = ipv6_hdr->proto;
+    hbh->mac_key_id = rte_cpu_to_be_32(POT_MAC_KEY_ID(g_pot_mac->alg, 0));
+    hbh->key_set_id = rte_cpu_to_be_32(epoch != NULL ? epoch->key_set_id : 0);
+    ipv6_hdr->proto = IPPROTO_HOPOPTS;
+
+    meta->srh_off = (uint16_t)header_size;
+    meta->hmac_off = (uint16_t)header_size;
+    meta->pot_off = (uint16_t)header_size;
+    meta->payload_off = (uint16_t)(header_size + insert_size);
+    meta->nb_segments = 0;
+    meta->tag_len = g_pot_tag_len;
+    meta->verdict = POT_PKT_OK;
+    meta->carrier = POT_CARRIER_IOAM;
+    ipv6_hdr->payload_len = rte_cpu_to_be_16(rte_pktmbuf_pkt_len(pkt) - sizeof(*eth_hdr_6) - sizeof(*ipv6_hdr));
+    LOG_MAIN(DEBUG, "IOAM Hop-by-Hop header of %zu bytes added to packet\n", insert_size);
+    return 0;
   }
-  LOG_MAIN(DEBUG, "HMAC header appended at %p\n", hmac_hdr);
 
-  pot_hdr = (struct pot_tlv *)rte_pktmbuf_append(pkt, sizeof(struct pot_tlv));
-  if (pot_hdr == NULL) {
-    LOG_MAIN(ERR, "Failed to append POT header\n");
-    if (tmp_payload) free(tmp_payload); 
-    rte_pktmbuf_free(pkt);
-    return;
-  }
-  LOG_MAIN(DEBUG, "POT header appended at %p\n", pot_hdr);
-
-  // Re-append payload if it exists
-  if (payload_size > 0 && tmp_payload != NULL) {
-    payload = (uint8_t *)rte_pktmbuf_append(pkt, payload_size);
-    if (payload == NULL) {
-      LOG_MAIN(ERR, "Failed to append payload\n");
-      free(tmp_payload); 
-      rte_pktmbuf_free(pkt);
-      return;
-    }
-    LOG_MAIN(DEBUG, "New payload space appended at %p\n", payload);
-    
-    rte_memcpy(payload, tmp_payload, payload_size);
-    free(tmp_payload); 
-    LOG_MAIN(DEBUG, "Copied %zu bytes of payload back to packet\n", payload_size);
+  struct ipv6_srh *srh_hdr = (struct ipv6_srh *)(ipv6_hdr + 1);
+  struct hmac_tlv *hmac_hdr = (struct hmac_tlv *)((uint8_t *)srh_hdr + g_hdr_template_srh_len);
+  struct pot_tlv *pot_hdr = (struct pot_tlv *)((uint8_t *)hmac_hdr + HMAC_TLV_SIZE(g_pot_tag_len));
+
+  // The outer header keeps the inner source, traffic class and flow label, the ingress points its
+  // destination at the first segment
+  if (g_srv6_encap) {
+    *ipv6_hdr = inner_ipv6;
+    ipv6_hdr->proto = IPPROTO_ROUTING;
+    ipv6_hdr->hop_limits = 64;
+    header_size += sizeof(struct rte_ipv6_hdr);
+    insert_size -= sizeof(struct rte_ipv6_hdr);
   }
 
-  // Initialize the POT TLV header safely
-  pot_hdr->type = 1;
-  pot_hdr->length = 48;
-  pot_hdr->reserved = 0;
-  pot_hdr->nonce_length = 16;
-  pot_hdr->key_set_id = rte_cpu_to_be_32(1234);
-  memset(pot_hdr->nonce, 0, sizeof(pot_hdr->nonce));
-  memset(pot_hdr->encrypted_hmac, 0, sizeof(pot_hdr->encrypted_hmac));
-  LOG_MAIN(DEBUG, "POT TLV header added with type %u and length %u\n", pot_hdr->type, pot_hdr->length);
-
-  // Initialize the HMAC TLV header
-  hmac_hdr->type = 5;
-  hmac_hdr->length = 16;
-  hmac_hdr->d_flag = 0;
-  hmac_hdr->reserved = 0;
-  hmac_hdr->hmac_key_id = rte_cpu_to_be_32(0);
-  memset(hmac_hdr->hmac_value, 0, sizeof(hmac_hdr->hmac_value));
-  LOG_MAIN(DEBUG, "HMAC TLV header added with type %u and length %u\n", hmac_hdr->type, hmac_hdr->length);
-
-  // Initialize the SRH header
-  srh_hdr->next_header = 61;  // Example next header
-  // Only use the available segments - don't overflow
-  srh_hdr->hdr_ext_len = (total_srh_size - 8) / 8;
-  srh_hdr->routing_type = 4;
-  srh_hdr->segments_left = g_segment_count;   // Set to the total number of segments
-  srh_hdr->last_entry = g_segment_count - 1;  // Index of the last element
-  srh_hdr->flags = 0;
-  memset(srh_hdr->reserved, 0, 2);
-  LOG_MAIN(DEBUG, "SRH header added with hdr_ext_len %u, segments_left %u\n", 
-           srh_hdr->hdr_ext_len, srh_hdr->segments_left);
-
-  // Copy the loaded segments safely - limit to max 2 segments (as per struct definition)
-  // int segments_to_copy = (g_segment_count > 2) ? 2 : g_segment_count;
-  // rte_memcpy(srh_hdr->segments, g_segments, segments_to_copy * sizeof(struct in6_addr));
-  // LOG_MAIN(DEBUG, "Copied %d segments into SRH\n", segments_to_copy);
-  uint8_t *segments_ptr = (uint8_t *)srh_hdr + sizeof(struct ipv6_srh);
-  rte_memcpy(segments_ptr, g_segments, srh_segments_size);
-  LOG_MAIN(DEBUG, "Copied %d segments (%zu bytes) into SRH\n", g_segment_count, srh_segments_size);
-
-  // Add verification logging
-  struct in6_addr *copied_segments = (struct in6_addr *)segments_ptr;
-  for (int i = 0; i < g_segment_count; i++) {
-    char seg_str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, &copied_segments[i], seg_str, sizeof(seg_str));
-    LOG_MAIN(DEBUG, "Copied segment [%d]: %s\n", i, seg_str);
-  }
+  // Stamp the whole SRH, HMAC TLV and PoT TLV image in one copy, then patch the two ids that can
+  // change under live traffic. The nonce, PVF and HMAC are filled in by the ingress.
+  rte_memcpy(srh_hdr, g_hdr_template, insert_size);
+  hmac_hdr->hmac_key_id = rte_cpu_to_be_32(POT_MAC_KEY_ID(g_pot_mac->alg, 0));
+  // Name the key store epoch the PVF is about to be signed with, downstream nodes verify with it
+  pot_hdr->key_set_id = rte_cpu_to_be_32(epoch != NULL ? epoch->key_set_id : 0);
+  LOG_MAIN(DEBUG, "SRH at %p, HMAC TLV at %p, POT TLV at %p, %zu bytes from the template\n", srh_hdr, hmac_hdr,
+           pot_hdr, insert_size);
+
+  // The layout is known from the template, record it as the RX parser would for the crypto
+  // completions that look the TLVs up again
+  meta->srh_off = (uint16_t)header_size;
+  meta->hmac_off = (uint16_t)(header_size + g_hdr_template_srh_len);
+  meta->pot_off = (uint16_t)(meta->hmac_off + HMAC_TLV_SIZE(g_pot_tag_len));
+  meta->payload_off = (uint16_t)(header_size + insert_size);
+  meta->nb_segments = (uint8_t)(srh_hdr->last_entry + 1);
+  meta->tag_len = g_pot_tag_len;
+  meta->verdict = POT_PKT_OK;
+  meta->carrier = POT_CARRIER_SRH;
 
   // Update IPv6 next header field to point to SRH
   // uint8_t original_proto = ipv6_hdr->proto;
@@ -371,9 +690,16 @@ void add_custom_header(struct rte_mbuf *pkt) {
   // Update SRH next header to point to the original protocol
   // srh_hdr->next_header = original_proto;
 
+  // The UDP checksum covers the destination in its pseudo-header, carry it over to the final SID.
+  // The outer header of an encapsulated packet is never UDP, the inner one keeps its destination.
+  struct rte_udp_hdr *udp_hdr =
+      ipv6_hdr->proto == 17 ? pkt_mtod_chained(pkt, header_size + insert_size, sizeof(*udp_hdr)) : NULL;
+  if (udp_hdr != NULL) udp_cksum_move_dst(udp_hdr, &ipv6_hdr->dst_addr, &g_segments[g_segment_count - 1]);
+
   // Update IPv6 payload length
   uint16_t new_plen = rte_pktmbuf_pkt_len(pkt) - sizeof(*eth_hdr_6) - sizeof(*ipv6_hdr);
   ipv6_hdr->payload_len = rte_cpu_to_be_16(new_plen);
   LOG_MAIN(DEBUG, "Updated IPv6 payload length to %u\n", new_plen);
   LOG_MAIN(DEBUG, "Custom headers added to packet successfully\n");
+  return 0;
 }
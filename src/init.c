@@ -1,6 +1,8 @@
 #include "init.h"
 #include "headers.h"
 #include "utils/logging.h"
+#include "eventdev.h"
+#include "pipeline.h"
 #include "utils/utils.h"
 #include <fcntl.h>
 #include <getopt.h>
@@ -12,6 +14,8 @@
 #include "node/controller.h"
 #include <unistd.h>
 #include <openssl/md5.h>
+#include <rte_alarm.h>
+#include <signal.h>
 
 int init_eal(int argc, char* argv[]) {
   LOG_MAIN(DEBUG, "Initializing DPDK EAL\n");
@@ -30,14 +34,19 @@ void init_ports(uint16_t port_id, struct rte_mempool* mbuf_pool, PortRole role)
     rte_exit(EXIT_FAILURE, "Cannot init port %" PRIu16 "\n", port_id);
   }
 
+  // Every lcore polls a queue of its own, so each queue gets the callback
   switch (role) {
   case PORT_ROLE_LATENCY_RX:
-    rte_eth_add_rx_callback(port_id, 0, add_timestamps, NULL);
+    for (uint16_t q = 0; q < g_nb_queues; q++) rte_eth_add_rx_callback(port_id, q, add_timestamps, NULL);
     // rte_eth_add_tx_callback(port_id, 0, calc_latency, NULL);
     LOG_MAIN(INFO, "Added RX timestamp callback to port %u\n", port_id);
     break;
   case PORT_ROLE_LATENCY_TX:
-    rte_eth_add_tx_callback(port_id, 0, calc_latency, NULL);
+    for (uint16_t q = 0; q < g_nb_queues; q++) {
+      struct latency_queue* lq = latency_queue_alloc(port_id);
+      if (lq == NULL) rte_exit(EXIT_FAILURE, "Cannot allocate latency state for queue %u\n", q);
+      rte_eth_add_tx_callback(port_id, q, calc_latency, lq);
+    }
     LOG_MAIN(INFO, "Added TX latency calculation callback to port %u\n", port_id);
     break;
   }
@@ -46,9 +55,13 @@ void init_ports(uint16_t port_id, struct rte_mempool* mbuf_pool, PortRole role)
 struct rte_mempool* init_mempool() {
   LOG_MAIN(DEBUG, "Creating mbuf pool\n");
 
-  struct rte_mempool* mbuf_pool =
-      rte_pktmbuf_pool_create("MBUF_POOL", NUM_MBUFS * rte_eth_dev_count_avail(), MBUF_CACHE_SIZE, 0,
-                              RTE_MBUF_DEFAULT_BUF_SIZE + EXTRA_SPACE, rte_socket_id());
+  // Every queue pair holds its descriptors' mbufs, pipeline mode adds its rings and reorder buffer
+  // and eventdev mode the events in flight
+  unsigned nb_mbufs = NUM_MBUFS * rte_eth_dev_count_avail() * g_nb_queues;
+  nb_mbufs += pipeline_mbufs_needed() + pot_eventdev_mbufs_needed();
+  struct rte_mempool* mbuf_pool = rte_pktmbuf_pool_create("MBUF_POOL", nb_mbufs, MBUF_CACHE_SIZE, 0,
+                                                          RTE_MBUF_DEFAULT_BUF_SIZE + EXTRA_SPACE,
+                                                          rte_socket_id());
 
   LOG_MAIN(DEBUG, "Mbuf pool created: %p\n", mbuf_pool);
 
@@ -137,6 +150,43 @@ int init_topology(AppConfig* app_config) {
   return 0;
 }
 
+static volatile sig_atomic_t g_key_reload_requested = 0;
+
+static void key_reload_signal(int signum __rte_unused) { g_key_reload_requested = 1; }
+
+// Runs on the EAL interrupt thread, so the key file is parsed and the new epoch built off the
+// forwarding lcores. Re-arms itself to poll the reload flag set by SIGHUP.
+static void key_reload_alarm(void* arg __rte_unused) {
+  if (g_key_reload_requested) {
+    g_key_reload_requested = 0;
+    const char* keys_path = getenv("POT_KEYS_FILE");
+    LOG_MAIN(INFO, "SIGHUP received, reloading PoT keys from %s\n", keys_path ? keys_path : "(unset)");
+    if (keys_path == NULL || load_pot_keys(keys_path, num_transit_nodes + 1) < 0)
+      LOG_MAIN(ERR, "Key reload failed, keeping the current key set\n");
+  }
+  if (rte_eal_alarm_set(KEY_RELOAD_POLL_US, key_reload_alarm, NULL) != 0)
+    LOG_MAIN(ERR, "Failed to re-arm the key reload alarm, SIGHUP reloads are disabled\n");
+}
+
+int init_key_rotation(void) {
+  // Signal handlers cannot safely parse files or allocate, the handler only raises a flag
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = key_reload_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGHUP, &sa, NULL) != 0) {
+    LOG_MAIN(ERR, "Failed to install the SIGHUP key reload handler\n");
+    return -1;
+  }
+  if (rte_eal_alarm_set(KEY_RELOAD_POLL_US, key_reload_alarm, NULL) != 0) {
+    LOG_MAIN(ERR, "Failed to arm the key reload alarm\n");
+    return -1;
+  }
+  LOG_MAIN(INFO, "Key rotation enabled, send SIGHUP to reload POT_KEYS_FILE\n");
+  return 0;
+}
+
 int init_logging(const char* log_dir, const char* component_name, int log_level) {
   struct stat st = {0};
   if (stat(log_dir, &st) == -1) {
@@ -285,3 +335,16 @@ void register_tsc_dynfield() {
   tsc_dynfield_offset = rte_mbuf_dynfield_register(&tsc_dynfield_desc);
   if (tsc_dynfield_offset < 0) rte_exit(EXIT_FAILURE, "Cannot register mbuf field\n");
 }
+
+void register_pot_meta_dynfield() {
+  static const struct rte_mbuf_dynfield pot_meta_dynfield_desc = {
+      .name = "dpdk_pot_dynfield_meta",
+      .size = sizeof(struct pot_pkt_meta),
+      .align = alignof(struct pot_pkt_meta),
+  };
+
+  // Holds the header offsets parse_pot_burst() finds on RX, the role handlers cannot do without it
+  pot_meta_dynfield_offset = rte_mbuf_dynfield_register(&pot_meta_dynfield_desc);
+  if (pot_meta_dynfield_offset < 0) rte_exit(EXIT_FAILURE, "Cannot register mbuf metadata field\n");
+  LOG_MAIN(DEBUG, "PoT metadata dynamic field at offset %d\n", pot_meta_dynfield_offset);
+}
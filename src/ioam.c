@@ -0,0 +1,79 @@
+#include "ioam.h"
+
+#include <rte_ether.h>
+#include <string.h>
+
+#include "crypto.h"
+#include "utils/logging.h"
+
+void ioam_template_init(struct ioam_pot_hbh* hbh, uint8_t tag_len) {
+  memset(hbh, 0, IOAM_POT_HBH_SIZE(tag_len));
+  hbh->hdr_ext_len = IOAM_POT_HBH_SIZE(tag_len) / 8 - 1;
+  hbh->padn_type = IOAM_HBH_OPT_PADN;
+  hbh->padn_len = sizeof(hbh->padn);
+  hbh->opt_type = IOAM_HBH_OPT_IOAM;
+  hbh->opt_len = IOAM_POT_OPT_LEN(tag_len);
+  hbh->ioam_type = IOAM_OPT_TYPE_POT;
+  hbh->namespace_id = rte_cpu_to_be_16(IOAM_NAMESPACE_DEFAULT);
+  hbh->pot_type = IOAM_POT_TYPE_PVF;
+}
+
+uint8_t parse_ioam_packet(struct rte_mbuf* pkt, struct pot_pkt_meta* meta) {
+  const size_t hbh_off = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr);
+  if (rte_pktmbuf_data_len(pkt) < hbh_off + IOAM_POT_HBH_SIZE(0)) return POT_PKT_TRUNCATED;
+  const struct ioam_pot_hbh* hbh = rte_pktmbuf_mtod_offset(pkt, const struct ioam_pot_hbh*, hbh_off);
+
+  // The classifier saw the IOAM option type, the rest of the fixed layout is checked here. The tag
+  // length follows from the option length, the header length has to agree with it.
+  int tag_len = hbh->opt_len - (int)IOAM_POT_OPT_LEN(0);
+  if (hbh->padn_type != IOAM_HBH_OPT_PADN || hbh->padn_len != sizeof(hbh->padn) ||
+      hbh->ioam_type != IOAM_OPT_TYPE_POT || hbh->pot_type != IOAM_POT_TYPE_PVF)
+    return POT_PKT_BAD_IOAM;
+  if (!POT_TAG_LEN_VALID(tag_len) || (hbh->hdr_ext_len + 1) * 8 != (int)IOAM_POT_HBH_SIZE(tag_len))
+    return POT_PKT_BAD_TAG;
+
+  // The roles write the nonce and PVF in place, so the header has to be in the first segment
+  size_t payload_off = hbh_off + IOAM_POT_HBH_SIZE(tag_len);
+  if (rte_pktmbuf_data_len(pkt) < payload_off) return POT_PKT_TRUNCATED;
+
+  meta->srh_off = (uint16_t)hbh_off;
+  meta->hmac_off = (uint16_t)hbh_off;
+  meta->pot_off = (uint16_t)hbh_off;
+  meta->payload_off = (uint16_t)payload_off;
+  meta->nb_segments = 0;
+  meta->tag_len = (uint8_t)tag_len;
+  meta->carrier = POT_CARRIER_IOAM;
+  return POT_PKT_OK;
+}
+
+int remove_ioam_header(struct rte_mbuf* pkt) {
+  const struct pot_pkt_meta* meta = pot_meta(pkt);
+  const size_t header_size = meta->srh_off;
+  const size_t strip_size = meta->payload_off - header_size;
+  const struct ioam_pot_hbh* hbh = ioam_pot_of(pkt);
+  uint8_t next_header = hbh->next_header;
+
+  // As for the SRH, Ethernet+IPv6 slide forward over the option and the payload stays in place.
+  // The destination never changed, so the transport checksum is still right.
+  uint8_t* old_start = rte_pktmbuf_mtod(pkt, uint8_t*);
+  memmove(old_start + strip_size, old_start, header_size);
+  rte_pktmbuf_adj(pkt, strip_size);
+
+  struct rte_ipv6_hdr* ipv6_hdr = rte_pktmbuf_mtod_offset(pkt, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+  ipv6_hdr->proto = next_header;
+  ipv6_hdr->payload_len = rte_cpu_to_be_16(rte_be_to_cpu_16(ipv6_hdr->payload_len) - strip_size);
+  LOG_MAIN(DEBUG, "Stripped the %zu byte IOAM Hop-by-Hop header\n", strip_size);
+  return 0;
+}
+
+size_t ioam_mac_input_build(const struct rte_ipv6_hdr* ipv6, const struct ioam_pot_hbh* hbh, uint8_t* input,
+                            size_t input_size) {
+  if (input_size < IOAM_MAC_INPUT_LENGTH) return 0;
+  memcpy(input, &ipv6->src_addr, 16);
+  memcpy(input + 16, &ipv6->dst_addr, 16);
+  input[32] = hbh->next_header;
+  input[33] = hbh->pot_type;
+  memcpy(input + 34, &hbh->namespace_id, sizeof(hbh->namespace_id));
+  memcpy(input + 36, &hbh->mac_key_id, sizeof(hbh->mac_key_id));
+  return IOAM_MAC_INPUT_LENGTH;
+}
@@ -0,0 +1,131 @@
+#include "keystore.h"
+
+#include <openssl/crypto.h>
+#include <rte_malloc.h>
+#include <string.h>
+
+#include "utils/logging.h"
+
+struct pot_keystore {
+  uint32_t active; // slot of the current epoch
+  uint8_t published;
+  struct pot_key_epoch epochs[POT_KEY_EPOCHS];
+};
+
+static struct pot_keystore* g_keystore = NULL;
+struct rte_rcu_qsbr* g_keystore_qsbr = NULL;
+static keystore_publish_cb g_publish_cb = NULL;
+
+void keystore_set_publish_cb(keystore_publish_cb cb) { g_publish_cb = cb; }
+
+static uint32_t derive_key_set_id(const uint8_t keys[][POT_KEY_LENGTH], uint8_t nb_keys) {
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(&keys[0][0], (size_t)nb_keys * POT_KEY_LENGTH, digest);
+  return ((uint32_t)digest[0] << 24) | ((uint32_t)digest[1] << 16) | ((uint32_t)digest[2] << 8) | digest[3];
+}
+
+int keystore_publish(const uint8_t keys[][POT_KEY_LENGTH], uint8_t nb_keys) {
+  if (nb_keys == 0 || nb_keys > MAX_POT_NODES + 1) return -1;
+
+  if (g_keystore == NULL) {
+    g_keystore = rte_zmalloc("pot_keystore", sizeof(*g_keystore), RTE_CACHE_LINE_SIZE);
+    if (g_keystore == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate the PoT key store\n");
+      return -1;
+    }
+    for (uint8_t s = 0; s < POT_KEY_EPOCHS; s++) g_keystore->epochs[s].slot = s;
+
+    size_t qsbr_size = rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE);
+    g_keystore_qsbr = rte_zmalloc("pot_keystore_qsbr", qsbr_size, RTE_CACHE_LINE_SIZE);
+    if (g_keystore_qsbr == NULL || rte_rcu_qsbr_init(g_keystore_qsbr, RTE_MAX_LCORE) != 0) {
+      LOG_MAIN(ERR, "Failed to set up the QSBR variable of the PoT key store\n");
+      rte_free(g_keystore_qsbr);
+      rte_free(g_keystore);
+      g_keystore_qsbr = NULL;
+      g_keystore = NULL;
+      return -1;
+    }
+  }
+
+  uint32_t key_set_id = derive_key_set_id(keys, nb_keys);
+  uint32_t active = __atomic_load_n(&g_keystore->active, __ATOMIC_ACQUIRE);
+  if (g_keystore->published && g_keystore->epochs[active].key_set_id == key_set_id) {
+    LOG_MAIN(INFO, "Key set 0x%08x is already current, nothing to rotate\n", key_set_id);
+    return 0;
+  }
+
+  // The first epoch goes into slot 0, every later one replaces the epoch before the current one
+  uint32_t slot = g_keystore->published ? active ^ 1 : 0;
+  struct pot_key_epoch* epoch = &g_keystore->epochs[slot];
+
+  // Readers skip a slot whose version is odd, so a half written epoch is never matched
+  __atomic_add_fetch(&epoch->version, 1, __ATOMIC_RELEASE);
+  // Lcores that found the old epoch before that may still be reading its keys. Each one reports a
+  // quiescent state once it is done with the burst, after that nobody holds the slot any more.
+  if (g_keystore->published) rte_rcu_qsbr_synchronize(g_keystore_qsbr, RTE_QSBR_THRID_INVALID);
+  epoch->key_set_id = key_set_id;
+  epoch->nb_keys = nb_keys;
+  epoch->has_round_keys = aes_ctr_accel_available();
+  for (uint8_t i = 0; i < nb_keys; i++) {
+    struct pot_key* k = &epoch->keys[i];
+    memcpy(k->key, keys[i], POT_KEY_LENGTH);
+    k->slot = slot;
+    k->index = i;
+    if (epoch->has_round_keys) aes256_expand_key(k->key, &k->rk);
+  }
+  for (uint8_t i = nb_keys; i < MAX_POT_NODES + 1; i++) OPENSSL_cleanse(&epoch->keys[i], sizeof(epoch->keys[i]));
+  if (g_publish_cb != NULL) g_publish_cb(epoch);
+  __atomic_add_fetch(&epoch->version, 1, __ATOMIC_RELEASE);
+
+  __atomic_store_n(&g_keystore->active, slot, __ATOMIC_RELEASE);
+  g_keystore->published = 1;
+  LOG_MAIN(INFO, "Key set 0x%08x with %u keys is now current (slot %u)\n", key_set_id, nb_keys, slot);
+  return 0;
+}
+
+const struct pot_key_epoch* keystore_current(void) {
+  if (unlikely(g_keystore == NULL || !g_keystore->published)) return NULL;
+  return &g_keystore->epochs[__atomic_load_n(&g_keystore->active, __ATOMIC_ACQUIRE)];
+}
+
+const struct pot_key_epoch* keystore_find(uint32_t key_set_id) {
+  if (unlikely(g_keystore == NULL || !g_keystore->published)) return NULL;
+
+  // Current epoch first, it is what nearly every packet names
+  uint32_t active = __atomic_load_n(&g_keystore->active, __ATOMIC_ACQUIRE);
+  for (uint32_t i = 0; i < POT_KEY_EPOCHS; i++) {
+    const struct pot_key_epoch* epoch = &g_keystore->epochs[active ^ i];
+    uint32_t version = __atomic_load_n(&epoch->version, __ATOMIC_ACQUIRE);
+    if (version != 0 && (version & 1) == 0 && epoch->key_set_id == key_set_id) return epoch;
+  }
+  return NULL;
+}
+
+const struct pot_key* keystore_key_of(const uint8_t* key) {
+  if (g_keystore == NULL) return NULL;
+  uintptr_t addr = (uintptr_t)key;
+  for (uint32_t s = 0; s < POT_KEY_EPOCHS; s++) {
+    const struct pot_key_epoch* epoch = &g_keystore->epochs[s];
+    uintptr_t base = (uintptr_t)&epoch->keys[0];
+    if (addr < base || addr >= (uintptr_t)&epoch->keys[epoch->nb_keys]) continue;
+    if ((addr - base) % sizeof(struct pot_key) != offsetof(struct pot_key, key)) return NULL;
+    return &epoch->keys[(addr - base) / sizeof(struct pot_key)];
+  }
+  return NULL;
+}
+
+void keystore_reader_register(void) {
+  unsigned lcore_id = rte_lcore_id();
+  if (g_keystore_qsbr == NULL || lcore_id >= RTE_MAX_LCORE) return;
+  rte_rcu_qsbr_thread_register(g_keystore_qsbr, lcore_id);
+  rte_rcu_qsbr_thread_online(g_keystore_qsbr, lcore_id);
+}
+
+void keystore_free(void) {
+  rte_free(g_keystore_qsbr);
+  g_keystore_qsbr = NULL;
+  if (g_keystore == NULL) return;
+  OPENSSL_cleanse(g_keystore, sizeof(*g_keystore));
+  rte_free(g_keystore);
+  g_keystore = NULL;
+}
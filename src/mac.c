@@ -0,0 +1,260 @@
+#include "mac.h"
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <string.h>
+
+#include "utils/logging.h"
+
+#define POT_MAC_TAG_128 16
+
+// Per-lcore MAC contexts, one per key of each key store epoch and keyed lazily like the AES-CTR
+// pool in crypto.c: a slot re-keys when the version of its epoch changes. Only the contexts of the
+// configured algorithm are created. HMAC-SHA256 keeps the midstates of its key in mac and CMAC its
+// key schedule, both are only restarted per packet; GMAC keeps an AES-256-GCM context in cipher;
+// Poly1305 draws its one-time key from the AES-256-CTR context in cipher and re-keys mac with it
+// for every packet.
+struct mac_ctx_pool {
+  uint32_t version[POT_KEY_EPOCHS];
+  uint8_t nb_keys[POT_KEY_EPOCHS];
+  EVP_MAC_CTX* mac[POT_KEY_EPOCHS][MAX_POT_NODES + 1];
+  EVP_CIPHER_CTX* cipher[POT_KEY_EPOCHS][MAX_POT_NODES + 1];
+} __rte_cache_aligned;
+
+static struct mac_ctx_pool* g_mac_pools[RTE_MAX_LCORE];
+static EVP_MAC* g_evp_mac = NULL; // HMAC, CMAC or POLY1305 implementation, fetched once
+
+static int hmac_sha256_compute(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                               uint8_t out[POT_MAC_FIELD_LENGTH]);
+static int aes_cmac_compute(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                            uint8_t out[POT_MAC_FIELD_LENGTH]);
+static int aes_gmac_compute(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                            uint8_t out[POT_MAC_FIELD_LENGTH]);
+static int poly1305_compute(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                            uint8_t out[POT_MAC_FIELD_LENGTH]);
+
+static const struct pot_mac_ops g_mac_table[POT_MAC_COUNT] = {
+    [POT_MAC_HMAC_SHA256] = {"hmac-sha256", POT_MAC_HMAC_SHA256, 32, 0, hmac_sha256_compute},
+    [POT_MAC_AES_CMAC] = {"aes-cmac", POT_MAC_AES_CMAC, POT_MAC_TAG_128, 0, aes_cmac_compute},
+    [POT_MAC_AES_GMAC] = {"aes-gmac", POT_MAC_AES_GMAC, POT_MAC_TAG_128, 1, aes_gmac_compute},
+    [POT_MAC_POLY1305] = {"poly1305", POT_MAC_POLY1305, POT_MAC_TAG_128, 1, poly1305_compute},
+};
+
+const struct pot_mac_ops* g_pot_mac = &g_mac_table[POT_MAC_HMAC_SHA256];
+
+const struct pot_mac_ops* pot_mac_get(int alg) {
+  if (alg < 0 || alg >= POT_MAC_COUNT) return NULL;
+  return &g_mac_table[alg];
+}
+
+int pot_mac_parse(const char* name) {
+  for (int alg = 0; alg < POT_MAC_COUNT; alg++)
+    if (strcmp(name, g_mac_table[alg].name) == 0) return alg;
+  return -1;
+}
+
+void pot_mac_configure(int alg) {
+  const struct pot_mac_ops* mac = pot_mac_get(alg);
+  if (mac == NULL) {
+    LOG_MAIN(ERR, "Unknown MAC algorithm %d, keeping %s\n", alg, g_pot_mac->name);
+    return;
+  }
+  EVP_MAC* evp_mac = NULL;
+  if (alg != POT_MAC_AES_GMAC) {
+    const char* evp_name = alg == POT_MAC_HMAC_SHA256 ? OSSL_MAC_NAME_HMAC
+                           : alg == POT_MAC_AES_CMAC  ? OSSL_MAC_NAME_CMAC
+                                                      : OSSL_MAC_NAME_POLY1305;
+    evp_mac = EVP_MAC_fetch(NULL, evp_name, NULL);
+    if (evp_mac == NULL) {
+      LOG_MAIN(ERR, "OpenSSL provides no %s, keeping %s\n", mac->name, g_pot_mac->name);
+      return;
+    }
+  }
+
+  // Contexts keyed for the previous algorithm are useless to the new one
+  pot_mac_free();
+  g_evp_mac = evp_mac;
+  g_pot_mac = mac;
+  LOG_MAIN(INFO, "PoT MAC algorithm: %s (%u-byte tag)\n", mac->name, mac->tag_len);
+}
+
+// The AES based MACs never use a PoT key directly: that key already runs AES-256-CTR over the PVF,
+// so each algorithm gets its own subkey, HMAC-SHA256(key, "PoT MAC <name>").
+static void mac_derive_key(const struct pot_key* key, uint8_t subkey[POT_KEY_LENGTH]) {
+  char label[32];
+  unsigned int len;
+  snprintf(label, sizeof(label), "PoT MAC %s", g_pot_mac->name);
+  HMAC(EVP_sha256(), key->key, POT_KEY_LENGTH, (const uint8_t*)label, strlen(label), subkey, &len);
+}
+
+static int mac_ctx_key(struct mac_ctx_pool* pool, uint8_t slot, const struct pot_key* key) {
+  uint8_t i = key->index;
+  uint8_t subkey[POT_KEY_LENGTH];
+  int ok = 1;
+  // HMAC-SHA256 is keyed with the PoT key itself, as it always was
+  if (g_pot_mac->alg != POT_MAC_HMAC_SHA256) mac_derive_key(key, subkey);
+
+  switch (g_pot_mac->alg) {
+  case POT_MAC_HMAC_SHA256: {
+    OSSL_PARAM params[] = {OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+                           OSSL_PARAM_construct_end()};
+    if (pool->mac[slot][i] == NULL) pool->mac[slot][i] = EVP_MAC_CTX_new(g_evp_mac);
+    ok = pool->mac[slot][i] != NULL && EVP_MAC_init(pool->mac[slot][i], key->key, POT_KEY_LENGTH, params) == 1;
+    break;
+  }
+  case POT_MAC_AES_CMAC: {
+    OSSL_PARAM params[] = {OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_CIPHER, "AES-256-CBC", 0),
+                           OSSL_PARAM_construct_end()};
+    if (pool->mac[slot][i] == NULL) pool->mac[slot][i] = EVP_MAC_CTX_new(g_evp_mac);
+    ok = pool->mac[slot][i] != NULL && EVP_MAC_init(pool->mac[slot][i], subkey, sizeof(subkey), params) == 1;
+    break;
+  }
+  case POT_MAC_AES_GMAC:
+    // The whole 16-byte PoT nonce is the GCM IV, so counter-mode nonces never repeat an IV either
+    if (pool->cipher[slot][i] == NULL) pool->cipher[slot][i] = EVP_CIPHER_CTX_new();
+    ok = pool->cipher[slot][i] != NULL &&
+         EVP_EncryptInit_ex(pool->cipher[slot][i], EVP_aes_256_gcm(), NULL, NULL, NULL) == 1 &&
+         EVP_CIPHER_CTX_ctrl(pool->cipher[slot][i], EVP_CTRL_GCM_SET_IVLEN, 16, NULL) == 1 &&
+         EVP_EncryptInit_ex(pool->cipher[slot][i], NULL, NULL, subkey, NULL) == 1;
+    break;
+  case POT_MAC_POLY1305:
+    if (pool->cipher[slot][i] == NULL) pool->cipher[slot][i] = EVP_CIPHER_CTX_new();
+    if (pool->mac[slot][i] == NULL) pool->mac[slot][i] = EVP_MAC_CTX_new(g_evp_mac);
+    ok = pool->cipher[slot][i] != NULL && pool->mac[slot][i] != NULL &&
+         EVP_EncryptInit_ex(pool->cipher[slot][i], EVP_aes_256_ctr(), NULL, subkey, NULL) == 1;
+    break;
+  default: break;
+  }
+
+  OPENSSL_cleanse(subkey, sizeof(subkey));
+  return ok ? 0 : -1;
+}
+
+static struct mac_ctx_pool* get_lcore_mac_pool(const struct pot_key* key) {
+  unsigned lcore_id = rte_lcore_id();
+  if (lcore_id >= RTE_MAX_LCORE) return NULL;
+
+  struct mac_ctx_pool* pool = g_mac_pools[lcore_id];
+  if (unlikely(pool == NULL)) {
+    pool = rte_zmalloc_socket("mac_ctx_pool", sizeof(*pool), RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+    if (pool == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate MAC context pool for lcore %u\n", lcore_id);
+      return NULL;
+    }
+    g_mac_pools[lcore_id] = pool;
+  }
+
+  const struct pot_key_epoch* epoch = keystore_epoch_of(key);
+  uint8_t slot = epoch->slot;
+  uint32_t version = __atomic_load_n(&epoch->version, __ATOMIC_ACQUIRE);
+  if (likely(pool->version[slot] == version)) return pool;
+
+  for (uint8_t i = 0; i < epoch->nb_keys; i++) {
+    if (mac_ctx_key(pool, slot, &epoch->keys[i]) < 0) {
+      LOG_MAIN(ERR, "%s context key setup failed for key %u on lcore %u\n", g_pot_mac->name, i, lcore_id);
+      pool->version[slot] = 0;
+      pool->nb_keys[slot] = 0;
+      return NULL;
+    }
+  }
+  pool->nb_keys[slot] = epoch->nb_keys;
+  pool->version[slot] = version;
+  return pool;
+}
+
+// HMAC-SHA256 keeps the ipad/opad midstates of its key in mac, like CMAC its key schedule, so a
+// packet only compresses the message blocks and the outer digest block
+static int hmac_sha256_compute(const struct pot_key* key, const uint8_t* nonce __rte_unused, const uint8_t* msg,
+                               size_t len, uint8_t out[POT_MAC_FIELD_LENGTH]) {
+  // The pool is keyed for the configured algorithm, anything else takes the one-shot path
+  if (unlikely(g_pot_mac->alg != POT_MAC_HMAC_SHA256)) {
+    unsigned int out_len;
+    return HMAC(EVP_sha256(), key->key, POT_KEY_LENGTH, msg, len, out, &out_len) != NULL ? 0 : -1;
+  }
+  struct mac_ctx_pool* pool = get_lcore_mac_pool(key);
+  if (unlikely(pool == NULL || key->index >= pool->nb_keys[key->slot])) return -1;
+
+  // Initializing with a NULL key restarts HMAC from the midstates already in the context
+  EVP_MAC_CTX* ctx = pool->mac[key->slot][key->index];
+  size_t tag_len;
+  if (EVP_MAC_init(ctx, NULL, 0, NULL) != 1 || EVP_MAC_update(ctx, msg, len) != 1 ||
+      EVP_MAC_final(ctx, out, &tag_len, POT_MAC_FIELD_LENGTH) != 1 || tag_len != SHA256_DIGEST_LENGTH)
+    return -1;
+  return 0;
+}
+
+static int aes_cmac_compute(const struct pot_key* key, const uint8_t* nonce __rte_unused, const uint8_t* msg,
+                            size_t len, uint8_t out[POT_MAC_FIELD_LENGTH]) {
+  struct mac_ctx_pool* pool = get_lcore_mac_pool(key);
+  if (unlikely(pool == NULL || key->index >= pool->nb_keys[key->slot])) return -1;
+
+  // Initializing with a NULL key restarts CMAC with the key schedule already in the context
+  EVP_MAC_CTX* ctx = pool->mac[key->slot][key->index];
+  size_t tag_len;
+  if (EVP_MAC_init(ctx, NULL, 0, NULL) != 1 || EVP_MAC_update(ctx, msg, len) != 1 ||
+      EVP_MAC_final(ctx, out, &tag_len, POT_MAC_FIELD_LENGTH) != 1 || tag_len != POT_MAC_TAG_128)
+    return -1;
+  memset(out + POT_MAC_TAG_128, 0, POT_MAC_FIELD_LENGTH - POT_MAC_TAG_128);
+  return 0;
+}
+
+static int aes_gmac_compute(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                            uint8_t out[POT_MAC_FIELD_LENGTH]) {
+  struct mac_ctx_pool* pool = get_lcore_mac_pool(key);
+  if (unlikely(pool == NULL || nonce == NULL || key->index >= pool->nb_keys[key->slot])) return -1;
+
+  // GMAC is GCM with the whole message as additional data and nothing to encrypt
+  EVP_CIPHER_CTX* ctx = pool->cipher[key->slot][key->index];
+  uint8_t unused[POT_MAC_TAG_128];
+  int out_len;
+  if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, nonce) != 1 || EVP_EncryptUpdate(ctx, NULL, &out_len, msg, len) != 1 ||
+      EVP_EncryptFinal_ex(ctx, unused, &out_len) != 1 ||
+      EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, POT_MAC_TAG_128, out) != 1)
+    return -1;
+  memset(out + POT_MAC_TAG_128, 0, POT_MAC_FIELD_LENGTH - POT_MAC_TAG_128);
+  return 0;
+}
+
+static int poly1305_compute(const struct pot_key* key, const uint8_t* nonce, const uint8_t* msg, size_t len,
+                            uint8_t out[POT_MAC_FIELD_LENGTH]) {
+  struct mac_ctx_pool* pool = get_lcore_mac_pool(key);
+  if (unlikely(pool == NULL || nonce == NULL || key->index >= pool->nb_keys[key->slot])) return -1;
+
+  // Poly1305 keys are single use. Each packet's key is the AES-256-CTR keystream of the subkey at the
+  // PoT nonce, as in Poly1305-AES, so no two packets share one.
+  static const uint8_t zero[32] = {0};
+  uint8_t one_time_key[32];
+  EVP_CIPHER_CTX* ctr = pool->cipher[key->slot][key->index];
+  EVP_MAC_CTX* ctx = pool->mac[key->slot][key->index];
+  int out_len;
+  size_t tag_len;
+  int ok = EVP_EncryptInit_ex(ctr, NULL, NULL, NULL, nonce) == 1 &&
+           EVP_EncryptUpdate(ctr, one_time_key, &out_len, zero, sizeof(zero)) == 1 &&
+           EVP_MAC_init(ctx, one_time_key, sizeof(one_time_key), NULL) == 1 && EVP_MAC_update(ctx, msg, len) == 1 &&
+           EVP_MAC_final(ctx, out, &tag_len, POT_MAC_FIELD_LENGTH) == 1 && tag_len == POT_MAC_TAG_128;
+  OPENSSL_cleanse(one_time_key, sizeof(one_time_key));
+  if (!ok) return -1;
+  memset(out + POT_MAC_TAG_128, 0, POT_MAC_FIELD_LENGTH - POT_MAC_TAG_128);
+  return 0;
+}
+
+void pot_mac_free(void) {
+  for (unsigned lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+    struct mac_ctx_pool* pool = g_mac_pools[lcore_id];
+    if (pool == NULL) continue;
+    for (int s = 0; s < POT_KEY_EPOCHS; s++) {
+      for (int i = 0; i < MAX_POT_NODES + 1; i++) {
+        EVP_MAC_CTX_free(pool->mac[s][i]);
+        EVP_CIPHER_CTX_free(pool->cipher[s][i]);
+      }
+    }
+    rte_free(pool);
+    g_mac_pools[lcore_id] = NULL;
+  }
+  EVP_MAC_free(g_evp_mac);
+  g_evp_mac = NULL;
+}
@@ -2,6 +2,8 @@
 #include <stdio.h>
 
 #include "node/controller.h"
+#include "forward.h"
+#include "port.h"
 #include "utils/logging.h"
 #include "headers.h"
 
@@ -32,12 +34,32 @@ void add_next_hop(const char* ipv6_str, const char* mac_str) {
          &next_hops[next_hop_count].mac.addr_bytes[3], &next_hops[next_hop_count].mac.addr_bytes[4],
          &next_hops[next_hop_count].mac.addr_bytes[5]);
 
+  // The L2 header needs the TX port's MAC, which is only known once the ports are up
+  next_hops[next_hop_count].l2_port = UINT16_MAX;
+
   // Increment the count of registered next hops.
   LOG_MAIN(INFO, "Added next hop: IPv6 %s, MAC %s. Total next hops: %d.\n", ipv6_str, mac_str,
            next_hop_count + 1);
   next_hop_count++;
 }
 
+void next_hops_build_l2(uint16_t tx_port) {
+  for (int i = 0; i < next_hop_count; i++) {
+    l2_rewrite_build(&next_hops[i].l2, &next_hops[i].mac, tx_port);
+    next_hops[i].l2_port = tx_port;
+  }
+  LOG_MAIN(DEBUG, "Built the L2 headers of %d next hops for port %u\n", next_hop_count, tx_port);
+}
+
+const struct next_hop_entry* lookup_next_hop(const struct in6_addr* ipv6) {
+  for (int i = 0; i < next_hop_count; i++) {
+    if (memcmp(&next_hops[i].ipv6, ipv6, sizeof(struct in6_addr)) == 0) return &next_hops[i];
+  }
+  LOG_MAIN(WARNING, "No next hop for IPv6 address %s.\n",
+           inet_ntop(AF_INET6, ipv6, (char[INET6_ADDRSTRLEN]){0}, INET6_ADDRSTRLEN));
+  return NULL;
+}
+
 struct rte_ether_addr* lookup_mac_for_ipv6(struct in6_addr* ipv6) {
   LOG_MAIN(DEBUG, "Looking up MAC for IPv6 address %s...\n",
            inet_ntop(AF_INET6, ipv6, (char[INET6_ADDRSTRLEN]){0}, INET6_ADDRSTRLEN));
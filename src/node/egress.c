@@ -1,39 +1,120 @@
 #include "node/egress.h"
 
 #include "crypto.h"
+#include "cryptodev.h"
+#include "mac.h"
 #include "forward.h"
 #include "headers.h"
+#include "ioam.h"
 #include "utils/config.h"
 #include "utils/logging.h"
 
-static inline void process_egress_packet(struct rte_mbuf* mbuf) {
-  // LOG_MAIN(NOTICE, "Processing egress packet with length %u", rte_pktmbuf_pkt_len(mbuf));
-  // LOG_MAIN(NOTICE, "Egress packet nb_segs: %u", mbuf->nb_segs);
-  
-  // Add bounds checking before accessing headers
-  if (rte_pktmbuf_pkt_len(mbuf) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr)) {
-    LOG_MAIN(WARNING, "Egress: Packet too small for basic headers, dropping\n");
+// The MAC address of the iperf server is hardcoded here, it gets a next hop entry of its own so its
+// L2 header is built once, by egress_build_l2() before the lcores start
+static struct next_hop_entry iperf_hop = {.mac = {{0x02, 0xcc, 0xef, 0x38, 0x4b, 0x25}}, .l2_port = UINT16_MAX};
+
+void egress_build_l2(uint16_t tx_port) {
+  l2_rewrite_build(&iperf_hop.l2, &iperf_hop.mac, tx_port);
+  iperf_hop.l2_port = tx_port;
+}
+
+// Strips the SRH, HMAC TLV and PoT TLV off a verified packet and hands it to the iperf server
+static void egress_forward_packet(struct rte_mbuf* mbuf) {
+  if (remove_headers(mbuf) < 0) return;
+
+  LOG_MAIN(DEBUG, "Packet after removing headers - length: %u\n", rte_pktmbuf_pkt_len(mbuf));
+  struct rte_ether_hdr* eth_hdr_final = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
+  struct rte_ipv6_hdr* ipv6_hdr_final = (struct rte_ipv6_hdr*)(eth_hdr_final + 1);
+  LOG_MAIN(DEBUG, "Final packet IPv6 src: %s, dst: %s\n",
+           inet_ntop(AF_INET6, &ipv6_hdr_final->src_addr, NULL, 0),
+           inet_ntop(AF_INET6, &ipv6_hdr_final->dst_addr, NULL, 0));
+
+  char final_src_ip[INET6_ADDRSTRLEN], final_dst_ip[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, &ipv6_hdr_final->src_addr, final_src_ip, INET6_ADDRSTRLEN);
+  inet_ntop(AF_INET6, &ipv6_hdr_final->dst_addr, final_dst_ip, INET6_ADDRSTRLEN);
+  LOG_MAIN(DEBUG, "Final packet IPv6 src: %s, dst: %s\n", final_src_ip, final_dst_ip);
+
+  // Forward the packet to the iperf server
+  uint16_t tx_port = g_is_virtual_machine == 0 ? 1 : 0;
+  send_packet_to_hop(&iperf_hop, mbuf, tx_port);
+  LOG_MAIN(DEBUG, "Packet sent to iperf server with MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
+           iperf_hop.mac.addr_bytes[0], iperf_hop.mac.addr_bytes[1], iperf_hop.mac.addr_bytes[2],
+           iperf_hop.mac.addr_bytes[3], iperf_hop.mac.addr_bytes[4], iperf_hop.mac.addr_bytes[5]);
+}
+
+// Cryptodev backend: this node's layer was peeled in place and the expected HMAC is back, compare
+// them and forward the packet on a match
+static void egress_crypto_done(struct rte_mbuf* mbuf, const uint8_t* digest, int ok) {
+  if (!ok) {
+    LOG_MAIN(ERR, "Egress: PoT crypto failed on cryptodev, dropping packet\n");
     rte_pktmbuf_free(mbuf);
     return;
   }
 
-  struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
-  uint16_t ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
+  struct ipv6_srh* srh;
+  struct hmac_tlv* hmac;
+  struct pot_tlv* pot;
+  locate_pot_tlvs(mbuf, &srh, &hmac, &pot);
+  uint8_t tag_len = pot_meta(mbuf)->tag_len;
+  if (memcmp(pot->encrypted_hmac, digest, tag_len) != 0) {
+    log_hex_data("Final HMAC", pot->encrypted_hmac, tag_len);
+    log_hex_data("Expected HMAC", digest, tag_len);
+    LOG_MAIN(ERR, "Egress: HMAC verification failed, dropping packet\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  egress_forward_packet(mbuf);
+}
+
+// IOAM carrier: peel the last layer off the PVF and check it against the MAC of the option, then
+// strip the Hop-by-Hop header
+static void egress_ioam_packet(struct rte_mbuf* mbuf) {
+  struct rte_ipv6_hdr* ipv6_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv6_hdr*, sizeof(struct rte_ether_hdr));
+  struct ioam_pot_hbh* hbh = ioam_pot_of(mbuf);
+  uint8_t tag_len = pot_meta(mbuf)->tag_len;
 
-  // Check if the packet is IPv6, if not drop it
-  if (ether_type != RTE_ETHER_TYPE_IPV6) {
-    LOG_MAIN(NOTICE, "Non-IPv6 packet received in egress (EtherType: %u), dropping.\n", ether_type);
+  // Same policy as for the TLVs: the configured algorithm and tag length only
+  uint8_t mac_alg = POT_MAC_KEY_ID_ALG(rte_be_to_cpu_32(hbh->mac_key_id));
+  if (mac_alg != g_pot_mac->alg || tag_len != g_pot_tag_len) {
+    LOG_MAIN(WARNING, "Egress: IOAM option with MAC algorithm %u and a %u byte tag, dropping packet\n", mac_alg,
+             tag_len);
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  const struct pot_key_epoch* epoch = keystore_find(rte_be_to_cpu_32(hbh->key_set_id));
+  if (epoch == NULL) {
+    LOG_MAIN(WARNING, "Egress: Unknown key set 0x%08x, dropping packet\n", rte_be_to_cpu_32(hbh->key_set_id));
     rte_pktmbuf_free(mbuf);
     return;
   }
 
-  // Check if the destination MAC address is a multicast/broadcast address
-  // If the least significant bit of the first byte is set, it's multicast/broadcast
-  if ((eth_hdr->dst_addr.addr_bytes[0] & 0x01) != 0) {
-    LOG_MAIN(NOTICE, "Multicast/Broadcast packet received in egress, dropping.\n");
+  uint8_t final_hmac[HMAC_MAX_LENGTH];
+  uint8_t expected_hmac[HMAC_MAX_LENGTH];
+  uint8_t input[IOAM_MAC_INPUT_LENGTH];
+  size_t input_len = ioam_mac_input_build(ipv6_hdr, hbh, input, sizeof(input));
+  if (decrypt(hbh->pvf, tag_len, (uint8_t*)epoch->keys[0].key, hbh->nonce, final_hmac) < 0 ||
+      calculate_pot_mac_input(g_pot_mac, &epoch->keys[0], hbh->nonce, input, input_len, expected_hmac) < 0) {
+    LOG_MAIN(ERR, "Egress: IOAM PoT verification failed to run, dropping packet\n");
     rte_pktmbuf_free(mbuf);
     return;
   }
+  if (memcmp(final_hmac, expected_hmac, tag_len) != 0) {
+    log_hex_data("Final HMAC", final_hmac, tag_len);
+    log_hex_data("Expected HMAC", expected_hmac, tag_len);
+    LOG_MAIN(ERR, "Egress: HMAC verification failed, dropping packet\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  egress_forward_packet(mbuf);
+}
+
+static inline void process_egress_packet(struct rte_mbuf* mbuf) {
+  // LOG_MAIN(NOTICE, "Processing egress packet with length %u", rte_pktmbuf_pkt_len(mbuf));
+  // LOG_MAIN(NOTICE, "Egress packet nb_segs: %u", mbuf->nb_segs);
+  
+  // Only packets parse_pot_burst() found to be valid PoT packets get here
+  struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
+  uint16_t ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
 
   switch (ether_type) {
   case RTE_ETHER_TYPE_IPV6:
@@ -49,131 +130,142 @@ static inline void process_egress_packet(struct rte_mbuf* mbuf) {
     switch (operation_bypass_bit) {
       LOG_MAIN(DEBUG, "Operation bypass bit is %d\n", operation_bypass_bit);
     case 0: {
+      if (pot_meta(mbuf)->carrier == POT_CARRIER_IOAM) {
+        egress_ioam_packet(mbuf);
+        break;
+      }
       LOG_MAIN(DEBUG, "Processing packet with SRH and HMAC\n");
       struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr + 1);
-      struct ipv6_srh* srh = (struct ipv6_srh*)(ipv6_hdr + 1);
-
-      // Check if the SRH next header is 61 (SRv6). If it is, we proceed with processing.
-      // 61 is the next header type for SRv6, as per RFC 8200.
-      // If the next header is not 61, we do not process the packet further
-      // and simply return.
-      if (srh->next_header == 61) {
-        LOG_MAIN(DEBUG, "SRH detected, processing packet\n");
-        size_t actual_srh_size = (srh->hdr_ext_len * 8) + 8;
-        size_t min_packet_size = sizeof(struct rte_ether_hdr) +
-                                sizeof(struct rte_ipv6_hdr) +
-                                actual_srh_size +
-                                sizeof(struct hmac_tlv) +
-                                sizeof(struct pot_tlv);
-        if (rte_pktmbuf_pkt_len(mbuf) < min_packet_size) {
-          LOG_MAIN(WARNING, "Egress: Packet too small (%u bytes) for expected headers (%zu bytes), dropping\n",
-                   rte_pktmbuf_pkt_len(mbuf), min_packet_size);
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-        uint8_t* hmac_ptr = (uint8_t*)srh + actual_srh_size;
-        struct hmac_tlv* hmac = (struct hmac_tlv*)hmac_ptr;
-        uint8_t* pot_ptr = hmac_ptr + sizeof(struct hmac_tlv);
-        struct pot_tlv* pot = (struct pot_tlv*)pot_ptr;
-        LOG_MAIN(DEBUG, "HMAC TLV type: %u, length: %u\n", hmac->type, hmac->length);
-
-        // Create a buffer to hold the destination IPv6 address as a string
-        // Convert the destination IPv6 address from binary to text form.
-        // If inet_ntop fails, log an error, free the packet, and exit processing.
-        char dst_ip_str[INET6_ADDRSTRLEN];
-        if (inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)) == NULL) {
-          LOG_MAIN(ERR, "inet_ntop failed for destination address\n");
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
+      struct ipv6_srh* srh;
+      struct hmac_tlv* hmac;
+      struct pot_tlv* pot;
+      locate_pot_tlvs(mbuf, &srh, &hmac, &pot);
+      LOG_MAIN(DEBUG, "HMAC TLV type: %u, length: %u\n", hmac->type, hmac->length);
 
-        LOG_MAIN(DEBUG, "Destination IPv6 address: %s\n", dst_ip_str);
-        uint8_t hmac_out[HMAC_MAX_LENGTH];
-        memcpy(hmac_out, pot->encrypted_hmac, HMAC_MAX_LENGTH);
-
-        // This code decrypts the HMAC in the PoT TLV structure that was encrypted at ingress.
-        // First logs the encrypted HMAC length for debugging
-        // Then decrypts the Packet Verification Field (PVF) using:
-        //  - k_pot_in[0]: Secret key shared between ingress/egress nodes
-        //  - pot->nonce: Prevents replay attacks
-        //  - hmac_out: Buffer for decrypted result
-        // Finally copies the decrypted HMAC back to the PoT structure
-        //
-        // After this, the code will verify packet integrity by comparing this HMAC
-        // with a freshly calculated value to confirm path compliance
-        LOG_MAIN(DEBUG, "Encrypted HMAC length: %zu\n", sizeof(pot->encrypted_hmac));
-
-        uint8_t final_hmac[HMAC_MAX_LENGTH];
-        int dec_len = decrypt(pot->encrypted_hmac, HMAC_MAX_LENGTH, k_pot_in[0], pot->nonce, final_hmac);
-
-        if (dec_len < 0) {
-          LOG_MAIN(ERR, "Egress: Final PVF decryption failed.\n");
-          return;
-        }
-        // memcpy(pot->encrypted_hmac, hmac_out, HMAC_MAX_LENGTH);
-        LOG_MAIN(DEBUG, "Decrypted HMAC length: %zu\n", sizeof(pot->encrypted_hmac));
-
-        // Prepare the HMAC key for verification
-        // This key is used to calculate the expected HMAC for the packet.
-        uint8_t* k_hmac_ie = k_pot_in[0];
-        uint8_t expected_hmac[HMAC_MAX_LENGTH];
-        LOG_MAIN(DEBUG, "Calculating expected HMAC with key length %zu\n", HMAC_MAX_LENGTH);\
-        // Log the inputs to HMAC calculations for verifications
-        //
-        // Increase segment_left by 1 to temporarly test if it is the root cause of 
-        // HMAC verification failure
-        srh->segments_left += 1;
-        if (calculate_hmac((uint8_t*)&ipv6_hdr->src_addr, srh, hmac, k_hmac_ie, HMAC_MAX_LENGTH,
-                           expected_hmac) != 0) {
-          LOG_MAIN(ERR, "Egress: HMAC calculation failed\n");
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
+      // Create a buffer to hold the destination IPv6 address as a string
+      // Convert the destination IPv6 address from binary to text form.
+      // If inet_ntop fails, log an error, free the packet, and exit processing.
+      char dst_ip_str[INET6_ADDRSTRLEN];
+      if (inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)) == NULL) {
+        LOG_MAIN(ERR, "inet_ntop failed for destination address\n");
+        rte_pktmbuf_free(mbuf);
+        return;
+      }
+
+      LOG_MAIN(DEBUG, "Destination IPv6 address: %s\n", dst_ip_str);
+
+      // Only the algorithm this deployment is configured for is accepted, a packet naming another
+      // one was signed by a misconfigured ingress or tampered with
+      uint8_t mac_alg = POT_MAC_KEY_ID_ALG(rte_be_to_cpu_32(hmac->hmac_key_id));
+      if (mac_alg != g_pot_mac->alg) {
+        LOG_MAIN(WARNING, "Egress: Packet MAC algorithm %u does not match %s, dropping packet\n", mac_alg,
+                 g_pot_mac->name);
+        rte_pktmbuf_free(mbuf);
+        return;
+      }
 
-        LOG_MAIN(DEBUG, "Comparing calculated HMAC with expected HMAC\n");
-        if (memcmp(final_hmac, expected_hmac, HMAC_MAX_LENGTH) != 0) {
-          LOG_MAIN(DEBUG, "Final HMAC: ");
-          log_hex_data("Final HMAC", final_hmac, HMAC_MAX_LENGTH);
-          LOG_MAIN(DEBUG, "Expected HMAC: ");
-          log_hex_data("Expected HMAC", expected_hmac, HMAC_MAX_LENGTH);
-          LOG_MAIN(ERR, "Egress: HMAC verification failed, dropping packet\n");
+      // Likewise only the configured tag length, a shorter tag would be far cheaper to forge
+      uint8_t tag_len = pot_meta(mbuf)->tag_len;
+      if (tag_len != g_pot_tag_len) {
+        LOG_MAIN(WARNING, "Egress: Packet carries a %u byte tag, %u configured, dropping packet\n", tag_len,
+                 g_pot_tag_len);
+        rte_pktmbuf_free(mbuf);
+        return;
+      }
+
+      // Verify with the key set the ingress signed the packet with, the current or the previous one
+      const struct pot_key_epoch* epoch = keystore_find(rte_be_to_cpu_32(pot->key_set_id));
+      if (epoch == NULL) {
+        LOG_MAIN(WARNING, "Egress: Unknown key set 0x%08x, dropping packet\n", rte_be_to_cpu_32(pot->key_set_id));
+        rte_pktmbuf_free(mbuf);
+        return;
+      }
+
+      // On the cryptodev backend the layer decryption and the expected HMAC run as crypto ops,
+      // verification continues in egress_crypto_done() once the forwarding loop dequeues them
+      if (g_crypto_backend == CRYPTO_BACKEND_CRYPTODEV) {
+        uint8_t hmac_input[HMAC_INPUT_MAX_LENGTH];
+        srh->segments_left += 1; // same adjustment as the EVP path below
+        struct pot_cryptodev_job job = {
+            .epoch = epoch,
+            .first_key = 0,
+            .nb_cipher = 1,
+            .pvf_offset = (uint16_t)(pot->encrypted_hmac - rte_pktmbuf_mtod(mbuf, uint8_t*)),
+            .pvf_len = tag_len,
+            .nonce = pot->nonce,
+            .hmac_key = 0,
+            .hmac_input = hmac_input,
+            .hmac_input_len = (uint16_t)hmac_input_build((uint8_t*)&ipv6_hdr->src_addr, srh, hmac, hmac_input,
+                                                         sizeof(hmac_input)),
+            .done = egress_crypto_done,
+        };
+        if (pot_cryptodev_submit(mbuf, &job) < 0) {
+          LOG_MAIN(ERR, "Egress: Could not submit PoT verification, dropping packet\n");
           rte_pktmbuf_free(mbuf);
-          return;
         }
+        return;
+      }
 
-        // If the HMAC verification is successful, we proceed to remove headers
-        // and forward the packet to the iperf server.
-        // This includes removing the SRH, HMAC TLV, and PoT TLV
-        // from the packet, and then sending it to the iperf server.
-        // The final packet will have the original IPv6 header and payload,
-        // but without the SRH, HMAC TLV, and PoT TLV.
-        // LOG_MAIN(INFO, "Egress: HMAC verified successfully, forwarding packet\n");
-        remove_headers(mbuf);
-
-        LOG_MAIN(DEBUG, "Packet after removing headers - length: %u\n", rte_pktmbuf_pkt_len(mbuf));
-        struct rte_ether_hdr* eth_hdr_final = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
-        struct rte_ipv6_hdr* ipv6_hdr_final = (struct rte_ipv6_hdr*)(eth_hdr_final + 1);
-        LOG_MAIN(DEBUG, "Final packet IPv6 src: %s, dst: %s\n",
-                 inet_ntop(AF_INET6, &ipv6_hdr_final->src_addr, NULL, 0),
-                 inet_ntop(AF_INET6, &ipv6_hdr_final->dst_addr, NULL, 0));
-
-        char final_src_ip[INET6_ADDRSTRLEN], final_dst_ip[INET6_ADDRSTRLEN];
-        inet_ntop(AF_INET6, &ipv6_hdr_final->src_addr, final_src_ip, INET6_ADDRSTRLEN);
-        inet_ntop(AF_INET6, &ipv6_hdr_final->dst_addr, final_dst_ip, INET6_ADDRSTRLEN);
-        LOG_MAIN(DEBUG, "Final packet IPv6 src: %s, dst: %s\n", final_src_ip, final_dst_ip);
-
-        // Forward the packet to the iperf server
-        // The MAC address of the iperf server is hardcoded here.
-        struct rte_ether_addr iperf_mac = {{0x02, 0xcc, 0xef, 0x38, 0x4b, 0x25}};
-        if(g_is_virtual_machine == 0) {
-          send_packet_to(iperf_mac, mbuf, 1);
-        } else {
-          send_packet_to(iperf_mac, mbuf, 0);
-        }
-        LOG_MAIN(DEBUG, "Packet sent to iperf server with MAC %02x:%02x:%02x:%02x:%02x:%02x\n",
-                 iperf_mac.addr_bytes[0], iperf_mac.addr_bytes[1], iperf_mac.addr_bytes[2],
-                 iperf_mac.addr_bytes[3], iperf_mac.addr_bytes[4], iperf_mac.addr_bytes[5]);
+      uint8_t hmac_out[HMAC_MAX_LENGTH];
+      memcpy(hmac_out, pot->encrypted_hmac, tag_len);
+
+      // This code decrypts the HMAC in the PoT TLV structure that was encrypted at ingress.
+      // First logs the encrypted HMAC length for debugging
+      // Then decrypts the Packet Verification Field (PVF) using:
+      //  - epoch->keys[0]: Secret key shared between ingress/egress nodes
+      //  - pot->nonce: Prevents replay attacks
+      //  - hmac_out: Buffer for decrypted result
+      // Finally copies the decrypted HMAC back to the PoT structure
+      //
+      // After this, the code will verify packet integrity by comparing this HMAC
+      // with a freshly calculated value to confirm path compliance
+      LOG_MAIN(DEBUG, "Encrypted HMAC length: %u\n", tag_len);
+
+      uint8_t final_hmac[HMAC_MAX_LENGTH];
+      int dec_len = decrypt(pot->encrypted_hmac, tag_len, (uint8_t*)epoch->keys[0].key, pot->nonce, final_hmac);
+
+      if (dec_len < 0) {
+        LOG_MAIN(ERR, "Egress: Final PVF decryption failed.\n");
+        return;
+      }
+      // memcpy(pot->encrypted_hmac, hmac_out, HMAC_MAX_LENGTH);
+      LOG_MAIN(DEBUG, "Decrypted HMAC length: %d\n", dec_len);
+
+      // The ingress/egress key of the packet's key set is used to calculate the expected MAC
+      uint8_t expected_hmac[HMAC_MAX_LENGTH];
+      LOG_MAIN(DEBUG, "Calculating expected HMAC with key length %zu\n", HMAC_MAX_LENGTH);\
+      // Log the inputs to HMAC calculations for verifications
+      //
+      // Increase segment_left by 1 to temporarly test if it is the root cause of 
+      // HMAC verification failure
+      srh->segments_left += 1;
+      if (calculate_pot_mac(g_pot_mac, (uint8_t*)&ipv6_hdr->src_addr, srh, hmac, &epoch->keys[0], pot->nonce,
+                            expected_hmac) != 0) {
+        LOG_MAIN(ERR, "Egress: HMAC calculation failed\n");
+        rte_pktmbuf_free(mbuf);
+        return;
       }
+
+      LOG_MAIN(DEBUG, "Comparing calculated HMAC with expected HMAC\n");
+      // The tag is the leading tag_len bytes of the MAC field
+      if (memcmp(final_hmac, expected_hmac, tag_len) != 0) {
+        LOG_MAIN(DEBUG, "Final HMAC: ");
+        log_hex_data("Final HMAC", final_hmac, tag_len);
+        LOG_MAIN(DEBUG, "Expected HMAC: ");
+        log_hex_data("Expected HMAC", expected_hmac, tag_len);
+        LOG_MAIN(ERR, "Egress: HMAC verification failed, dropping packet\n");
+        rte_pktmbuf_free(mbuf);
+        return;
+      }
+
+      // If the HMAC verification is successful, we proceed to remove headers
+      // and forward the packet to the iperf server.
+      // This includes removing the SRH, HMAC TLV, and PoT TLV
+      // from the packet, and then sending it to the iperf server.
+      // The final packet will have the original IPv6 header and payload,
+      // but without the SRH, HMAC TLV, and PoT TLV.
+      // LOG_MAIN(INFO, "Egress: HMAC verified successfully, forwarding packet\n");
+      egress_forward_packet(mbuf);
       break;
     }
     case 1:
@@ -2,13 +2,187 @@
 
 #include "forward.h"
 #include "headers.h"
+#include "ioam.h"
 #include "crypto.h"
+#include "cryptodev.h"
+#include "mac.h"
 #include "utils/logging.h"
 #include "node/controller.h"
 #include "utils/config.h"
 #include "headers.h"
 #include "forward.h"
 
+// Steers a signed packet to its first segment, or drops it when the SRH has nowhere left to go
+static void ingress_forward_packet(struct rte_mbuf *mbuf) {
+  struct rte_ether_hdr *eth_hdr6 = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+  struct rte_ipv6_hdr *ipv6_hdr = (struct rte_ipv6_hdr *)(eth_hdr6 + 1);
+  struct ipv6_srh *srh = (struct ipv6_srh *)(ipv6_hdr + 1);
+  char dst_ip_str[INET6_ADDRSTRLEN];
+
+  if (srh->segments_left == 0) {
+    LOG_MAIN(DEBUG, "SRH segments_left is 0, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+  } else {
+    
+    // Calculate the dynamic SRG size to find segments
+    // size_t actual_srh_size = (srh->hdr_ext_len * 8) + 8;
+
+    // Get pointer to the segments array (located after the SRH header)
+    struct in6_addr *segments = (struct in6_addr *)((uint8_t *)srh + sizeof(struct ipv6_srh));
+
+    // If segments_left is not 0, the packet needs to be forwarded to the next segment ID.
+    // Calculate the index of the next segment ID (SID) in the SRH segment list.
+    // srh->last_entry is the total number of segments.
+    // srh->segments_left is the number of remaining segments to visit.
+    // The next SID is (last_entry - segments_left + 1) index into the segments array.
+    // int next_sid_index = srh->last_entry - srh->segments_left + 1;
+    // int next_sid_index = srh->segments_left - 1;
+    int next_sid_index = 0;
+
+    LOG_MAIN(DEBUG, "SID calculation: last_entry=%u, segments_left=%u, next_sid_index=%d\n", 
+            srh->last_entry, srh->segments_left, next_sid_index);             
+    
+    // Add bounds check for segment array access
+    if (next_sid_index < 0 || next_sid_index > srh->last_entry) {
+      LOG_MAIN(ERR, "Ingress: Invalid next_sid_index (%d), last_entry (%u), dropping packet\n", 
+               next_sid_index, srh->last_entry);
+      rte_pktmbuf_free(mbuf);
+      return;
+    }
+
+    // Debug the segment we're about to use
+    char debug_seg_str[INET6_ADDRSTRLEN];
+    inet_ntop(AF_INET6, &segments[next_sid_index], debug_seg_str, sizeof(debug_seg_str));
+    LOG_MAIN(DEBUG, "About to use segment[%d]: %s\n", next_sid_index, debug_seg_str);
+
+    
+    // memcpy(&ipv6_hdr->dst_addr, &srh->segments[next_sid_index], sizeof(struct in6_addr));
+    // LOG_MAIN(DEBUG, "Updated packet destination to next SID: %s\n",
+    //          inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
+    memcpy(&ipv6_hdr->dst_addr, &segments[next_sid_index], sizeof(struct in6_addr));
+    LOG_MAIN(DEBUG, "Updated packet destination to next SID: %s\n",
+            inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
+
+
+    // With C-SIDs the first segment is a container, the hop is its first uSID
+    struct in6_addr next_sid;
+    srh_active_sid(srh, (const struct in6_addr *)&ipv6_hdr->dst_addr, &next_sid);
+    const struct next_hop_entry *next_hop = lookup_next_hop(&next_sid);
+
+    if (next_hop) {
+      if(g_is_virtual_machine == 0) {
+        send_packet_to_hop(next_hop, mbuf, 1);
+      } else {
+        send_packet_to_hop(next_hop, mbuf, 0);
+      }
+      LOG_MAIN(DEBUG, "Packet sent to next hop with MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
+               next_hop->mac.addr_bytes[0], next_hop->mac.addr_bytes[1], next_hop->mac.addr_bytes[2],
+               next_hop->mac.addr_bytes[3], next_hop->mac.addr_bytes[4], next_hop->mac.addr_bytes[5]);
+    } else {
+      LOG_MAIN(ERR, "No MAC found for next SID, dropping packet.\n");
+      rte_pktmbuf_free(mbuf);
+    }
+  }
+}
+
+// IOAM carrier: the Hop-by-Hop option is in place, sign it and send the packet on to its own
+// destination, there is no segment list to steer it by
+static void ingress_ioam_packet(struct rte_mbuf *mbuf) {
+  struct rte_ipv6_hdr *ipv6_hdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv6_hdr *, sizeof(struct rte_ether_hdr));
+  struct ioam_pot_hbh *hbh = ioam_pot_of(mbuf);
+
+  const struct pot_key_epoch *epoch = keystore_find(rte_be_to_cpu_32(hbh->key_set_id));
+  if (epoch == NULL) {
+    LOG_MAIN(ERR, "Ingress: No PoT keys loaded for key set 0x%08x, dropping packet\n",
+             rte_be_to_cpu_32(hbh->key_set_id));
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  if (generate_nonce(hbh->nonce) != 0) {
+    LOG_MAIN(ERR, "Nonce generation failed, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+
+  uint8_t input[IOAM_MAC_INPUT_LENGTH];
+  uint8_t mac_out[HMAC_MAX_LENGTH];
+  size_t input_len = ioam_mac_input_build(ipv6_hdr, hbh, input, sizeof(input));
+  if (calculate_pot_mac_input(g_pot_mac, &epoch->keys[0], hbh->nonce, input, input_len, mac_out) < 0 ||
+      encrypt_pvf(epoch, hbh->nonce, mac_out, g_pot_tag_len) < 0) {
+    LOG_MAIN(ERR, "Ingress: Signing the IOAM PoT option failed, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  rte_memcpy(hbh->pvf, mac_out, g_pot_tag_len);
+
+  const struct next_hop_entry *next_hop = lookup_next_hop((const struct in6_addr *)&ipv6_hdr->dst_addr);
+  if (next_hop == NULL) {
+    LOG_MAIN(ERR, "No MAC found for the destination, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  send_packet_to_hop(next_hop, mbuf, g_is_virtual_machine == 0 ? 1 : 0);
+}
+
+// Cryptodev backend, second step: the onion layers are on, forward the packet
+static void ingress_crypto_done(struct rte_mbuf *mbuf, const uint8_t *digest __rte_unused, int ok) {
+  if (!ok) {
+    LOG_MAIN(ERR, "Ingress: PVF encryption failed on cryptodev, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+  ingress_forward_packet(mbuf);
+}
+
+// Cryptodev backend, first step: the HMAC is back. Store it, pick a nonce and submit the onion
+// encryption of the PVF, which continues in ingress_crypto_done().
+static void ingress_hmac_done(struct rte_mbuf *mbuf, const uint8_t *digest, int ok) {
+  if (!ok) {
+    LOG_MAIN(ERR, "Ingress: HMAC calculation failed on cryptodev, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+
+  struct ipv6_srh *srh;
+  struct hmac_tlv *hmac;
+  struct pot_tlv *pot;
+  locate_pot_tlvs(mbuf, &srh, &hmac, &pot);
+
+  // The key set may have rotated while the HMAC was on the device, encrypt with the one it was
+  // signed under
+  const struct pot_key_epoch *epoch = keystore_find(rte_be_to_cpu_32(pot->key_set_id));
+  if (epoch == NULL) {
+    LOG_MAIN(ERR, "Ingress: Key set 0x%08x is gone, dropping packet.\n", rte_be_to_cpu_32(pot->key_set_id));
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+
+  // Only the leading tag_len bytes of the digest travel, the TLVs end right behind them
+  uint8_t tag_len = pot_meta(mbuf)->tag_len;
+  rte_memcpy(hmac->hmac_value, digest, tag_len);
+  rte_memcpy(pot->encrypted_hmac, digest, tag_len);
+  if (generate_nonce(pot->nonce) != 0) {
+    LOG_MAIN(ERR, "Nonce generation failed, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+    return;
+  }
+
+  struct pot_cryptodev_job job = {
+      .epoch = epoch,
+      .first_key = 0,
+      .nb_cipher = (uint8_t)(num_transit_nodes + 1),
+      .pvf_offset = (uint16_t)(pot->encrypted_hmac - rte_pktmbuf_mtod(mbuf, uint8_t *)),
+      .pvf_len = tag_len,
+      .nonce = pot->nonce,
+      .hmac_input = NULL,
+      .done = ingress_crypto_done,
+  };
+  if (pot_cryptodev_submit(mbuf, &job) < 0) {
+    LOG_MAIN(ERR, "Ingress: Could not submit PVF encryption, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+  }
+}
+
 static inline void process_ingress_packet(struct rte_mbuf *mbuf, uint16_t rx_port_id) {
   
   // Add bounds checking before accessing headers
@@ -51,9 +225,14 @@ static inline void process_ingress_packet(struct rte_mbuf *mbuf, uint16_t rx_por
         case 0:
           LOG_MAIN(DEBUG, "Processing packet with SRH and HMAC for ingress.\n");
 
-          add_custom_header(mbuf);
-          
-          
+          // add_custom_header() frees the packet itself when it cannot take the headers, and may
+          // hand back a header mbuf chained ahead of it
+          if (add_custom_header(&mbuf) < 0) return;
+          if (g_pot_carrier == POT_CARRIER_IOAM) {
+            ingress_ioam_packet(mbuf);
+            return;
+          }
+
           struct rte_ether_hdr *eth_hdr6 = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
           struct rte_ipv6_hdr *ipv6_hdr = (struct rte_ipv6_hdr *)(eth_hdr6 + 1);
           struct ipv6_srh *srh = (struct ipv6_srh *)(ipv6_hdr + 1);
@@ -65,8 +244,8 @@ static inline void process_ingress_packet(struct rte_mbuf *mbuf, uint16_t rx_por
           size_t min_ingress_size = sizeof(struct rte_ether_hdr) + 
                                   sizeof(struct rte_ipv6_hdr) + 
                                   actual_srh_size +  // Use dynamic size instead of sizeof(struct ipv6_srh)
-                                  sizeof(struct hmac_tlv) + 
-                                  sizeof(struct pot_tlv);
+                                  HMAC_TLV_SIZE(g_pot_tag_len) + 
+                                  POT_TLV_SIZE(g_pot_tag_len);
 
           if (rte_pktmbuf_pkt_len(mbuf) < min_ingress_size) {
             LOG_MAIN(ERR, "Ingress: Packet too small after adding headers (%u bytes), expected (%zu bytes)\n", 
@@ -77,7 +256,7 @@ static inline void process_ingress_packet(struct rte_mbuf *mbuf, uint16_t rx_por
 
           uint8_t* hmac_ptr = (uint8_t*)srh + actual_srh_size;
           struct hmac_tlv *hmac = (struct hmac_tlv *)hmac_ptr;
-          uint8_t* pot_ptr = hmac_ptr + sizeof(struct hmac_tlv);
+          uint8_t* pot_ptr = hmac_ptr + HMAC_TLV_SIZE(g_pot_tag_len);
           struct pot_tlv *pot = (struct pot_tlv *)pot_ptr;
 
 
@@ -97,15 +276,15 @@ static inline void process_ingress_packet(struct rte_mbuf *mbuf, uint16_t rx_por
           }
           LOG_MAIN(DEBUG, "Packet Destination IPv6: %s\n", dst_ip_str);
 
-          // Add bounds check for k_pot_in array access
-          if (0 >= MAX_POT_NODES) {
-            LOG_MAIN(ERR, "Ingress: Invalid key index (0), dropping packet\n");
+          // Sign with the key set add_custom_header() stamped into the PoT TLV
+          const struct pot_key_epoch *epoch = keystore_find(rte_be_to_cpu_32(pot->key_set_id));
+          if (epoch == NULL) {
+            LOG_MAIN(ERR, "Ingress: No PoT keys loaded for key set 0x%08x, dropping packet\n",
+                     rte_be_to_cpu_32(pot->key_set_id));
             rte_pktmbuf_free(mbuf);
             return;
           }
 
-          uint8_t *k_hmac_ie = k_pot_in[0];
-          size_t key_len = HMAC_MAX_LENGTH;
 
           struct in6_addr ingress_addr;
           if(g_is_virtual_machine) {
@@ -118,95 +297,59 @@ static inline void process_ingress_packet(struct rte_mbuf *mbuf, uint16_t rx_por
           if (dump_len > 128) dump_len = 128;
           LOG_MAIN(DEBUG, "Packet length for dump: %zu\n", dump_len);
 
-          uint8_t hmac_out[HMAC_MAX_LENGTH];
-
-          // Calculate the HMAC for the packet.
-          // This HMAC is computed over specific packet fields (source address, SRH, HMAC TLV, etc.)
-          // using the ingress_addr and the HMAC key.
-          // 
-          // Log the inputs to HMAC calculations for verifications
-          if (calculate_hmac((uint8_t *)&ingress_addr, srh, hmac, k_hmac_ie, key_len, hmac_out) == 0) {
-            rte_memcpy(hmac->hmac_value, hmac_out, HMAC_MAX_LENGTH);
-            LOG_MAIN(DEBUG, "HMAC calculated and copied to packet.\n");
-          } else {
-            LOG_MAIN(ERR, "HMAC calculation failed for ingress packet, dropping.\n");
-            break;
+          // On the cryptodev backend the HMAC and the encryption run as crypto ops, the packet
+          // continues in ingress_hmac_done() once the forwarding loop dequeues them
+          if (g_crypto_backend == CRYPTO_BACKEND_CRYPTODEV) {
+            uint8_t hmac_input[HMAC_INPUT_MAX_LENGTH];
+            struct pot_cryptodev_job job = {
+                .epoch = epoch,
+                .nb_cipher = 0,
+                .hmac_key = 0,
+                .hmac_input = hmac_input,
+                .hmac_input_len = (uint16_t)hmac_input_build((uint8_t *)&ingress_addr, srh, hmac, hmac_input,
+                                                             sizeof(hmac_input)),
+                .done = ingress_hmac_done,
+            };
+            if (pot_cryptodev_submit(mbuf, &job) < 0) {
+              LOG_MAIN(ERR, "Ingress: Could not submit HMAC calculation, dropping packet.\n");
+              rte_pktmbuf_free(mbuf);
+            }
+            return;
           }
 
+          uint8_t hmac_out[HMAC_MAX_LENGTH];
           uint8_t nonce[NONCE_LENGTH];
 
+          // The nonce is drawn first, MAC algorithms other than HMAC-SHA256 may be keyed with it
           if (generate_nonce(nonce) != 0) {
             LOG_MAIN(ERR, "Nonce generation failed, dropping packet.\n");
             break;
           }
 
-          encrypt_pvf(k_pot_in, nonce, hmac_out);
-          rte_memcpy(pot->encrypted_hmac, hmac_out, HMAC_MAX_LENGTH);
-          rte_memcpy(pot->nonce, nonce, NONCE_LENGTH);
-          LOG_MAIN(DEBUG, "HMAC encrypted and Nonce added to POT TLV.\n");
-
-          if (srh->segments_left == 0) {
-            LOG_MAIN(DEBUG, "SRH segments_left is 0, dropping packet.\n");
-            rte_pktmbuf_free(mbuf);
+          // Calculate the path MAC for the packet with the configured algorithm (see mac.h).
+          // It is computed over specific packet fields (source address, SRH, HMAC TLV, etc.)
+          // using the ingress_addr and the ingress/egress key.
+          //
+          // Log the inputs to HMAC calculations for verifications
+          if (calculate_pot_mac(g_pot_mac, (uint8_t *)&ingress_addr, srh, hmac, &epoch->keys[0], nonce, hmac_out) ==
+              0) {
+            rte_memcpy(hmac->hmac_value, hmac_out, g_pot_tag_len);
+            LOG_MAIN(DEBUG, "%s calculated and copied to packet.\n", g_pot_mac->name);
           } else {
-            
-            // Calculate the dynamic SRG size to find segments
-            // size_t actual_srh_size = (srh->hdr_ext_len * 8) + 8;
-
-            // Get pointer to the segments array (located after the SRH header)
-            struct in6_addr *segments = (struct in6_addr *)((uint8_t *)srh + sizeof(struct ipv6_srh));
-
-            // If segments_left is not 0, the packet needs to be forwarded to the next segment ID.
-            // Calculate the index of the next segment ID (SID) in the SRH segment list.
-            // srh->last_entry is the total number of segments.
-            // srh->segments_left is the number of remaining segments to visit.
-            // The next SID is (last_entry - segments_left + 1) index into the segments array.
-            // int next_sid_index = srh->last_entry - srh->segments_left + 1;
-            // int next_sid_index = srh->segments_left - 1;
-            int next_sid_index = 0;
-
-            LOG_MAIN(DEBUG, "SID calculation: last_entry=%u, segments_left=%u, next_sid_index=%d\n", 
-                    srh->last_entry, srh->segments_left, next_sid_index);             
-            
-            // Add bounds check for segment array access
-            if (next_sid_index < 0 || next_sid_index > srh->last_entry) {
-              LOG_MAIN(ERR, "Ingress: Invalid next_sid_index (%d), last_entry (%u), dropping packet\n", 
-                       next_sid_index, srh->last_entry);
-              rte_pktmbuf_free(mbuf);
-              return;
-            }
+            LOG_MAIN(ERR, "%s calculation failed for ingress packet, dropping.\n", g_pot_mac->name);
+            break;
+          }
 
-            // Debug the segment we're about to use
-            char debug_seg_str[INET6_ADDRSTRLEN];
-            inet_ntop(AF_INET6, &segments[next_sid_index], debug_seg_str, sizeof(debug_seg_str));
-            LOG_MAIN(DEBUG, "About to use segment[%d]: %s\n", next_sid_index, debug_seg_str);
-
-            
-            // memcpy(&ipv6_hdr->dst_addr, &srh->segments[next_sid_index], sizeof(struct in6_addr));
-            // LOG_MAIN(DEBUG, "Updated packet destination to next SID: %s\n",
-            //          inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
-            memcpy(&ipv6_hdr->dst_addr, &segments[next_sid_index], sizeof(struct in6_addr));
-            LOG_MAIN(DEBUG, "Updated packet destination to next SID: %s\n",
-                    inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
-
-
-            // struct rte_ether_addr *next_mac = lookup_mac_for_ipv6(&srh->segments[next_sid_index]);
-            struct rte_ether_addr *next_mac = lookup_mac_for_ipv6(&segments[next_sid_index]);
-
-            if (next_mac) {
-              if(g_is_virtual_machine == 0) {
-                send_packet_to(*next_mac, mbuf, 1);
-              } else {
-                send_packet_to(*next_mac, mbuf, 0);
-              }
-              LOG_MAIN(DEBUG, "Packet sent to next hop with MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
-                       next_mac->addr_bytes[0], next_mac->addr_bytes[1], next_mac->addr_bytes[2],
-                       next_mac->addr_bytes[3], next_mac->addr_bytes[4], next_mac->addr_bytes[5]);
-            } else {
-              LOG_MAIN(ERR, "No MAC found for next SID, dropping packet.\n");
-              rte_pktmbuf_free(mbuf);
-            }
+          if (encrypt_pvf(epoch, nonce, hmac_out, g_pot_tag_len) < 0) {
+            LOG_MAIN(ERR, "PVF encryption failed, dropping packet.\n");
+            rte_pktmbuf_free(mbuf);
+            return;
           }
+          rte_memcpy(pot->encrypted_hmac, hmac_out, g_pot_tag_len);
+          rte_memcpy(pot->nonce, nonce, NONCE_LENGTH);
+          LOG_MAIN(DEBUG, "HMAC encrypted and Nonce added to POT TLV.\n");
+
+          ingress_forward_packet(mbuf);
 
           break;
         case 1:
@@ -1,225 +1,217 @@
 #include "node/transit.h"
 
 #include "crypto.h"
+#include "cryptodev.h"
 #include "forward.h"
 #include "headers.h"
+#include "ioam.h"
 #include "node/controller.h"
 #include "utils/config.h"
 #include "utils/logging.h"
 
-static inline void process_transit_packet(struct rte_mbuf* mbuf, int i) {
-  size_t dump_len = rte_pktmbuf_pkt_len(mbuf);
-  if (dump_len > 64) dump_len = 64;
-  // LOG_DP(DEBUG, "Processing transit packet %u with length %u.", i, rte_pktmbuf_pkt_len(mbuf));
-
-  // Enhanced bounds checking - check for ALL expected headers
-  // size_t min_packet_size = sizeof(struct rte_ether_hdr) + 
-  //                         sizeof(struct rte_ipv6_hdr) + 
-  //                         sizeof(struct ipv6_srh) + 
-  //                         sizeof(struct hmac_tlv) + 
-  //                         sizeof(struct pot_tlv);
-  
-  if (rte_pktmbuf_pkt_len(mbuf) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr)) {
-      LOG_MAIN(WARNING, "Transit: Packet too small for basic headers, dropping\n");
-      rte_pktmbuf_free(mbuf);
-      return;
+// Finds the key set id, nonce and PVF of a packet, from the PoT TLV or the IOAM option. Returns -1
+// if the packet was dropped (and freed).
+static inline int transit_validate_packet(struct rte_mbuf* mbuf, uint32_t* key_set_id, uint8_t** nonce,
+                                          uint8_t** pvf) {
+  // Tags of the configured length only, the whole burst is then peeled with one length
+  if (pot_meta(mbuf)->tag_len != g_pot_tag_len) {
+    LOG_MAIN(WARNING, "Transit: %u byte tag but --tag-len is %u, dropping.\n", pot_meta(mbuf)->tag_len,
+             g_pot_tag_len);
+    rte_pktmbuf_free(mbuf);
+    return -1;
   }
 
-  struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
-  uint16_t ether_type = rte_be_to_cpu_16(eth_hdr->ether_type);
+  if (pot_meta(mbuf)->carrier == POT_CARRIER_IOAM) {
+    struct ioam_pot_hbh* hbh = ioam_pot_of(mbuf);
+    *key_set_id = rte_be_to_cpu_32(hbh->key_set_id);
+    *nonce = hbh->nonce;
+    *pvf = hbh->pvf;
+    return 0;
+  }
 
-  // Check if the destination MAC address is a multicast/broadcast address.
-  // If the least significant bit of the first byte is set, it's multicast/broadcast.
-  // Such packets are not processed by this specific logic and are dropped.
-  if ((eth_hdr->dst_addr.addr_bytes[0] & 0x01) != 0) {
-    LOG_MAIN(NOTICE, "Multicast/Broadcast packet received in transit, dropping.");
+  // The layout was checked when the burst was received and invalid packets never get here, see
+  // parse_pot_burst()
+  struct ipv6_srh* srh;
+  struct hmac_tlv* hmac;
+  struct pot_tlv* pot;
+  locate_pot_tlvs(mbuf, &srh, &hmac, &pot);
+
+  // Check if 'segments_left' is 0. If it is, the packet has reached
+  // its final segment in the SRH path at this node, but this is a transit node.
+  // This indicates a routing error or misconfiguration, so the packet is dropped
+  // before any crypto work is spent on it.
+  if (srh->segments_left == 0) {
+    LOG_MAIN(WARNING, "Transit: segments_left is 0, but packet still in transit, dropping.\n");
     rte_pktmbuf_free(mbuf);
+    return -1;
+  }
+
+  LOG_MAIN(DEBUG, "Transit: SRH detected. POT TLV address: %p\n", (void*)pot);
+  *key_set_id = rte_be_to_cpu_32(pot->key_set_id);
+  *nonce = pot->nonce;
+  *pvf = pot->encrypted_hmac;
+  return 0;
+}
+
+static inline void transit_forward_packet(struct rte_mbuf* mbuf) {
+  const struct pot_pkt_meta* meta = pot_meta(mbuf);
+  struct rte_ether_hdr* eth_hdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr*);
+  struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr + 1);
+
+  // IOAM packets keep their destination, the next hop is looked up on it as it is
+  if (meta->carrier == POT_CARRIER_IOAM) {
+    const struct next_hop_entry* next_hop = lookup_next_hop((const struct in6_addr*)&ipv6_hdr->dst_addr);
+    if (next_hop == NULL) {
+      LOG_MAIN(ERR, "Transit: No MAC found for the destination, dropping packet.\n");
+      rte_pktmbuf_free(mbuf);
+      return;
+    }
+    send_packet_to_hop(next_hop, mbuf, g_is_virtual_machine == 0 ? 1 : 0);
     return;
   }
 
-  // Check if the packet is IPv6, if not drop it
-  if (ether_type != RTE_ETHER_TYPE_IPV6) {
-    LOG_MAIN(NOTICE, "Non-IPv6 packet received in transit (EtherType: %u), dropping.\n", ether_type);
+  struct ipv6_srh* srh = rte_pktmbuf_mtod_offset(mbuf, struct ipv6_srh*, meta->srh_off);
+  char dst_ip_str[INET6_ADDRSTRLEN];
+
+  // Add bounds check for segments_left
+  // if (srh->segments_left > srh->last_entry) {
+  //   LOG_MAIN(ERR, "Transit: segments_left (%u) > last_entry (%u), dropping packet\n", 
+  //            srh->segments_left, srh->last_entry);
+  //   rte_pktmbuf_free(mbuf);
+  //   return;
+  // }
+
+  // Next uSID of a C-SID container, or segments_left-- and the next full segment
+  if (srh_advance(srh, meta->nb_segments, (struct in6_addr*)&ipv6_hdr->dst_addr) < 0) {
+    LOG_MAIN(ERR, "Transit: No SID left after this node, last_entry (%u), dropping packet\n", srh->last_entry);
     rte_pktmbuf_free(mbuf);
     return;
   }
+  LOG_MAIN(DEBUG, "Transit: Advanced the segment list. Next SID: %s\n",
+          inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
+
+  struct in6_addr next_sid;
+  srh_active_sid(srh, (const struct in6_addr*)&ipv6_hdr->dst_addr, &next_sid);
+  const struct next_hop_entry* next_hop = lookup_next_hop(&next_sid);
+  if (next_hop) {
+    if(g_is_virtual_machine == 0) {
+    send_packet_to_hop(next_hop, mbuf, 1);
+    } else {
+      send_packet_to_hop(next_hop, mbuf, 0);
+    }
+    LOG_MAIN(DEBUG, "Transit: Packet sent to next hop with MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
+             next_hop->mac.addr_bytes[0], next_hop->mac.addr_bytes[1], next_hop->mac.addr_bytes[2],
+             next_hop->mac.addr_bytes[3], next_hop->mac.addr_bytes[4], next_hop->mac.addr_bytes[5]);
+  } else {
+    LOG_MAIN(ERR, "Transit: No MAC found for next SID, dropping packet.\n");
+    rte_pktmbuf_free(mbuf);
+  }
+}
 
-  struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr + 1);
-  struct ipv6_srh* srh = (struct ipv6_srh*)(ipv6_hdr + 1);
-  size_t actual_srh_size = (srh->hdr_ext_len * 8) + 8;
-  size_t min_packet_size = sizeof(struct rte_ether_hdr) + 
-                          sizeof(struct rte_ipv6_hdr) + 
-                          actual_srh_size + 
-                          sizeof(struct hmac_tlv) + 
-                          sizeof(struct pot_tlv);  
-
-  if (rte_pktmbuf_pkt_len(mbuf) < min_packet_size) {
-    LOG_MAIN(WARNING, "Transit: Packet too small (%u bytes) for expected headers (%zu bytes), dropping\n", 
-             rte_pktmbuf_pkt_len(mbuf), min_packet_size);
+// Completion of this node's layer on the cryptodev backend
+static void transit_crypto_done(struct rte_mbuf* mbuf, const uint8_t* digest __rte_unused, int ok) {
+  if (!ok) {
+    LOG_MAIN(ERR, "Transit: PVF decryption failed on cryptodev, dropping packet.\n");
     rte_pktmbuf_free(mbuf);
     return;
   }
+  transit_forward_packet(mbuf);
+}
 
-  switch (ether_type) {
-  case RTE_ETHER_TYPE_IPV6:
-    LOG_MAIN(DEBUG, "Transit packet is IPv6, processing headers.\n");
-
-    switch (0) {
-    case 0: {
-      LOG_MAIN(DEBUG, "Processing transit packet with SRH.\n");
+void process_transit(struct rte_mbuf** pkts, uint16_t nb_rx) {
+  // Processes the received burst in three passes: validate every packet and collect the PoT TLVs of
+  // the ones that survive, peel this node's PVF layer off all of them in one multi-buffer pass, then
+  // advance the SRH and forward each packet.
+  // LOG_MAIN(NOTICE, "Processing %u transit packets", nb_rx);
+  struct rte_mbuf* valid[BURST_SIZE];
+  const struct pot_key_epoch* epochs[BURST_SIZE];
+  uint8_t* nonces[BURST_SIZE];
+  uint8_t* pvfs[BURST_SIZE];
+  uint16_t nb_valid = 0;
+
+  // Add bounds check for g_node_index
+  if (g_node_index < 0 || g_node_index >= MAX_POT_NODES) {
+    LOG_MAIN(ERR, "Transit: Invalid g_node_index (%d), dropping %u packets\n", g_node_index, nb_rx);
+    rte_pktmbuf_free_bulk(pkts, nb_rx);
+    return;
+  }
 
-      // Get pointers to the IPv6 header and Segment Routing Header (SRH).
-      // This assumes fixed header order: Ethernet -> IPv6 -> SRH.
-      struct rte_ipv6_hdr* ipv6_hdr = (struct rte_ipv6_hdr*)(eth_hdr + 1);
-      struct ipv6_srh* srh = (struct ipv6_srh*)(ipv6_hdr + 1);
+  for (uint16_t i = 0; i < nb_rx; i++) {
+    // LOG_MAIN(DEBUG, "Processing transit packet %u with length %u", i, rte_pktmbuf_pkt_len(pkts[i]));
+    uint32_t key_set_id;
+    uint8_t* nonce;
+    uint8_t* pvf;
+    if (transit_validate_packet(pkts[i], &key_set_id, &nonce, &pvf) < 0) continue;
+
+    // The packet names the key set it was signed with, during a rotation that can be either the
+    // current or the previous one
+    const struct pot_key_epoch* epoch = keystore_find(key_set_id);
+    if (epoch == NULL || g_node_index >= epoch->nb_keys) {
+      LOG_MAIN(WARNING, "Transit: Unknown key set 0x%08x, dropping packet.\n", key_set_id);
+      rte_pktmbuf_free(pkts[i]);
+      continue;
+    }
+    epochs[nb_valid] = epoch;
+    valid[nb_valid] = pkts[i];
+    nonces[nb_valid] = nonce;
+    pvfs[nb_valid] = pvf;
+    nb_valid++;
+  }
 
-      // Add NULL pointer checks
-      if (!ipv6_hdr || !srh) {
-        LOG_MAIN(ERR, "Transit: NULL pointer detected in headers\n");
-        rte_pktmbuf_free(mbuf);
-        return;
+  if (nb_valid == 0) return;
+
+  if (g_crypto_backend == CRYPTO_BACKEND_CRYPTODEV) {
+    // Hand the layer to the cryptodev, packets are forwarded from transit_crypto_done() once the
+    // forwarding loop dequeues their ops
+    for (uint16_t i = 0; i < nb_valid; i++) {
+      struct pot_cryptodev_job job = {
+          .epoch = epochs[i],
+          .first_key = (uint8_t)g_node_index,
+          .nb_cipher = 1,
+          .pvf_offset = (uint16_t)(pvfs[i] - rte_pktmbuf_mtod(valid[i], uint8_t*)),
+          .pvf_len = g_pot_tag_len,
+          .nonce = nonces[i],
+          .hmac_input = NULL,
+          .done = transit_crypto_done,
+      };
+      if (pot_cryptodev_submit(valid[i], &job) < 0) {
+        LOG_MAIN(ERR, "Transit: Could not submit PVF decryption, dropping packet.\n");
+        rte_pktmbuf_free(valid[i]);
       }
-
-      // Verify that the SRH's next header is 61 (Destination Options Header)
-      // and its routing type is 4 (SRH). If not, the packet is not a valid SRv6 packet
-      // for this transit node, so it's dropped.
-      if (srh->next_header != 61 || srh->routing_type != 4) {
-        LOG_MAIN(WARNING, "Transit: SRH next_header (%u) or routing_type (%u) mismatch, dropping packet.\n",
-                 srh->next_header, srh->routing_type);
-        rte_pktmbuf_free(mbuf);
-        return;
+    }
+  } else {
+    // One multi-buffer pass per key set in the burst, normally a single one; during a rotation the
+    // packets of the previous key set get a pass of their own
+    uint8_t failed[POT_KEY_EPOCHS] = {0};
+    for (uint8_t slot = 0; slot < POT_KEY_EPOCHS; slot++) {
+      const struct pot_key_epoch* epoch = NULL;
+      uint8_t* slot_nonces[BURST_SIZE];
+      uint8_t* slot_pvfs[BURST_SIZE];
+      uint16_t nb_slot = 0;
+      for (uint16_t i = 0; i < nb_valid; i++) {
+        if (epochs[i]->slot != slot) continue;
+        epoch = epochs[i];
+        slot_nonces[nb_slot] = nonces[i];
+        slot_pvfs[nb_slot] = pvfs[i];
+        nb_slot++;
       }
+      if (nb_slot == 0) continue;
 
-      if (srh->next_header == 61) {
-        // size_t srh_bytes = sizeof(struct ipv6_srh);
-        size_t actual_srh_size = (srh->hdr_ext_len * 8) + 8;
-        struct in6_addr *segments = (struct in6_addr *)((uint8_t *)srh + sizeof(struct ipv6_srh));
-
-        // uint8_t* hmac_ptr = (uint8_t*)srh + srh_bytes;
-        // uint8_t* pot_ptr = hmac_ptr + sizeof(struct hmac_tlv);
-        uint8_t* hmac_ptr = (uint8_t*)srh + actual_srh_size;
-        uint8_t* pot_ptr = hmac_ptr + sizeof(struct hmac_tlv);
-
-        // Add bounds check for POT TLV access
-        if ((uint8_t*)pot_ptr + sizeof(struct pot_tlv) > 
-            (uint8_t*)rte_pktmbuf_mtod(mbuf, void*) + rte_pktmbuf_pkt_len(mbuf)) {
-          LOG_MAIN(ERR, "Transit: POT TLV extends beyond packet boundary, dropping\n");
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-        
-        struct pot_tlv* pot = (struct pot_tlv*)pot_ptr;
-        LOG_MAIN(DEBUG, "Transit: SRH detected. POT TLV address: %p\n", (void*)pot);
-
-        char dst_ip_str[INET6_ADDRSTRLEN];
-
-        if (inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)) == NULL) {
-          LOG_MAIN(ERR, "Transit: inet_ntop failed for destination address.\n");
-          perror("inet_ntop failed");
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-        LOG_MAIN(DEBUG, "Transit: Destination IPv6 address: %s\n", dst_ip_str);
-
-        uint8_t pvf_out[HMAC_MAX_LENGTH];
-
-        memcpy(pvf_out, pot->encrypted_hmac, HMAC_MAX_LENGTH);
-
-        // Add bounds check for g_node_index
-        if (g_node_index < 0 || g_node_index >= MAX_POT_NODES) {
-          LOG_MAIN(ERR, "Transit: Invalid g_node_index (%d), dropping packet\n", g_node_index);
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-
-        int curr_index = g_node_index;
-        uint8_t decrypted_once[HMAC_MAX_LENGTH];
-        int dec_len =
-            decrypt(pot->encrypted_hmac, HMAC_MAX_LENGTH, k_pot_in[curr_index], pot->nonce, decrypted_once);
-
-        if (dec_len < 0) {
-          LOG_MAIN(ERR, "Transit: PVF decryption failed for this layer.\n");
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-
-        memcpy(pot->encrypted_hmac, decrypted_once, HMAC_MAX_LENGTH);
-        LOG_MAIN(DEBUG, "Transit: Layer %d decrypted.\n", curr_index);
-
-        // Check if 'segments_left' is 0. If it is, the packet has reached
-        // its final segment in the SRH path at this node, but this is a transit node.
-        // This indicates a routing error or misconfiguration, so the packet is dropped.
-        if (srh->segments_left == 0) {
-          LOG_MAIN(WARNING, "Transit: segments_left is 0, but packet still in transit, dropping.\n");
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-
-        // Add bounds check for segments_left
-        // if (srh->segments_left > srh->last_entry) {
-        //   LOG_MAIN(ERR, "Transit: segments_left (%u) > last_entry (%u), dropping packet\n", 
-        //            srh->segments_left, srh->last_entry);
-        //   rte_pktmbuf_free(mbuf);
-        //   return;
-        // }
-
-        srh->segments_left--;
-        int next_sid_index = srh->last_entry - srh->segments_left + 1;
-
-        // Add bounds check for segment array access
-        if (next_sid_index < 0 || next_sid_index > srh->last_entry) {
-          LOG_MAIN(ERR, "Transit: Invalid next_sid_index (%d), last_entry (%u), dropping packet\n", 
-                   next_sid_index, srh->last_entry);
-          rte_pktmbuf_free(mbuf);
-          return;
-        }
-        // memcpy(&ipv6_hdr->dst_addr, &srh->segments[next_sid_index], sizeof(ipv6_hdr->dst_addr));
-        // LOG_MAIN(DEBUG, "Transit: Decremented segments_left. Next SID: %s\n",
-        //          inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
-
-        // struct rte_ether_addr* next_mac = lookup_mac_for_ipv6(&srh->segments[next_sid_index]);
-        memcpy(&ipv6_hdr->dst_addr, &segments[next_sid_index], sizeof(ipv6_hdr->dst_addr));
-        LOG_MAIN(DEBUG, "Transit: Decremented segments_left. Next SID: %s\n",
-                inet_ntop(AF_INET6, &ipv6_hdr->dst_addr, dst_ip_str, sizeof(dst_ip_str)));
-
-        struct rte_ether_addr* next_mac = lookup_mac_for_ipv6(&segments[next_sid_index]);        
-        if (next_mac) {
-          if(g_is_virtual_machine == 0) {
-          send_packet_to(*next_mac, mbuf, 1);
-          } else {
-            send_packet_to(*next_mac, mbuf, 0);
-          }
-          LOG_MAIN(DEBUG, "Transit: Packet sent to next hop with MAC: %02x:%02x:%02x:%02x:%02x:%02x\n",
-                   next_mac->addr_bytes[0], next_mac->addr_bytes[1], next_mac->addr_bytes[2],
-                   next_mac->addr_bytes[3], next_mac->addr_bytes[4], next_mac->addr_bytes[5]);
-
-          dump_len = rte_pktmbuf_pkt_len(mbuf);
-        } else {
-          LOG_MAIN(ERR, "Transit: No MAC found for next SID, dropping packet.\n");
-          rte_pktmbuf_free(mbuf);
-        }
+      if (decrypt_pvf_burst(&epoch->keys[g_node_index], slot_nonces, slot_pvfs, nb_slot, g_pot_tag_len) < 0) {
+        LOG_MAIN(ERR, "Transit: PVF decryption failed for this layer, dropping %u packets.\n", nb_slot);
+        failed[slot] = 1;
+        continue;
       }
-      break;
+      LOG_MAIN(DEBUG, "Transit: Layer %d of key set 0x%08x decrypted for %u packets.\n", g_node_index,
+               epoch->key_set_id, nb_slot);
     }
-    case 1: LOG_MAIN(DEBUG, "Transit: Bypassing all operations.\n"); break;
 
-    default:
-      LOG_MAIN(WARNING, "Transit: Unknown operation_bypass_bit value for transit processing.\n");
-      break;
+    for (uint16_t i = 0; i < nb_valid; i++) {
+      if (unlikely(failed[epochs[i]->slot]))
+        rte_pktmbuf_free(valid[i]);
+      else
+        transit_forward_packet(valid[i]);
     }
-    break;
-  default: LOG_MAIN(DEBUG, "Transit: Packet is not IPv6, not processed by transit_packet_process.\n"); break;
-  }
-}
-
-void process_transit(struct rte_mbuf** pkts, uint16_t nb_rx) {
-  // Processes each received packet in the transit queue.
-  // This function iterates over the received packets, processes each one,
-  // and logs the packet information.
-  // LOG_MAIN(NOTICE, "Processing %u transit packets", nb_rx);
-  for (uint16_t i = 0; i < nb_rx; i++) {
-    // LOG_MAIN(DEBUG, "Processing transit packet %u with length %u", i, rte_pktmbuf_pkt_len(pkts[i]));
-    process_transit_packet(pkts[i], i);
   }
 
   // Print DPDK RX/TX stats for port 0
@@ -0,0 +1,141 @@
+#include "nonce.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <rte_byteorder.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <string.h>
+
+#include "crypto.h"
+#include "utils/logging.h"
+
+static int g_nonce_mode = NONCE_MODE_DRBG;
+static uint32_t g_nonce_reseed_interval = NONCE_RESEED_DEFAULT;
+
+// Only touched by its own lcore. In DRBG mode ring holds count ready nonces starting at head; in
+// counter mode only salt and counter are used.
+struct nonce_pool {
+  EVP_CIPHER_CTX* drbg;
+  uint32_t since_reseed; // nonces produced with the current key or salt
+  uint16_t head;
+  uint16_t count;
+  uint8_t salt[8];
+  uint64_t counter;
+  uint8_t ring[NONCE_POOL_SIZE][NONCE_LENGTH];
+} __rte_cache_aligned;
+
+static struct nonce_pool* g_nonce_pools[RTE_MAX_LCORE];
+
+void nonce_pool_configure(int mode, uint32_t reseed_interval) {
+  g_nonce_mode = mode;
+  g_nonce_reseed_interval = reseed_interval > 0 ? reseed_interval : NONCE_RESEED_DEFAULT;
+  LOG_MAIN(INFO, "Nonce generator: %s mode, reseed every %u nonces\n",
+           g_nonce_mode == NONCE_MODE_COUNTER ? "counter" : "drbg", g_nonce_reseed_interval);
+}
+
+// Draws a fresh DRBG key and IV, or a fresh salt, from the OpenSSL CSPRNG
+static int nonce_pool_reseed(struct nonce_pool* pool) {
+  if (g_nonce_mode == NONCE_MODE_COUNTER) {
+    if (RAND_bytes(pool->salt, sizeof(pool->salt)) != 1) return -1;
+    pool->counter = 0;
+  } else {
+    uint8_t seed[32 + 16];
+    int ok = RAND_bytes(seed, sizeof(seed)) == 1 &&
+             EVP_EncryptInit_ex(pool->drbg, EVP_aes_256_ctr(), NULL, seed, seed + 32) == 1;
+    OPENSSL_cleanse(seed, sizeof(seed));
+    if (!ok) return -1;
+  }
+  pool->since_reseed = 0;
+  return 0;
+}
+
+static struct nonce_pool* get_lcore_nonce_pool(void) {
+  unsigned lcore_id = rte_lcore_id();
+  if (lcore_id >= RTE_MAX_LCORE) return NULL;
+
+  struct nonce_pool* pool = g_nonce_pools[lcore_id];
+  if (likely(pool != NULL)) return pool;
+
+  pool = rte_zmalloc_socket("nonce_pool", sizeof(*pool), RTE_CACHE_LINE_SIZE, rte_lcore_to_socket_id(lcore_id));
+  if (pool == NULL) {
+    LOG_MAIN(ERR, "Failed to allocate nonce pool for lcore %u\n", lcore_id);
+    return NULL;
+  }
+  if ((pool->drbg = EVP_CIPHER_CTX_new()) == NULL || nonce_pool_reseed(pool) < 0) {
+    LOG_MAIN(ERR, "Failed to seed nonce pool for lcore %u\n", lcore_id);
+    EVP_CIPHER_CTX_free(pool->drbg);
+    rte_free(pool);
+    return NULL;
+  }
+  g_nonce_pools[lcore_id] = pool;
+  return pool;
+}
+
+// Fills the free slots of the ring with DRBG output, re-keying first when the interval is used up
+static int nonce_pool_refill(struct nonce_pool* pool) {
+  static const uint8_t zeros[NONCE_POOL_SIZE * NONCE_LENGTH];
+
+  uint32_t room = NONCE_POOL_SIZE - pool->count;
+  if (room == 0) return 0;
+
+  // Re-key once the interval is used up, and never produce past it with the current key
+  if (pool->since_reseed >= g_nonce_reseed_interval && nonce_pool_reseed(pool) < 0) return -1;
+  room = RTE_MIN(room, g_nonce_reseed_interval - pool->since_reseed);
+
+  // The free slots are at most two contiguous runs of the ring
+  uint16_t tail = (pool->head + pool->count) % NONCE_POOL_SIZE;
+  uint32_t first = RTE_MIN(room, (uint32_t)(NONCE_POOL_SIZE - tail));
+  int len;
+  if (EVP_EncryptUpdate(pool->drbg, pool->ring[tail], &len, zeros, first * NONCE_LENGTH) != 1) return -1;
+  if (room > first &&
+      EVP_EncryptUpdate(pool->drbg, pool->ring[0], &len, zeros, (room - first) * NONCE_LENGTH) != 1)
+    return -1;
+
+  pool->count += room;
+  pool->since_reseed += room;
+  return 0;
+}
+
+int nonce_pool_next(uint8_t nonce[NONCE_LENGTH]) {
+  struct nonce_pool* pool = get_lcore_nonce_pool();
+  if (unlikely(pool == NULL)) return RAND_bytes(nonce, NONCE_LENGTH) == 1 ? 0 : -1;
+
+  if (g_nonce_mode == NONCE_MODE_COUNTER) {
+    if (unlikely(pool->since_reseed >= g_nonce_reseed_interval) && nonce_pool_reseed(pool) < 0) return -1;
+    // The PVF spans two AES blocks, so CTR also consumes nonce + 1. Stepping the counter by two
+    // keeps the keystream blocks of consecutive packets from overlapping.
+    uint64_t counter = rte_cpu_to_be_64(pool->counter);
+    memcpy(nonce, pool->salt, sizeof(pool->salt));
+    memcpy(nonce + sizeof(pool->salt), &counter, sizeof(counter));
+    pool->counter += 2;
+    pool->since_reseed++;
+    return 0;
+  }
+
+  if (unlikely(pool->count == 0) && nonce_pool_refill(pool) < 0) {
+    LOG_MAIN(ERR, "Nonce pool refill failed on lcore %u\n", rte_lcore_id());
+    return -1;
+  }
+  memcpy(nonce, pool->ring[pool->head], NONCE_LENGTH);
+  pool->head = (pool->head + 1) % NONCE_POOL_SIZE;
+  pool->count--;
+  return 0;
+}
+
+void nonce_pool_fill(void) {
+  if (g_nonce_mode != NONCE_MODE_DRBG) return;
+  struct nonce_pool* pool = get_lcore_nonce_pool();
+  if (pool != NULL && pool->count < NONCE_POOL_SIZE) nonce_pool_refill(pool);
+}
+
+void nonce_pool_free(void) {
+  for (unsigned lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+    struct nonce_pool* pool = g_nonce_pools[lcore_id];
+    if (pool == NULL) continue;
+    EVP_CIPHER_CTX_free(pool->drbg);
+    OPENSSL_cleanse(pool, sizeof(*pool));
+    rte_free(pool);
+    g_nonce_pools[lcore_id] = NULL;
+  }
+}
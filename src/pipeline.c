@@ -0,0 +1,315 @@
+#include "pipeline.h"
+
+#include <errno.h>
+#include <rte_errno.h>
+#include <rte_ethdev.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_reorder.h>
+#include <rte_ring.h>
+#include <stdio.h>
+
+#include "forward.h"
+#include "headers.h"
+#include "keystore.h"
+#include "nonce.h"
+#include "utils/logging.h"
+#include "utils/role.h"
+
+int g_pipeline_workers = 0;
+
+// One crypto worker. seqns and sent describe the packets of the burst its handler is working on,
+// staged holds what the handler sent until it goes to the TX lcore. Only the owning lcore touches
+// it; rx_ring has the RX lcore as its only producer, tx_ring the TX lcore as its only consumer.
+struct pipeline_worker {
+  struct rte_ring* rx_ring;
+  struct rte_ring* tx_ring;
+  uint16_t nb_in;
+  uint16_t nb_staged;
+  uint32_t seqn_base; // number of the burst's first packet, the others follow it in ascending order
+  uint32_t seqns[BURST_SIZE];
+  uint8_t sent[BURST_SIZE];
+  struct rte_mbuf* staged[BURST_SIZE];
+} __rte_cache_aligned;
+
+static struct {
+  struct pipeline_worker* workers[PIPELINE_MAX_WORKERS];
+  struct rte_reorder_buffer* reorder;
+  uint16_t rx_port;
+} g_pipeline;
+
+// The worker running on each lcore, NULL on every other one
+static struct pipeline_worker* g_lcore_workers[RTE_MAX_LCORE];
+
+int pipeline_init(unsigned nb_workers) {
+  if (nb_workers == 0 || nb_workers > PIPELINE_MAX_WORKERS) {
+    LOG_MAIN(ERR, "Pipeline needs 1 to %u workers, got %u\n", PIPELINE_MAX_WORKERS, nb_workers);
+    return -1;
+  }
+  if (rte_lcore_count() < nb_workers + 3) {
+    LOG_MAIN(ERR, "Pipeline with %u workers needs %u lcores, the main lcore, RX, TX and the workers, "
+             "only %u are enabled\n", nb_workers, nb_workers + 3, rte_lcore_count());
+    return -1;
+  }
+
+  // Registers the sequence number dynfield the RX lcore writes, too
+  int socket_id = rte_socket_id();
+  g_pipeline.reorder = rte_reorder_create("POT_REORDER", socket_id, PIPELINE_REORDER_SIZE);
+  if (g_pipeline.reorder == NULL) {
+    LOG_MAIN(ERR, "Failed to create the reorder buffer: %s\n", rte_strerror(rte_errno));
+    return -1;
+  }
+
+  for (unsigned i = 0; i < nb_workers; i++) {
+    char name[RTE_RING_NAMESIZE];
+    struct pipeline_worker* w =
+        rte_zmalloc_socket("pipeline_worker", sizeof(*w), RTE_CACHE_LINE_SIZE, socket_id);
+    if (w == NULL) {
+      LOG_MAIN(ERR, "Failed to allocate pipeline worker %u\n", i);
+      pipeline_free();
+      return -1;
+    }
+    g_pipeline.workers[i] = w;
+    snprintf(name, sizeof(name), "POT_PIPE_RX_%u", i);
+    w->rx_ring = rte_ring_create(name, PIPELINE_RING_SIZE, socket_id, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    snprintf(name, sizeof(name), "POT_PIPE_TX_%u", i);
+    w->tx_ring = rte_ring_create(name, PIPELINE_RING_SIZE, socket_id, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (w->rx_ring == NULL || w->tx_ring == NULL) {
+      LOG_MAIN(ERR, "Failed to create the rings of pipeline worker %u: %s\n", i, rte_strerror(rte_errno));
+      pipeline_free();
+      return -1;
+    }
+  }
+  g_pipeline_workers = (int)nb_workers;
+  LOG_MAIN(INFO, "Pipeline: RX lcore, %u crypto workers, TX lcore reordering up to %u packets\n", nb_workers,
+           PIPELINE_REORDER_SIZE);
+  return 0;
+}
+
+void pipeline_free(void) {
+  for (unsigned i = 0; i < PIPELINE_MAX_WORKERS; i++) {
+    struct pipeline_worker* w = g_pipeline.workers[i];
+    if (w == NULL) continue;
+    rte_ring_free(w->rx_ring);
+    rte_ring_free(w->tx_ring);
+    rte_free(w);
+    g_pipeline.workers[i] = NULL;
+  }
+  if (g_pipeline.reorder != NULL) rte_reorder_free(g_pipeline.reorder);
+  g_pipeline.reorder = NULL;
+  g_pipeline_workers = 0;
+}
+
+unsigned pipeline_mbufs_needed(void) {
+  return g_pipeline_workers > 0
+             ? (unsigned)g_pipeline_workers * (2 * PIPELINE_RING_SIZE + BURST_SIZE) + PIPELINE_REORDER_SIZE
+             : 0;
+}
+
+// Hands what the handler sent to the TX lcore. A full ring means TX is behind, the worker waits for it
+// rather than drop packets the crypto was already spent on.
+static void worker_flush(struct pipeline_worker* w) {
+  unsigned done = 0;
+  while (done < w->nb_staged) {
+    done += rte_ring_enqueue_burst(w->tx_ring, (void* const*)w->staged + done, w->nb_staged - done, NULL);
+    if (done < w->nb_staged) rte_pause();
+  }
+  w->nb_staged = 0;
+}
+
+static inline void worker_stage(struct pipeline_worker* w, struct rte_mbuf* mbuf) {
+  if (unlikely(w->nb_staged == BURST_SIZE)) worker_flush(w);
+  w->staged[w->nb_staged++] = mbuf;
+}
+
+// Finds the packet among the burst's ascending sequence numbers and notes it was sent
+static void worker_mark_sent(struct pipeline_worker* w, uint32_t seqn) {
+  uint32_t off = seqn - w->seqn_base;
+  uint16_t lo = 0, hi = w->nb_in;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (w->seqns[mid] - w->seqn_base < off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < w->nb_in && w->seqns[lo] == seqn) w->sent[lo] = 1;
+}
+
+int pipeline_tx_stage(struct rte_mbuf* mbuf, uint16_t tx_port_id) {
+  unsigned lcore_id = rte_lcore_id();
+  struct pipeline_worker* w = lcore_id < RTE_MAX_LCORE ? g_lcore_workers[lcore_id] : NULL;
+  if (w == NULL) return 0;
+
+  // The TX lcore reads the port back from the mbuf, nothing past RX looks at the input port
+  mbuf->port = tx_port_id;
+  worker_mark_sent(w, *rte_reorder_seqn(mbuf));
+  worker_stage(w, mbuf);
+  return 1;
+}
+
+// Every packet of the burst the handler did not send would hold the reorder buffer up, an empty mbuf
+// with its number and no port takes its place
+static void worker_fill_gaps(struct pipeline_worker* w, struct rte_mempool* pool) {
+  for (uint16_t i = 0; i < w->nb_in; i++) {
+    if (w->sent[i]) continue;
+    struct rte_mbuf* gap = rte_pktmbuf_alloc(pool);
+    if (unlikely(gap == NULL)) {
+      LOG_MAIN(WARNING, "No mbuf for the gap of packet %u, TX holds later packets until its buffer fills\n",
+               w->seqns[i]);
+      continue;
+    }
+    gap->port = RTE_MBUF_PORT_INVALID;
+    *rte_reorder_seqn(gap) = w->seqns[i];
+    worker_stage(w, gap);
+  }
+}
+
+static int pipeline_worker_main(void* arg) {
+  struct pipeline_worker* w = arg;
+  enum role cur_role = global_role;
+  uint16_t rx_port_id = g_pipeline.rx_port;
+  LOG_MAIN(INFO, "Pipeline worker started on lcore %u\n", rte_lcore_id());
+  keystore_reader_register();
+
+  while (1) {
+    keystore_quiescent();
+    struct rte_mbuf* pkts[BURST_SIZE];
+    uint16_t nb = (uint16_t)rte_ring_dequeue_burst(w->rx_ring, (void**)pkts, BURST_SIZE, NULL);
+    if (nb == 0) {
+      // Ingress tops its nonce ring up while idle so refills stay off the packet path
+      if (cur_role == ROLE_INGRESS) nonce_pool_fill();
+      rte_pause();
+      continue;
+    }
+
+    // The handler may free any of them, what is needed for the gaps is read before
+    struct rte_mempool* pool = pkts[0]->pool;
+    w->seqn_base = *rte_reorder_seqn(pkts[0]);
+    for (uint16_t i = 0; i < nb; i++) {
+      w->seqns[i] = *rte_reorder_seqn(pkts[i]);
+      w->sent[i] = 0;
+    }
+    w->nb_in = nb;
+
+    forward_burst(cur_role, pkts, nb, rx_port_id);
+    worker_fill_gaps(w, pool);
+    w->nb_in = 0;
+    worker_flush(w);
+  }
+  return 0;
+}
+
+static int pipeline_rx_main(void* arg) {
+  (void)arg;
+  uint16_t rx_port_id = g_pipeline.rx_port;
+  enum role cur_role = global_role;
+  unsigned nb_workers = (unsigned)g_pipeline_workers;
+  unsigned next = 0;
+  uint32_t seqn = 0;
+  LOG_MAIN(INFO, "Pipeline RX started on lcore %u, port %u\n", rte_lcore_id(), rx_port_id);
+
+  while (1) {
+    struct rte_mbuf* pkts[BURST_SIZE];
+    uint16_t nb_rx = rte_eth_rx_burst(rx_port_id, 0, pkts, BURST_SIZE);
+    if (nb_rx == 0) {
+      rte_pause();
+      continue;
+    }
+
+    // As in the run-to-completion loop, non-PoT packets are dropped and the headers found here
+    if (cur_role == ROLE_TRANSIT || cur_role == ROLE_EGRESS) nb_rx = parse_pot_burst(pkts, nb_rx);
+    if (nb_rx == 0) continue;
+
+    for (uint16_t i = 0; i < nb_rx; i++) *rte_reorder_seqn(pkts[i]) = seqn + i;
+
+    // Round-robin over the workers, a burst goes to the next one whose ring has room for all of it
+    unsigned tries;
+    for (tries = 0; tries < nb_workers; tries++) {
+      struct rte_ring* ring = g_pipeline.workers[next]->rx_ring;
+      next = next + 1 == nb_workers ? 0 : next + 1;
+      if (rte_ring_enqueue_bulk(ring, (void* const*)pkts, nb_rx, NULL) == nb_rx) break;
+    }
+    if (unlikely(tries == nb_workers)) {
+      // The numbers are handed out again, so dropping here leaves no gap
+      LOG_MAIN(DEBUG, "All pipeline workers busy, dropped a burst of %u packets\n", nb_rx);
+      rte_pktmbuf_free_bulk(pkts, nb_rx);
+      continue;
+    }
+    seqn += nb_rx;
+  }
+  return 0;
+}
+
+static inline void pipeline_tx_send(struct rte_mbuf* mbuf) {
+  if (unlikely(mbuf->port == RTE_MBUF_PORT_INVALID))
+    rte_pktmbuf_free(mbuf); // stands in for a packet a worker dropped
+  else
+    tx_buffer_packet(mbuf, mbuf->port);
+}
+
+static void pipeline_tx_drain(struct rte_reorder_buffer* reorder) {
+  struct rte_mbuf* out[BURST_SIZE];
+  unsigned nb;
+  while ((nb = rte_reorder_drain(reorder, out, BURST_SIZE)) > 0)
+    for (unsigned i = 0; i < nb; i++) pipeline_tx_send(out[i]);
+}
+
+static int pipeline_tx_main(void* arg) {
+  (void)arg;
+  struct rte_reorder_buffer* reorder = g_pipeline.reorder;
+  unsigned nb_workers = (unsigned)g_pipeline_workers;
+  LOG_MAIN(INFO, "Pipeline TX started on lcore %u\n", rte_lcore_id());
+
+  while (1) {
+    for (unsigned w = 0; w < nb_workers; w++) {
+      struct rte_mbuf* pkts[BURST_SIZE];
+      unsigned nb = rte_ring_dequeue_burst(g_pipeline.workers[w]->tx_ring, (void**)pkts, BURST_SIZE, NULL);
+      for (unsigned i = 0; i < nb; i++) {
+        if (rte_reorder_insert(reorder, pkts[i]) == 0) continue;
+        // No room: what is in order goes out first, then it is tried once more
+        if (rte_errno == ENOSPC) {
+          pipeline_tx_drain(reorder);
+          if (rte_reorder_insert(reorder, pkts[i]) == 0) continue;
+        }
+        // Older than what the buffer already let out, or still no room: it is sent as it is
+        LOG_MAIN(DEBUG, "Packet %u could not be reordered, sent out of order\n", *rte_reorder_seqn(pkts[i]));
+        pipeline_tx_send(pkts[i]);
+      }
+    }
+    pipeline_tx_drain(reorder);
+    tx_buffers_flush();
+  }
+  return 0;
+}
+
+void pipeline_launch(uint16_t* ports) {
+  unsigned nb_workers = (unsigned)g_pipeline_workers;
+  unsigned lcores[PIPELINE_MAX_WORKERS + 2];
+  unsigned nb_lcores = 0, lcore_id;
+  RTE_LCORE_FOREACH_WORKER(lcore_id) {
+    if (nb_lcores == nb_workers + 2) break;
+    lcores[nb_lcores++] = lcore_id;
+  }
+  if (nb_lcores < nb_workers + 2) {
+    LOG_MAIN(ERR, "Pipeline needs %u worker lcores, found %u\n", nb_workers + 2, nb_lcores);
+    return;
+  }
+  g_pipeline.rx_port = ports[0];
+
+  // TX and the workers come up before RX hands them anything: lcores[0] is RX, the last one TX
+  unsigned tx_lcore = lcores[nb_workers + 1];
+  if (rte_eal_remote_launch(pipeline_tx_main, NULL, tx_lcore) < 0)
+    LOG_MAIN(ERR, "Failed to launch pipeline TX on lcore %u\n", tx_lcore);
+  for (unsigned i = 0; i < nb_workers; i++) {
+    g_lcore_workers[lcores[i + 1]] = g_pipeline.workers[i];
+    if (rte_eal_remote_launch(pipeline_worker_main, g_pipeline.workers[i], lcores[i + 1]) < 0)
+      LOG_MAIN(ERR, "Failed to launch pipeline worker %u on lcore %u\n", i, lcores[i + 1]);
+  }
+  if (rte_eal_remote_launch(pipeline_rx_main, NULL, lcores[0]) < 0)
+    LOG_MAIN(ERR, "Failed to launch pipeline RX on lcore %u\n", lcores[0]);
+
+  LOG_MAIN(INFO, "Waiting for all lcores to complete\n");
+  rte_eal_mp_wait_lcore();
+  LOG_MAIN(INFO, "All lcores completed\n");
+}
@@ -1,10 +1,36 @@
 #include "port.h"
 #include "utils/logging.h"
+#include <errno.h>
+#include <inttypes.h>
 #include <rte_ethdev.h>
+#include <rte_lcore.h>
+
+// Cleared as soon as one port cannot transmit chained mbufs
+int g_tx_multi_seg = 1;
+struct rte_ether_addr g_port_mac[RTE_MAX_ETHPORTS];
+uint16_t g_nb_queues = 1;
+
+uint16_t port_queues_configure(unsigned nb_pollers) {
+  uint16_t nb_queues = (uint16_t)RTE_MIN(RTE_MAX(nb_pollers, 1u), (unsigned)UINT16_MAX);
+
+  // Every port gets the same number, a queue index is an lcore's own on whichever port it sends
+  uint16_t nb_ports = rte_eth_dev_count_avail();
+  for (uint16_t port = 0; port < nb_ports; port++) {
+    struct rte_eth_dev_info dev_info;
+    if (rte_eth_dev_info_get(port, &dev_info) != 0) continue;
+    nb_queues = RTE_MIN(nb_queues, RTE_MIN(dev_info.max_rx_queues, dev_info.max_tx_queues));
+  }
+  g_nb_queues = nb_queues > 0 ? nb_queues : 1;
+  if (g_nb_queues < nb_pollers)
+    LOG_MAIN(WARNING, "Ports support %u queue pairs, %u of the %u forwarding lcores stay idle\n", g_nb_queues,
+             nb_pollers - g_nb_queues, nb_pollers);
+  LOG_MAIN(INFO, "Using %u RX/TX queue pair(s) per port\n", g_nb_queues);
+  return g_nb_queues;
+}
 
 int setup_port(uint16_t port, struct rte_mempool* mbuf_pool) {
   struct rte_eth_conf port_conf = {0};
-  const uint16_t rx_rings = 1, tx_rings = 1;
+  const uint16_t rx_rings = g_nb_queues, tx_rings = g_nb_queues;
   uint16_t nb_rxd = RX_RING_SIZE;
   uint16_t nb_txd = TX_RING_SIZE;
   int retval;
@@ -38,7 +64,7 @@ int setup_port(uint16_t port, struct rte_mempool* mbuf_pool) {
   retval = start_port(port, rx_rings);
   LOG_AND_RETURN_ON_ERROR(retval, "Failed to start port %u\n", port);
 
-  // Step 7: Log the MAC address for verification.
+  // Step 7: Cache the MAC address for the TX path and log it for verification.
   retval = log_port_mac_address(port);
   LOG_AND_RETURN_ON_ERROR(retval, "Failed to get MAC for port %u\n", port);
 
@@ -56,6 +82,33 @@ int configure_device(uint16_t port, struct rte_eth_conf* port_conf) {
   if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE) {
     port_conf->txmode.offloads |= RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
   }
+
+  // Chained mbufs: jumbo frames are received across several mbufs, and add_custom_header() puts the
+  // SRH in a header mbuf of its own when the packet has no room left for it
+  if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MULTI_SEGS) {
+    port_conf->txmode.offloads |= RTE_ETH_TX_OFFLOAD_MULTI_SEGS;
+  } else {
+    g_tx_multi_seg = 0;
+    LOG_MAIN(INFO, "Port %u cannot transmit chained mbufs, SRH insertion stays in place\n", port);
+  }
+  if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_SCATTER) {
+    port_conf->rxmode.offloads |= RTE_ETH_RX_OFFLOAD_SCATTER;
+  }
+
+  // With several queues RSS keeps every flow on one of them, and so on one lcore. PoT packets hash
+  // as "other" IPv6 on the addresses alone, the NIC does not look past the SRH or Hop-by-Hop header.
+  if (g_nb_queues > 1) {
+    uint64_t rss_hf = PORT_RSS_HF & dev_info.flow_type_rss_offloads;
+    if (rss_hf == 0) {
+      LOG_MAIN(ERR, "Port %u cannot hash IPv6 packets over %u queues\n", port, g_nb_queues);
+      return -ENOTSUP;
+    }
+    if (rss_hf != PORT_RSS_HF)
+      LOG_MAIN(INFO, "Port %u hashes IPv6 on a subset of the flow types: 0x%" PRIx64 "\n", port, rss_hf);
+    port_conf->rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+    port_conf->rx_adv_conf.rss_conf.rss_key = NULL; // the driver's default key
+    port_conf->rx_adv_conf.rss_conf.rss_hf = rss_hf;
+  }
   return 0;
 }
 
@@ -124,6 +177,8 @@ int log_port_mac_address(uint16_t port) {
     return retval;
   }
 
+  rte_ether_addr_copy(&addr, &g_port_mac[port]);
+
   char mac_str[RTE_ETHER_ADDR_FMT_SIZE];
   rte_ether_format_addr(mac_str, sizeof(mac_str), &addr);
   LOG_MAIN(INFO, "Port %u MAC: %s\n", port, mac_str);
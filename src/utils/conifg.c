@@ -12,12 +12,17 @@
 #include <string.h>
 #include <sys/socket.h>
 
+#include "mac.h"
+#include "nonce.h"
 #include "utils/config.h"
 #include "utils/logging.h"
 
 // Global variable to indicate if running in a virtual machine
 int g_is_virtual_machine = 0; 
 
+// Global variable holding the selected crypto backend (enum crypto_backend)
+int g_crypto_backend = CRYPTO_BACKEND_EVP;
+
 void config_init(AppConfig* config) {
   config->node.log_level = NULL;
   config->node.type = NULL;
@@ -27,6 +32,16 @@ void config_init(AppConfig* config) {
   // Sayısal değerleri sıfırla
   config->topology.num_transit = 0;
   config->virtual_machine = 0;     // Default: not running in a VM
+  config->crypto_backend = CRYPTO_BACKEND_EVP; // Default: OpenSSL EVP crypto
+  config->nonce_mode = NONCE_MODE_DRBG;        // Default: random nonces from the per-lcore DRBG
+  config->nonce_reseed = NONCE_RESEED_DEFAULT;
+  config->mac_alg = POT_MAC_HMAC_SHA256;       // Default: HMAC-SHA256 path authenticator
+  config->csid_block_len = 0;                  // Default: uncompressed SIDs
+  config->tag_len = HMAC_MAX_LENGTH;           // Default: untruncated 32-byte tags
+  config->srv6_encap = 0;                      // Default: SRH insertion
+  config->pot_carrier = POT_CARRIER_SRH;       // Default: PoT data in the SRH TLVs
+  config->pipeline_workers = 0;                // Default: run to completion, one lcore per queue
+  config->eventdev_workers = 0;                // Default: no event scheduling
   config->follow_flag = 0;         // Default: do not follow log
 }
 
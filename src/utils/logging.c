@@ -3,7 +3,11 @@
 #include "utils/role.h"
 #include "headers.h"         // Add this for g_segments, g_segment_count, next_hops, etc.
 #include "crypto.h"          // Add this for g_key_count
+#include "eventdev.h"
+#include "mac.h"
+#include "nonce.h"
 #include "node/controller.h" // Add this for g_node_index
+#include "port.h"
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -61,6 +65,25 @@ void print_system_info(AppConfig* config) {
   printf("Topology segment list: %s\n", config->topology.segment_list ? config->topology.segment_list : "N/A");
   printf("Topology key locations: %s\n", config->topology.key_locations ? config->topology.key_locations : "N/A");
   printf("Number of transit nodes: %d\n", config->topology.num_transit);
+  printf("Crypto backend: %s\n", config->crypto_backend == CRYPTO_BACKEND_CRYPTODEV ? "cryptodev" : "evp");
+  printf("Nonce mode: %s, reseed every %u nonces\n", config->nonce_mode == NONCE_MODE_COUNTER ? "counter" : "drbg",
+         config->nonce_reseed);
+  printf("MAC algorithm: %s\n", g_pot_mac->name);
+  printf("Tag length: %d bytes%s\n", config->tag_len,
+         config->tag_len > g_pot_mac->tag_len ? ", the bytes past the MAC's own tag are zero padding" : "");
+  if (config->csid_block_len > 0)
+    printf("Compressed SIDs: /%d block, %d uSIDs per container\n", config->csid_block_len,
+           (128 - config->csid_block_len) / POT_CSID_USID_LEN);
+  else
+    printf("Compressed SIDs: disabled\n");
+  printf("SRv6 mode: %s\n", config->srv6_encap ? "encap (H.Encaps)" : "insert");
+  printf("PoT carrier: %s\n", config->pot_carrier == POT_CARRIER_IOAM ? "IOAM Hop-by-Hop option" : "SRH TLVs");
+  if (config->pipeline_workers > 0)
+    printf("Forwarding: pipeline, RX lcore, %d crypto workers, reordering TX lcore\n", config->pipeline_workers);
+  else if (config->eventdev_workers > 0)
+    printf("Forwarding: eventdev %s, RX lcore, %d workers, TX lcore\n", POT_EVDEV_NAME, config->eventdev_workers);
+  else
+    printf("Forwarding: run to completion, %u RX/TX queue pair(s) per port\n", g_nb_queues);
   printf("==== End Application Configuration ====\n\n");
 
   printf("==== Environment Variables ====\n");
@@ -80,8 +103,11 @@ void print_system_info(AppConfig* config) {
   printf("Operation bypass bit: %d\n", operation_bypass_bit);
   printf("Loaded SRH segments: %d\n", g_segment_count);
   printf("Loaded POT keys: %d\n", g_key_count);
+  const struct pot_key_epoch* epoch = keystore_current();
+  printf("Current key set ID: 0x%08x\n", epoch != NULL ? epoch->key_set_id : 0);
   printf("Next hop entries: %d\n", next_hop_count);
   printf("TSC dynfield offset: %d\n", tsc_dynfield_offset);
+  printf("PoT metadata dynfield offset: %d\n", pot_meta_dynfield_offset);
   printf("==== End Runtime Information ====\n\n");
 
   printf("==== Memory Information ====\n");
@@ -2,8 +2,15 @@
 #include "headers.h"
 #include "utils/role.h"
 
+#include <rte_ethdev.h>
+#include <rte_malloc.h>
+#include <rte_spinlock.h>
 #include <stdlib.h>
 
+#include "mac.h"
+#include "nonce.h"
+#include "eventdev.h"
+#include "pipeline.h"
 #include "utils/config.h"
 #include "node/controller.h"
 #include "utils/logging.h"
@@ -40,6 +47,16 @@ void parse_args(AppConfig* config, int argc, char* argv[]) {
       {"no-logging", no_argument, 0, 1},
       {"help", no_argument, 0, 'h'},
       {"virtual-machine", no_argument, 0, 'v'},
+      {"crypto-backend", required_argument, 0, 2},
+      {"nonce-mode", required_argument, 0, 3},
+      {"nonce-reseed", required_argument, 0, 4},
+      {"mac-alg", required_argument, 0, 5},
+      {"csid-block", required_argument, 0, 6},
+      {"tag-len", required_argument, 0, 7},
+      {"srv6-mode", required_argument, 0, 8},
+      {"carrier", required_argument, 0, 9},
+      {"pipeline", required_argument, 0, 10},
+      {"eventdev", required_argument, 0, 11},
       {0, 0, 0, 0} // Dizi sonunu belirtir
   };
 
@@ -88,6 +105,115 @@ void parse_args(AppConfig* config, int argc, char* argv[]) {
       g_logging_enabled = 0;
       break;
 
+    case 2: // --crypto-backend
+      if (strcmp(optarg, "evp") == 0) {
+        config->crypto_backend = CRYPTO_BACKEND_EVP;
+      } else if (strcmp(optarg, "cryptodev") == 0) {
+        config->crypto_backend = CRYPTO_BACKEND_CRYPTODEV;
+      } else {
+        fprintf(stderr, "Invalid crypto backend: %s (expected 'evp' or 'cryptodev')\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      g_crypto_backend = config->crypto_backend;
+      break;
+
+    case 3: // --nonce-mode
+      if (strcmp(optarg, "drbg") == 0) {
+        config->nonce_mode = NONCE_MODE_DRBG;
+      } else if (strcmp(optarg, "counter") == 0) {
+        config->nonce_mode = NONCE_MODE_COUNTER;
+      } else {
+        fprintf(stderr, "Invalid nonce mode: %s (expected 'drbg' or 'counter')\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 4: // --nonce-reseed
+      if (atoi(optarg) <= 0) {
+        fprintf(stderr, "Invalid nonce reseed interval: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      config->nonce_reseed = (unsigned)atoi(optarg);
+      break;
+
+    case 5: // --mac-alg
+      config->mac_alg = pot_mac_parse(optarg);
+      if (config->mac_alg < 0) {
+        fprintf(stderr, "Invalid MAC algorithm: %s (expected 'hmac-sha256', 'aes-cmac', 'aes-gmac' or 'poly1305')\n",
+                optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+
+    case 6: { // --csid-block
+      int bits = atoi(optarg);
+      if (bits < POT_CSID_BLOCK_MIN || bits > POT_CSID_BLOCK_MAX || bits % POT_CSID_USID_LEN != 0) {
+        fprintf(stderr, "Invalid C-SID block length: %s (expected a multiple of %d from %d to %d)\n", optarg,
+                POT_CSID_USID_LEN, POT_CSID_BLOCK_MIN, POT_CSID_BLOCK_MAX);
+        exit(EXIT_FAILURE);
+      }
+      config->csid_block_len = bits;
+      g_csid_block_len = bits;
+      break;
+    }
+
+    case 7: { // --tag-len
+      int len = atoi(optarg);
+      if (!POT_TAG_LEN_VALID(len)) {
+        fprintf(stderr, "Invalid tag length: %s (expected 8, 16, 24 or 32)\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      config->tag_len = len;
+      g_pot_tag_len = (uint8_t)len;
+      break;
+    }
+
+    case 8: // --srv6-mode
+      if (strcmp(optarg, "insert") == 0) {
+        config->srv6_encap = 0;
+      } else if (strcmp(optarg, "encap") == 0) {
+        config->srv6_encap = 1;
+      } else {
+        fprintf(stderr, "Invalid SRv6 mode: %s (expected 'insert' or 'encap')\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      g_srv6_encap = config->srv6_encap;
+      break;
+
+    case 9: // --carrier
+      if (strcmp(optarg, "srh") == 0) {
+        config->pot_carrier = POT_CARRIER_SRH;
+      } else if (strcmp(optarg, "ioam") == 0) {
+        config->pot_carrier = POT_CARRIER_IOAM;
+      } else {
+        fprintf(stderr, "Invalid PoT carrier: %s (expected 'srh' or 'ioam')\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      g_pot_carrier = config->pot_carrier;
+      break;
+
+    case 10: { // --pipeline
+      int workers = atoi(optarg);
+      if (workers < 1 || workers > PIPELINE_MAX_WORKERS) {
+        fprintf(stderr, "Invalid number of pipeline workers: %s (expected 1 to %d)\n", optarg,
+                PIPELINE_MAX_WORKERS);
+        exit(EXIT_FAILURE);
+      }
+      config->pipeline_workers = workers;
+      break;
+    }
+
+    case 11: { // --eventdev
+      int workers = atoi(optarg);
+      if (workers < 1 || workers > POT_EVDEV_MAX_WORKERS) {
+        fprintf(stderr, "Invalid number of eventdev workers: %s (expected 1 to %d)\n", optarg,
+                POT_EVDEV_MAX_WORKERS);
+        exit(EXIT_FAILURE);
+      }
+      config->eventdev_workers = workers;
+      break;
+    }
+
     case 'i': // --node-index veya -i
       g_node_index = atoi(optarg);
       if (g_node_index < 0) {
@@ -110,6 +236,35 @@ void parse_args(AppConfig* config, int argc, char* argv[]) {
       printf("  -s, --segment-list <path>     Specify the segment list file.\n");
       printf("  -k, --key-locations <path>    Specify the key locations file.\n");
       printf("  -n, --num-transit <number>    Set the number of transit nodes.\n\n");
+      printf("Crypto Options:\n");
+      printf("  --crypto-backend <evp|cryptodev>  Run PoT crypto on OpenSSL EVP (default) or on the\n");
+      printf("                                    first rte_cryptodev, e.g. --vdev crypto_aesni_mb.\n");
+      printf("  --nonce-mode <drbg|counter>       Random nonces from a per-lcore AES-CTR DRBG (default) or\n");
+      printf("                                    a per-lcore random salt followed by a counter.\n");
+      printf("  --nonce-reseed <n>                Nonces per lcore between two reseeds (default %u).\n",
+             NONCE_RESEED_DEFAULT);
+      printf("  --mac-alg <alg>                   Path MAC: hmac-sha256 (default), aes-cmac, aes-gmac or\n");
+      printf("                                    poly1305. Ingress and egress must use the same one.\n");
+      printf("  --tag-len <8|16|24|32>            Bytes of the HMAC and PVF carried per packet (default 32).\n");
+      printf("                                    Every node must use the same value.\n\n");
+      printf("Segment Routing Options:\n");
+      printf("  --csid-block <bits>               Carry the segment list as compressed SIDs (uSID) under a\n");
+      printf("                                    locator block of this many bits, e.g. 48 for SIDs like\n");
+      printf("                                    2001:db8:1:d1::. Every node must use the same value.\n");
+      printf("  --srv6-mode <insert|encap>        Insert the SRH into the packet (default) or encapsulate it\n");
+      printf("                                    in an outer IPv6 header (H.Encaps). Only the ingress needs\n");
+      printf("                                    it, the egress decapsulates whatever it receives.\n");
+      printf("  --carrier <srh|ioam>              Carry the PoT data in the SRH TLVs (default) or in an IOAM\n");
+      printf("                                    Hop-by-Hop option without segment list, forwarded on the\n");
+      printf("                                    destination. Every node must use the same value.\n\n");
+      printf("Forwarding Options:\n");
+      printf("  --pipeline <workers>              Receive on one lcore, run PoT on this many worker lcores and\n");
+      printf("                                    transmit in arrival order on one more. Needs workers + 3\n");
+      printf("                                    lcores. By default every lcore runs to completion on an\n");
+      printf("                                    RSS queue of its own.\n");
+      printf("  --eventdev <workers>              Run parse, PoT and TX as queues of the event_sw eventdev,\n");
+      printf("                                    flows balanced over this many worker lcores in per-flow\n");
+      printf("                                    order. Needs workers + 3 lcores.\n\n");
       printf("Other Options:\n");
       printf("  -h, --help                      Show this help message.\n");
       exit(EXIT_SUCCESS);
@@ -123,6 +278,24 @@ void parse_args(AppConfig* config, int argc, char* argv[]) {
     default: abort();
     }
   }
+
+  // The IOAM option has no SRH to encapsulate with, and the cryptodev jobs build the SRH's MAC input
+  if (config->pot_carrier == POT_CARRIER_IOAM &&
+      (config->srv6_encap || config->crypto_backend == CRYPTO_BACKEND_CRYPTODEV)) {
+    fprintf(stderr, "--carrier ioam cannot be combined with --srv6-mode encap or --crypto-backend cryptodev\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // The workers run the handlers to completion, cryptodev ops would finish after the burst has left them
+  if ((config->pipeline_workers > 0 || config->eventdev_workers > 0) &&
+      config->crypto_backend == CRYPTO_BACKEND_CRYPTODEV) {
+    fprintf(stderr, "--pipeline and --eventdev cannot be combined with --crypto-backend cryptodev\n");
+    exit(EXIT_FAILURE);
+  }
+  if (config->pipeline_workers > 0 && config->eventdev_workers > 0) {
+    fprintf(stderr, "--pipeline and --eventdev are alternatives, choose one\n");
+    exit(EXIT_FAILURE);
+  }
 }
 
 uint16_t add_timestamps(uint16_t port __rte_unused, uint16_t qidx __rte_unused, struct rte_mbuf** pkts,
@@ -134,14 +307,19 @@ uint16_t add_timestamps(uint16_t port __rte_unused, uint16_t qidx __rte_unused,
   return nb_pkts;
 }
 
-struct latency_numbers_t latency_numbers = {0, 0, 0};
+// Serializes the batch writes of the TX queues to the shared log file
+static rte_spinlock_t latency_log_lock = RTE_SPINLOCK_INITIALIZER;
 
-#define LATENCY_BATCH_SIZE 1000
-static double latency_buffer[LATENCY_BATCH_SIZE];
-static int latency_buffer_index = 0;
+struct latency_queue* latency_queue_alloc(uint16_t port_id) {
+  int socket_id = rte_eth_dev_socket_id(port_id);
+  if (socket_id < 0) socket_id = (int)rte_socket_id();
+  return rte_zmalloc_socket("latency_queue", sizeof(struct latency_queue), RTE_CACHE_LINE_SIZE, socket_id);
+}
 
-uint16_t calc_latency(uint16_t port, uint16_t qidx __rte_unused, struct rte_mbuf** pkts, uint16_t nb_pkts,
-                      void* _ __rte_unused) {
+uint16_t calc_latency(uint16_t port __rte_unused, uint16_t qidx __rte_unused, struct rte_mbuf** pkts,
+                      uint16_t nb_pkts, void* user_param) {
+  struct latency_queue* lq = user_param;
+  struct latency_numbers_t* latency_numbers = &lq->numbers;
   uint64_t cycles = 0;
   uint64_t now = rte_rdtsc();
   unsigned i;
@@ -150,29 +328,31 @@ uint16_t calc_latency(uint16_t port, uint16_t qidx __rte_unused, struct rte_mbuf
     cycles += now - *tsc_field(pkts[i]);
   }
 
-  latency_numbers.total_cycles += cycles;
-  latency_numbers.total_pkts += nb_pkts;
+  latency_numbers->total_cycles += cycles;
+  latency_numbers->total_pkts += nb_pkts;
 
-  if (latency_numbers.total_pkts > 0) {
-    double latency_us = (double)latency_numbers.total_cycles / rte_get_tsc_hz() * 1e6;
+  if (latency_numbers->total_pkts > 0) {
+    double latency_us = (double)latency_numbers->total_cycles / rte_get_tsc_hz() * 1e6;
     // Buffer the average latency
-    latency_buffer[latency_buffer_index++] = latency_us / latency_numbers.total_pkts;
+    lq->buffer[lq->buffer_index++] = latency_us / latency_numbers->total_pkts;
     // Reset counters
-    latency_numbers.total_cycles = 0;
-    latency_numbers.total_queue_cycles = 0;
-    latency_numbers.total_pkts = 0;
+    latency_numbers->total_cycles = 0;
+    latency_numbers->total_queue_cycles = 0;
+    latency_numbers->total_pkts = 0;
     // Write to file in batches
-    if (latency_buffer_index >= LATENCY_BATCH_SIZE) {
+    if (lq->buffer_index >= LATENCY_BATCH_SIZE) {
       char log_path[128];
       snprintf(log_path, sizeof(log_path), "/tmp/latency_%s-%d.log", get_role_name(global_role), g_node_index);
+      rte_spinlock_lock(&latency_log_lock);
       FILE *f = fopen(log_path, "a");
       if (f) {
         for (int j = 0; j < LATENCY_BATCH_SIZE; ++j) {
-          fprintf(f, "%.3f\n", latency_buffer[j]);
+          fprintf(f, "%.3f\n", lq->buffer[j]);
         }
         fclose(f);
       }
-      latency_buffer_index = 0;
+      rte_spinlock_unlock(&latency_log_lock);
+      lq->buffer_index = 0;
     }
   }
 